@@ -3,6 +3,7 @@ import sys
 import random
 import time
 import os
+import struct
 
 
 def rand_ipv4_string_batch(n):
@@ -26,9 +27,25 @@ def rand_ipv4_bin_batch(n):
         data[offset + 1] = 168
     return data
 
+def rand_ipv6_bin_batch(n):
+    """
+        Random IPv6 addresses in 2001:db8::/32, 16 bytes each in network byte order
+    """
+    data = bytearray(os.urandom(16 * n))
+    for i in range(n):
+        data[16 * i:16 * i + 4] = b"\x20\x01\x0d\xb8"
+    return data
+
+def ipv6_key_header():
+    """
+        Key header of an IPv6 input file (KeyFileHeader of src/headers/keys.h):
+        magic, version, header bytes, kind (1 = IPv6), record size, key offset, key width
+    """
+    return b"CMSKEYS1" + struct.pack("<6I", 1, 32, 1, 16, 0, 16)
+
 def main():
     if len(sys.argv) < 3 or len(sys.argv) > 5:
-        print("Usage: python data_generator.py <num_samples> <output_file> [text|bin] [duration_seconds]")
+        print("Usage: python data_generator.py <num_samples> <output_file> [text|bin|bin6] [duration_seconds]")
         sys.exit(1)
     
     # Parse arguments
@@ -52,7 +69,7 @@ def main():
             sys.exit(1)
 
     print(f"Generating {'up to '+str(num_samples) if not duration else f'for {duration} seconds'} "
-          f"IPv4 addresses in {file_format} format to {output_file}...")
+          f"{'IPv6' if file_format == 'bin6' else 'IPv4'} addresses in {file_format} format to {output_file}...")
 
     # Specify batch size for each generation
     batch_size = 2_097_152    # Since every IP is 4 bytes, this is 8MB per batch
@@ -64,8 +81,10 @@ def main():
     # Counter for written samples
     written = 0
 
-    mode = 'wb' if file_format == 'bin' else 'w'
+    mode = 'wb' if file_format in ("bin", "bin6") else 'w'
     with open(output_file, mode) as f:
+        if file_format == "bin6":
+            f.write(ipv6_key_header())
         
         while( (duration and time.time() < end) or         # Check time limit
               (not duration and written < num_samples)):   # Check sample limit
@@ -76,6 +95,8 @@ def main():
             if file_format == "text":
                 ips = rand_ipv4_string_batch(count)
                 f.write("\n".join(ips) + "\n")
+            elif file_format == "bin6":
+                f.write(rand_ipv6_bin_batch(count))
             else:
                 f.write(rand_ipv4_bin_batch(count))
             written += count
@@ -7,6 +7,12 @@ QUEUE="short_cpuQ"
 MEM="16gb"
 PLACEMENT="pack:excl"
 PARAMETERS="Parallel-Count-Min-sketch/data/data.bin Parallel-Count-Min-sketch/data/process_info.csv 0.01 0.99"
+# Configuration written by cms_tune (EPSILON, DELTA, CMS_OPTIONS), used instead of the values above if present
+TUNED_CONFIG="${BASE_DIR}/data/tuned.conf"
+if [ -f "$TUNED_CONFIG" ]; then
+  source "$TUNED_CONFIG"
+  PARAMETERS="Parallel-Count-Min-sketch/data/data.bin Parallel-Count-Min-sketch/data/process_info.csv $EPSILON $DELTA $CMS_OPTIONS"
+fi
 EXECUTABLE="${BASE_DIR}/bin/CMsketch"      # Path to the executable file
 TEMPLATE="${BASE_DIR}/scripts/job_template.sh"
 
@@ -6,4 +6,4 @@
 #set the queue  
 #PBS -q short_cpuQ   
 module load mpich-3.2
-mpirun.actual -n 5 ./Parallel-Count-Min-sketch/bin/CMsketch ./Parallel-Count-Min-sketch/data/data.bin ./Parallel-Count-Min-sketch/data/process_info.csv 0.01 0.99 -l pack:excl
\ No newline at end of file
+mpirun.actual -n 5 ./Parallel-Count-Min-sketch/bin/CMsketch ./Parallel-Count-Min-sketch/data/data.bin ./Parallel-Count-Min-sketch/data/process_info.csv 0.01 0.99
\ No newline at end of file
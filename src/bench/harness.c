@@ -0,0 +1,168 @@
+#define _DEFAULT_SOURCE // syscall
+#include "headers/bench_harness.h"
+#include "headers/cms.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ---------------- Hardware counters ---------------- */
+
+/*
+    Open the cycles, instructions, cache references and cache misses
+    counters of the calling thread, as one group so that they are
+    enabled and read together. Any failure leaves perf->available at 0.
+*/
+void bench_perf_open(BenchPerf *perf) {
+    perf->available = 0;
+    for (int i = 0; i < BENCH_N_EVENTS; i++)
+        perf->fds[i] = -1;
+#ifdef __linux__
+    const uint64_t events[BENCH_N_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES
+    };
+    for (int i = 0; i < BENCH_N_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = events[i];
+        attr.disabled = (i == 0);  // The group follows its leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        perf->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : perf->fds[0], 0);
+        if (perf->fds[i] == -1) {
+            bench_perf_close(perf);
+            return;
+        }
+    }
+    perf->available = 1;
+#endif
+}
+
+void bench_perf_start(BenchPerf *perf) {
+#ifdef __linux__
+    if (perf->available) {
+        ioctl(perf->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(perf->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    (void)perf;
+#endif
+}
+
+void bench_perf_stop(BenchPerf *perf, BenchCounters *counters) {
+    memset(counters, 0, sizeof(BenchCounters));
+#ifdef __linux__
+    if (!perf->available)
+        return;
+    ioctl(perf->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t values[BENCH_N_EVENTS];
+    for (int i = 0; i < BENCH_N_EVENTS; i++) {
+        if (read(perf->fds[i], &values[i], sizeof(uint64_t)) != (ssize_t)sizeof(uint64_t))
+            return;
+    }
+    counters->cycles = values[0];
+    counters->instructions = values[1];
+    counters->cache_references = values[2];
+    counters->cache_misses = values[3];
+    counters->valid = 1;
+#else
+    (void)perf;
+#endif
+}
+
+void bench_perf_close(BenchPerf *perf) {
+    for (int i = BENCH_N_EVENTS - 1; i >= 0; i--) {
+        if (perf->fds[i] != -1)
+            close(perf->fds[i]);
+        perf->fds[i] = -1;
+    }
+    perf->available = 0;
+}
+
+/* ---------------- JSON output ---------------- */
+
+static void json_key(BenchJson *json, const char *key) {
+    fprintf(json->out, "%s\"%s\": ", json->n_fields++ ? ", " : "", key);
+}
+
+void bench_json_open(BenchJson *json, FILE *out, const char *benchmark, const BenchPerf *perf) {
+    json->out = out;
+    json->n_records = 0;
+    json->n_fields = 0;
+    fprintf(out, "{\n  \"benchmark\": \"%s\",\n", benchmark);
+    fprintf(out, "  \"machine\": {\"l2_bytes\": %zu, \"llc_bytes\": %zu, \"cpus\": %ld, \"perf_counters\": %s},\n",
+            cms_cache_size(2), cms_cache_size(3), sysconf(_SC_NPROCESSORS_ONLN),
+            perf->available ? "true" : "false");
+    fprintf(out, "  \"results\": [\n");
+}
+
+void bench_json_record_begin(BenchJson *json) {
+    fprintf(json->out, "%s    {", json->n_records ? ",\n" : "");
+    json->n_fields = 0;
+}
+
+void bench_json_string(BenchJson *json, const char *key, const char *value) {
+    json_key(json, key);
+    fprintf(json->out, "\"%s\"", value);
+}
+
+void bench_json_number(BenchJson *json, const char *key, double value) {
+    json_key(json, key);
+    fprintf(json->out, "%.6g", value);
+}
+
+void bench_json_integer(BenchJson *json, const char *key, long long value) {
+    json_key(json, key);
+    fprintf(json->out, "%lld", value);
+}
+
+static void json_counter(BenchJson *json, const char *key, const BenchCounters *counters, uint64_t value) {
+    json_key(json, key);
+    if (counters->valid)
+        fprintf(json->out, "%llu", (unsigned long long)value);
+    else
+        fprintf(json->out, "null");
+}
+
+void bench_json_measure(BenchJson *json, const char *unit, double seconds, size_t n_items,
+                        const BenchCounters *counters) {
+    bench_json_string(json, "unit", unit);
+    bench_json_integer(json, "keys", (long long)n_items);
+    bench_json_number(json, "seconds", seconds);
+    bench_json_number(json, "ns_per_key", n_items ? seconds * 1e9 / n_items : 0.0);
+    bench_json_number(json, "keys_per_sec", seconds > 0.0 ? n_items / seconds : 0.0);
+    json_counter(json, "cycles", counters, counters->cycles);
+    json_counter(json, "instructions", counters, counters->instructions);
+    json_counter(json, "cache_references", counters, counters->cache_references);
+    json_counter(json, "cache_misses", counters, counters->cache_misses);
+    json_key(json, "cache_misses_per_key");
+    if (counters->valid && n_items)
+        fprintf(json->out, "%.6g", (double)counters->cache_misses / n_items);
+    else
+        fprintf(json->out, "null");
+}
+
+void bench_json_record_end(BenchJson *json) {
+    fprintf(json->out, "}");
+    json->n_records++;
+    fflush(json->out);
+}
+
+void bench_json_close(BenchJson *json) {
+    fprintf(json->out, "\n  ]\n}\n");
+    fflush(json->out);
+}
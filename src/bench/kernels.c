@@ -0,0 +1,398 @@
+#include "headers/cms.h"
+#include "headers/file_io.h"
+#include "headers/util.h"
+#include "headers/keygen.h"
+#include "headers/keys.h"
+#include "headers/bench_harness.h"
+
+/*
+    * Microbenchmarks of the sketch kernels
+    Times cms_hash, cms_update, cms_batch_update, cms_merge_into,
+    read_buffer and the key formats (key_extract then cms_batch_update)
+    in isolation over a sweep of epsilon/delta (table size and depth),
+    batch size and key distribution (uniform, and Zipf generated by
+    keygen), and prints one JSON document with ns/key, keys/s and the
+    hardware counters of every configuration (null when perf_event_open is
+    not available). Each measured region starts on a table that was
+    already touched, so page faults are not counted.
+    Usage: ./bench_kernels [n_keys] [hash,update,batch,merge,read,keys]
+*/
+
+#define ZIPF_DISTINCT (1 << 20)  // Distinct addresses of the Zipf keys
+#define ZIPF_SKEW 1.1
+#define N_DISTRIBUTIONS 2
+
+static const double epsilons[] = {1e-2, 1e-3, 1e-4, 1e-5};
+static const double deltas[] = {0.1, 0.01, 0.001};
+static const size_t batch_sizes[] = {256, 4096, 65536, 1 << 20};
+static const cms_hash_family families[] = {CMS_HASH_MODPRIME, CMS_HASH_MULTISHIFT, CMS_HASH_MERSENNE};
+static const cms_counter_width counter_widths[] = {CMS_COUNTER_8, CMS_COUNTER_16, CMS_COUNTER_32, CMS_COUNTER_64};
+static const char *key_formats[] = {"ipv4", "ipv6", "record:32:8:16", "record:64:0:48"};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+/*
+    Inputs shared by all the benchmarks: the same keys in the input file
+    format and as integers, for every distribution
+*/
+typedef struct {
+    BenchJson json;
+    BenchPerf perf;
+    size_t n_keys;
+    uint8_t *keys[N_DISTRIBUTIONS];
+    uint32_t *ints[N_DISTRIBUTIONS];
+} Bench;
+
+static volatile uint64_t sink;  // Keeps the hash results alive
+
+/*
+    Common fields of a record
+*/
+static void record_begin(Bench *bench, const char *kernel, const CountMinSketch *cms, double epsilon, double delta) {
+    bench_json_record_begin(&bench->json);
+    bench_json_string(&bench->json, "kernel", kernel);
+    if (cms) {
+        bench_json_number(&bench->json, "epsilon", epsilon);
+        bench_json_number(&bench->json, "delta", delta);
+        bench_json_integer(&bench->json, "width", cms->width);
+        bench_json_integer(&bench->json, "depth", cms->depth);
+        bench_json_integer(&bench->json, "table_bytes", (long long)cms_table_bytes(cms));
+        bench_json_string(&bench->json, "hash", cms_hash_family_name(cms->hash_family));
+        bench_json_string(&bench->json, "counters", cms_counter_width_name(cms->counters));
+    }
+}
+
+static CountMinSketch *create(double epsilon, double delta, cms_hash_family family, cms_counter_width counters) {
+    CmsConfig config;
+    cms_config_default(&config);
+    config.hash_family = family;
+    config.counters = counters;
+    CountMinSketch *cms = cms_create_from_error_ex(epsilon, delta, &config);
+    if (cms)
+        cms_clear(cms);  // Fault the table in before any measure
+    return cms;
+}
+
+/*
+    cms_hash of every row of every key, without touching the table
+*/
+static int bench_hash(Bench *bench) {
+    for (size_t f = 0; f < COUNT(families); f++)
+    for (size_t e = 0; e < COUNT(epsilons); e++)
+    for (size_t d = 0; d < COUNT(deltas); d++) {
+        CountMinSketch *cms = create(epsilons[e], deltas[d], families[f], CMS_COUNTER_32);
+        if (cms == NULL)
+            return -1;
+        const uint32_t *ints = bench->ints[KEYGEN_UNIFORM];
+        BenchCounters counters;
+        uint64_t acc = 0;
+        bench_perf_start(&bench->perf);
+        double start = bench_now();
+        for (size_t i = 0; i < bench->n_keys; i++)
+            for (int row = 0; row < cms->depth; row++)
+                acc += cms_hash(cms, ints[i], row);
+        double elapsed = bench_now() - start;
+        bench_perf_stop(&bench->perf, &counters);
+        sink = acc;
+
+        record_begin(bench, "hash", cms, epsilons[e], deltas[d]);
+        bench_json_string(&bench->json, "distribution", keygen_distribution_name(KEYGEN_UNIFORM));
+        bench_json_measure(&bench->json, "key", elapsed, bench->n_keys, &counters);
+        bench_json_record_end(&bench->json);
+        cms_free(cms);
+    }
+    return 0;
+}
+
+/*
+    cms_update key by key (the per-key kernel, specialized when possible)
+*/
+static int bench_update(Bench *bench) {
+    for (size_t f = 0; f < COUNT(families); f++)
+    for (size_t e = 0; e < COUNT(epsilons); e++)
+    for (size_t d = 0; d < COUNT(deltas); d++)
+    for (int k = 0; k < N_DISTRIBUTIONS; k++) {
+        CountMinSketch *cms = create(epsilons[e], deltas[d], families[f], CMS_COUNTER_32);
+        if (cms == NULL)
+            return -1;
+        const uint32_t *ints = bench->ints[k];
+        BenchCounters counters;
+        bench_perf_start(&bench->perf);
+        double start = bench_now();
+        for (size_t i = 0; i < bench->n_keys; i++)
+            cms_update(cms, ints[i]);
+        double elapsed = bench_now() - start;
+        bench_perf_stop(&bench->perf, &counters);
+
+        record_begin(bench, "update", cms, epsilons[e], deltas[d]);
+        bench_json_string(&bench->json, "distribution", keygen_distribution_name((keygen_distribution)k));
+        bench_json_string(&bench->json, "specialized", cms->specialized ? "yes" : "no");
+        bench_json_measure(&bench->json, "key", elapsed, bench->n_keys, &counters);
+        bench_json_record_end(&bench->json);
+        cms_free(cms);
+    }
+    return 0;
+}
+
+/*
+    cms_batch_update on batches of the given sizes (kernel and cache
+    strategy chosen by the auto modes, as in the main program)
+*/
+static int bench_batch(Bench *bench) {
+    const double delta = 0.01;
+    for (size_t f = 0; f < COUNT(families); f++)
+    for (size_t e = 0; e < COUNT(epsilons); e++)
+    for (size_t b = 0; b < COUNT(batch_sizes); b++)
+    for (int k = 0; k < N_DISTRIBUTIONS; k++) {
+        CountMinSketch *cms = create(epsilons[e], delta, families[f], CMS_COUNTER_32);
+        if (cms == NULL)
+            return -1;
+        const uint8_t *keys = bench->keys[k];
+        BenchCounters counters;
+        bench_perf_start(&bench->perf);
+        double start = bench_now();
+        for (size_t i = 0; i < bench->n_keys; i += batch_sizes[b]) {
+            size_t count = (bench->n_keys - i < batch_sizes[b]) ? bench->n_keys - i : batch_sizes[b];
+            cms_batch_update(cms, &keys[i * IP_SIZE], count);
+        }
+        double elapsed = bench_now() - start;
+        bench_perf_stop(&bench->perf, &counters);
+
+        record_begin(bench, "batch_update", cms, epsilons[e], delta);
+        bench_json_string(&bench->json, "distribution", keygen_distribution_name((keygen_distribution)k));
+        bench_json_integer(&bench->json, "batch", (long long)batch_sizes[b]);
+        bench_json_string(&bench->json, "vector_kernel", cms_kernel_name(cms->kernel));
+        bench_json_string(&bench->json, "update_mode", cms_update_mode_name(cms->update_mode));
+        bench_json_measure(&bench->json, "key", elapsed, bench->n_keys, &counters);
+        bench_json_record_end(&bench->json);
+        cms_free(cms);
+    }
+    return 0;
+}
+
+/*
+    cms_merge_into of a filled sketch, repeated until about n_keys cells
+    have been merged. With 8/16-bit counters the Zipf keys saturate cells,
+    so the cost of the overflow table shows up.
+*/
+static int bench_merge(Bench *bench) {
+    const cms_hash_family family = CMS_HASH_MULTISHIFT;
+    for (size_t c = 0; c < COUNT(counter_widths); c++)
+    for (size_t e = 0; e < COUNT(epsilons); e++)
+    for (size_t d = 0; d < COUNT(deltas); d++)
+    for (int k = 0; k < N_DISTRIBUTIONS; k++) {
+        CountMinSketch *src = create(epsilons[e], deltas[d], family, counter_widths[c]);
+        CountMinSketch *dest = create(epsilons[e], deltas[d], family, counter_widths[c]);
+        if (src == NULL || dest == NULL) {
+            if (src)
+                cms_free(src);
+            if (dest)
+                cms_free(dest);
+            return -1;
+        }
+        cms_batch_update(src, bench->keys[k], bench->n_keys);
+
+        size_t n_cells = (size_t)src->width * src->depth;
+        size_t repeats = (bench->n_keys > n_cells) ? bench->n_keys / n_cells : 1;
+        BenchCounters counters;
+        bench_perf_start(&bench->perf);
+        double start = bench_now();
+        for (size_t r = 0; r < repeats; r++)
+            cms_merge_into(dest, src);
+        double elapsed = bench_now() - start;
+        bench_perf_stop(&bench->perf, &counters);
+
+        record_begin(bench, "merge", src, epsilons[e], deltas[d]);
+        bench_json_string(&bench->json, "distribution", keygen_distribution_name((keygen_distribution)k));
+        bench_json_integer(&bench->json, "repeats", (long long)repeats);
+        bench_json_measure(&bench->json, "cell", elapsed, repeats * n_cells, &counters);
+        bench_json_record_end(&bench->json);
+        cms_free(src);
+        cms_free(dest);
+    }
+    return 0;
+}
+
+/*
+    Ingest of the records of every key format: key_extract of a batch
+    followed by cms_batch_update of its keys, as in the main program.
+    The records hold the keys of the distribution in their last 4 key
+    bytes, after a prefix that is the same for every record (a routing
+    prefix for IPv6), so every format counts the same keys.
+*/
+static int bench_keys(Bench *bench) {
+    const double epsilon = 1e-3, delta = 0.01;
+    const size_t batch = 65536;
+    uint8_t *out = malloc(batch * IP_SIZE);
+    int result = (out == NULL) ? -1 : 0;
+
+    for (size_t f = 0; f < COUNT(key_formats) && result == 0; f++)
+    for (int k = 0; k < N_DISTRIBUTIONS && result == 0; k++) {
+        KeyFormat fmt;
+        key_format_parse(key_formats[f], &fmt);
+        const size_t size = (size_t)fmt.record_size;
+        uint8_t *records = malloc(bench->n_keys * size);
+        CountMinSketch *cms = create(epsilon, delta, CMS_HASH_MULTISHIFT, CMS_COUNTER_32);
+        if (records == NULL || cms == NULL) {
+            free(records);
+            if (cms)
+                cms_free(cms);
+            result = -1;
+            break;
+        }
+        key_format_seed(&fmt, cms->seed);
+        memset(records, 0x20, bench->n_keys * size);
+        for (size_t i = 0; i < bench->n_keys; i++)
+            memcpy(records + i * size + fmt.key_offset + fmt.key_width - IP_SIZE, &bench->keys[k][i * IP_SIZE],
+                   IP_SIZE);
+
+        BenchCounters counters;
+        bench_perf_start(&bench->perf);
+        double start = bench_now();
+        for (size_t i = 0; i < bench->n_keys; i += batch) {
+            size_t count = (bench->n_keys - i < batch) ? bench->n_keys - i : batch;
+            if (key_format_native(&fmt)) {
+                cms_batch_update(cms, records + i * size, count);
+            } else {
+                key_extract(&fmt, records + i * size, count, out);
+                cms_batch_update(cms, out, count);
+            }
+        }
+        double elapsed = bench_now() - start;
+        bench_perf_stop(&bench->perf, &counters);
+
+        char text[64];
+        key_format_describe(&fmt, text, sizeof(text));
+        record_begin(bench, "key_ingest", cms, epsilon, delta);
+        bench_json_string(&bench->json, "distribution", keygen_distribution_name((keygen_distribution)k));
+        bench_json_string(&bench->json, "key_format", text);
+        bench_json_integer(&bench->json, "batch", (long long)batch);
+        bench_json_measure(&bench->json, "key", elapsed, bench->n_keys, &counters);
+        bench_json_record_end(&bench->json);
+        free(records);
+        cms_free(cms);
+    }
+    if (result != 0)
+        fprintf(stderr, "Error: failed to allocate the records of the key benchmark\n");
+    free(out);
+    return result;
+}
+
+/*
+    read_buffer of a temporary file of n_keys uniform keys, read whole
+    in chunks of every batch size. The file is read once before the
+    measures, so they show the cost of the MPI-IO path on cached pages
+    rather than the one of the storage.
+*/
+static int bench_read(Bench *bench) {
+    char path[] = "/tmp/bench_kernels_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        fprintf(stderr, "Error: cannot create a temporary file for the read benchmark\n");
+        return -1;
+    }
+    size_t bytes = bench->n_keys * IP_SIZE;
+    int written = (write(fd, bench->keys[KEYGEN_UNIFORM], bytes) == (ssize_t)bytes);
+    close(fd);
+    MPI_File fh = MPI_FILE_NULL;
+    if (!written || MPI_File_open(MPI_COMM_SELF, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        fprintf(stderr, "Error: cannot write and reopen %s\n", path);
+        remove(path);
+        return -1;
+    }
+    uint8_t *buffer = malloc(batch_sizes[COUNT(batch_sizes) - 1] * IP_SIZE);
+    int result = (buffer == NULL) ? -1 : 0;
+
+    for (int b = -1; b < (int)COUNT(batch_sizes) && result == 0; b++) {
+        // b = -1 is the untimed pass that loads the page cache
+        size_t chunk = batch_sizes[b < 0 ? COUNT(batch_sizes) - 1 : (size_t)b];
+        BenchCounters counters;
+        bench_perf_start(&bench->perf);
+        double start = bench_now();
+        for (size_t i = 0; i < bench->n_keys && result == 0; i += chunk) {
+            size_t count = (bench->n_keys - i < chunk) ? bench->n_keys - i : chunk;
+            if (read_buffer(fh, buffer, (MPI_Offset)i, (MPI_Offset)count) != (int)count)
+                result = -1;
+        }
+        double elapsed = bench_now() - start;
+        bench_perf_stop(&bench->perf, &counters);
+        if (b < 0 || result != 0)
+            continue;
+
+        record_begin(bench, "read_buffer", NULL, 0.0, 0.0);
+        bench_json_integer(&bench->json, "batch", (long long)chunk);
+        bench_json_number(&bench->json, "mib_per_sec", bytes / elapsed / (1024.0 * 1024.0));
+        bench_json_measure(&bench->json, "key", elapsed, bench->n_keys, &counters);
+        bench_json_record_end(&bench->json);
+    }
+    if (result != 0)
+        fprintf(stderr, "Error: read_buffer failed\n");
+
+    free(buffer);
+    MPI_File_close(&fh);
+    remove(path);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    MPI_Init(&argc, &argv);
+    int comm_sz;
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+    Bench bench;
+    bench.n_keys = 4 * 1024 * 1024;
+    const char *selected = "hash,update,batch,merge,read,keys";
+    if (argc > 1)
+        bench.n_keys = strtoull(argv[1], NULL, 10);
+    if (argc > 2)
+        selected = argv[2];
+    if (bench.n_keys == 0 || comm_sz != 1) {
+        fprintf(stderr, "Usage: %s [n_keys] [hash,update,batch,merge,read,keys] (single process)\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // The same keys for every configuration, whatever the selected benchmarks
+    int error = 0;
+    for (int k = 0; k < N_DISTRIBUTIONS; k++) {
+        KeyGenerator gen;
+        bench.keys[k] = malloc(bench.n_keys * IP_SIZE);
+        bench.ints[k] = malloc(bench.n_keys * sizeof(uint32_t));
+        if (bench.keys[k] == NULL || bench.ints[k] == NULL ||
+            keygen_init(&gen, (keygen_distribution)k, ZIPF_DISTINCT, ZIPF_SKEW, 0x9E3779B97F4A7C15ULL + k) == -1) {
+            fprintf(stderr, "Error allocating %zu keys\n", bench.n_keys);
+            error = 1;
+            continue;
+        }
+        keygen_fill(&gen, bench.keys[k], bench.n_keys);
+        for (size_t i = 0; i < bench.n_keys; i++)
+            bench.ints[k][i] = ip_to_int(&bench.keys[k][i * IP_SIZE]);
+        keygen_free(&gen);
+    }
+
+    if (!error) {
+        bench_perf_open(&bench.perf);
+        bench_json_open(&bench.json, stdout, "kernels", &bench.perf);
+        if (strstr(selected, "hash"))
+            error |= bench_hash(&bench) == -1;
+        if (!error && strstr(selected, "update"))
+            error |= bench_update(&bench) == -1;
+        if (!error && strstr(selected, "batch"))
+            error |= bench_batch(&bench) == -1;
+        if (!error && strstr(selected, "merge"))
+            error |= bench_merge(&bench) == -1;
+        if (!error && strstr(selected, "read"))
+            error |= bench_read(&bench) == -1;
+        if (!error && strstr(selected, "keys"))
+            error |= bench_keys(&bench) == -1;
+        bench_json_close(&bench.json);
+        bench_perf_close(&bench.perf);
+    }
+
+    for (int k = 0; k < N_DISTRIBUTIONS; k++) {
+        free(bench.keys[k]);
+        free(bench.ints[k]);
+    }
+    MPI_Finalize();
+    return error ? 1 : 0;
+}
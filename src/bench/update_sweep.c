@@ -0,0 +1,100 @@
+#include "headers/cms.h"
+
+#include <time.h>
+
+/*
+    * Benchmark of the cache strategies of the batch update
+    Sweeps epsilon (and so the table size) and measures the update time
+    per key of the direct, prefetch and partition paths on the same
+    uniform random keys, to show where the crossover happens on the
+    current machine. The mode chosen by CMS_UPDATE_AUTO is reported too.
+    Usage: ./bench_update_sweep [n_keys] [hash_family]
+*/
+
+#define BATCH_KEYS (1 << 20)  // Keys per cms_batch_update call, as a read chunk would do
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+    Fill buffer with n_keys random IPv4 addresses (xorshift64*)
+*/
+static void fill_keys(uint8_t *buffer, size_t n_keys, uint64_t seed) {
+    uint64_t state = seed;
+    for (size_t i = 0; i < n_keys; i++) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        uint32_t ip = (uint32_t)((state * 0x2545F4914F6CDD1DULL) >> 32);
+        buffer[i * IP_SIZE + 0] = (uint8_t)(ip >> 24);
+        buffer[i * IP_SIZE + 1] = (uint8_t)(ip >> 16);
+        buffer[i * IP_SIZE + 2] = (uint8_t)(ip >> 8);
+        buffer[i * IP_SIZE + 3] = (uint8_t)ip;
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t n_keys = 16 * 1024 * 1024;
+    CmsConfig config;
+    cms_config_default(&config);
+    config.hash_family = CMS_HASH_MULTISHIFT;
+
+    if (argc > 1)
+        n_keys = strtoull(argv[1], NULL, 10);
+    if (argc > 2 && cms_hash_family_parse(argv[2], &config.hash_family) == -1) {
+        fprintf(stderr, "Invalid hash family: '%s'\n", argv[2]);
+        return 1;
+    }
+    if (n_keys == 0) {
+        fprintf(stderr, "Usage: %s [n_keys] [modprime|multishift|mersenne]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t *keys = malloc(n_keys * IP_SIZE);
+    if (keys == NULL) {
+        fprintf(stderr, "Error allocating %zu keys\n", n_keys);
+        return 1;
+    }
+    fill_keys(keys, n_keys, 0x9E3779B97F4A7C15ULL);
+
+    const double epsilons[] = {1e-2, 1e-3, 1e-4, 3e-5, 1e-5, 3e-6, 1e-6};
+    const cms_update_mode modes[] = {CMS_UPDATE_DIRECT, CMS_UPDATE_PREFETCH, CMS_UPDATE_PARTITION};
+    const double delta = 0.01;
+
+    printf("# L2 %zu bytes, LLC %zu bytes, %zu keys, hash %s\n",
+           cms_cache_size(2), cms_cache_size(3), n_keys, cms_hash_family_name(config.hash_family));
+    printf("epsilon,width,depth,table_bytes,mode,auto_mode,ns_per_key\n");
+
+    for (size_t e = 0; e < sizeof(epsilons) / sizeof(epsilons[0]); e++) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            config.update_mode = CMS_UPDATE_AUTO;
+            CountMinSketch *cms = cms_create_from_error_ex(epsilons[e], delta, &config);
+            if (cms == NULL)
+                return 1;
+            cms_update_mode auto_mode = cms->update_mode;
+            if (cms_select_update_mode(cms, modes[m]) == -1) {
+                cms_free(cms);
+                return 1;
+            }
+
+            double start = now_seconds();
+            for (size_t i = 0; i < n_keys; i += BATCH_KEYS) {
+                size_t count = (n_keys - i < BATCH_KEYS) ? n_keys - i : BATCH_KEYS;
+                cms_batch_update(cms, &keys[i * IP_SIZE], count);
+            }
+            double elapsed = now_seconds() - start;
+
+            printf("%g,%d,%d,%zu,%s,%s,%.3f\n", epsilons[e], cms->width, cms->depth,
+                   (size_t)cms->width * cms->depth * sizeof(uint32_t),
+                   cms_update_mode_name(modes[m]), cms_update_mode_name(auto_mode),
+                   elapsed * 1e9 / n_keys);
+            cms_free(cms);
+        }
+    }
+
+    free(keys);
+    return 0;
+}
@@ -1,5 +1,149 @@
 #include "headers/cms.h"
 #include "headers/util.h"
+#include "headers/cms_kernels.h"
+#include "headers/cms_memory.h"
+
+#include <unistd.h>
+
+/*
+    Fill config with the default settings (original modulo-prime hash family)
+*/
+void cms_config_default(CmsConfig *config) {
+    config->hash_family = CMS_HASH_MODPRIME;
+    config->kernel = CMS_KERNEL_AUTO;
+    config->update_mode = CMS_UPDATE_AUTO;
+    config->specialize = 1;
+    config->counters = CMS_COUNTER_32;
+    config->conservative = 0;
+    config->cells = NULL;
+    config->seed = CMS_DEFAULT_SEED;
+    config->key_width = IP_SIZE;
+}
+
+/*
+    Convert the command-line name of a hash family to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int cms_hash_family_parse(const char *name, cms_hash_family *family) {
+    if (strcmp(name, "modprime") == 0)
+        *family = CMS_HASH_MODPRIME;
+    else if (strcmp(name, "multishift") == 0)
+        *family = CMS_HASH_MULTISHIFT;
+    else if (strcmp(name, "mersenne") == 0)
+        *family = CMS_HASH_MERSENNE;
+    else
+        return -1;
+    return 0;
+}
+
+const char *cms_hash_family_name(cms_hash_family family) {
+    switch (family) {
+        case CMS_HASH_MODPRIME:   return "modprime";
+        case CMS_HASH_MULTISHIFT: return "multishift";
+        case CMS_HASH_MERSENNE:   return "mersenne";
+    }
+    return "unknown";
+}
+
+/*
+    Convert the command-line name of a batch kernel to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int cms_kernel_parse(const char *name, cms_kernel *kernel) {
+    if (strcmp(name, "auto") == 0)
+        *kernel = CMS_KERNEL_AUTO;
+    else if (strcmp(name, "scalar") == 0)
+        *kernel = CMS_KERNEL_SCALAR;
+    else if (strcmp(name, "avx2") == 0)
+        *kernel = CMS_KERNEL_AVX2;
+    else if (strcmp(name, "avx512") == 0)
+        *kernel = CMS_KERNEL_AVX512;
+    else
+        return -1;
+    return 0;
+}
+
+const char *cms_kernel_name(cms_kernel kernel) {
+    switch (kernel) {
+        case CMS_KERNEL_AUTO:   return "auto";
+        case CMS_KERNEL_SCALAR: return "scalar";
+        case CMS_KERNEL_AVX2:   return "avx2";
+        case CMS_KERNEL_AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+/*
+    Convert the command-line name of a cache strategy to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int cms_update_mode_parse(const char *name, cms_update_mode *mode) {
+    if (strcmp(name, "auto") == 0)
+        *mode = CMS_UPDATE_AUTO;
+    else if (strcmp(name, "direct") == 0)
+        *mode = CMS_UPDATE_DIRECT;
+    else if (strcmp(name, "prefetch") == 0)
+        *mode = CMS_UPDATE_PREFETCH;
+    else if (strcmp(name, "partition") == 0)
+        *mode = CMS_UPDATE_PARTITION;
+    else
+        return -1;
+    return 0;
+}
+
+const char *cms_update_mode_name(cms_update_mode mode) {
+    switch (mode) {
+        case CMS_UPDATE_AUTO:      return "auto";
+        case CMS_UPDATE_DIRECT:    return "direct";
+        case CMS_UPDATE_PREFETCH:  return "prefetch";
+        case CMS_UPDATE_PARTITION: return "partition";
+    }
+    return "unknown";
+}
+
+/*
+    Select the batch update kernel of the sketch.
+    CMS_KERNEL_AUTO picks the widest kernel the CPU supports. The vector
+    kernels only implement the multiply-shift family: for the others, or
+    if the CPU lacks the instructions, the scalar kernel is used.
+    Returns 0 if the requested kernel is in use, -1 if it fell back to scalar.
+*/
+int cms_select_kernel(CountMinSketch *cms, cms_kernel kernel) {
+    // The vector kernels do the standard update of 32-bit cells
+    int vectorizable = (cms->hash_family == CMS_HASH_MULTISHIFT && cms->counters == CMS_COUNTER_32 &&
+                        !cms->conservative);
+    if (kernel == CMS_KERNEL_AUTO) {
+        if (vectorizable && cms_kernel_supported(CMS_KERNEL_AVX512))
+            kernel = CMS_KERNEL_AVX512;
+        else if (vectorizable && cms_kernel_supported(CMS_KERNEL_AVX2))
+            kernel = CMS_KERNEL_AVX2;
+        else
+            kernel = CMS_KERNEL_SCALAR;
+    }
+
+    int result = 0;
+    if (kernel != CMS_KERNEL_SCALAR && (!vectorizable || !cms_kernel_supported(kernel))) {
+        kernel = CMS_KERNEL_SCALAR;
+        result = -1;
+    }
+
+    cms->kernel = kernel;
+    switch (kernel) {
+        case CMS_KERNEL_AVX2:
+            cms->batch_update = cms_batch_update_avx2;
+            cms->batch_query = cms_batch_query_avx2;
+            break;
+        case CMS_KERNEL_AVX512:
+            cms->batch_update = cms_batch_update_avx512;
+            cms->batch_query = cms_batch_query_avx512;
+            break;
+        default:
+            cms->batch_update = cms->scalar_batch;
+            cms->batch_query = cms_batch_query_scalar;
+            break;
+    }
+    return result;
+}
 
 /* 
     Create a Count-Min Sketch from the given error parameters
@@ -7,14 +151,39 @@
    - delta: The desired confidence level (probabilistic)
 */
 CountMinSketch * cms_create_from_error(double epsilon, double delta) {
-    if (epsilon <= 0.0 || delta <= 0.0 || delta >= 1.0) return NULL;
-    const double E = 2.718281828459045;
+    return cms_create_from_error_ex(epsilon, delta, NULL);
+}
+
+/*
+    Same as cms_create_from_error, with an explicit configuration
+    (NULL selects the defaults)
+*/
+CountMinSketch * cms_create_from_error_ex(double epsilon, double delta, const CmsConfig *config) {
+    int w, d;
+    if (cms_dimensions_from_error(epsilon, delta, &w, &d) == -1) return NULL;
+    // Create the Count-Min Sketch with calculated dimensions
+    return cms_create_ex(w, d, config);
+}
+
+/*
+    Dimensions of a sketch with error rate epsilon and failure probability delta
+    Returns 0 on success, -1 if the parameters are out of range.
+*/
+int cms_dimensions_from_error(double epsilon, double delta, int *width, int *depth) {
+    if (epsilon <= 0.0 || delta <= 0.0 || delta >= 1.0) return -1;
     // Number of columns (width)
-    int w = (int)ceil(E / epsilon);
+    *width = (int)ceil(CMS_E / epsilon);
     // Number of rows (depth)
-    int d = (int)ceil(log(1.0 / delta));
-    // Create the Count-Min Sketch with calculated dimensions
-    return cms_create(w, d);
+    *depth = (int)ceil(log(1.0 / delta));
+    return 0;
+}
+
+/*
+    Error rate of a sketch (the inverse of the width bound): an estimate
+    exceeds the count by at most error_rate * keys with probability 1 - e^-depth
+*/
+double cms_error_rate(const CountMinSketch *cms) {
+    return CMS_E / cms->width;
 }
 
 /* 
@@ -23,8 +192,79 @@ CountMinSketch * cms_create_from_error(double epsilon, double delta) {
     - depth: number of rows (hash functions)
 */
 CountMinSketch * cms_create(int width, int depth) {
+    return cms_create_ex(width, depth, NULL);
+}
+
+/*
+    Draw the hash parameters of every row from seed with splitmix64.
+    - modprime: a in [1, p-1], b in [0, p-1]; a*x + b is computed on
+      64 bits so it never wraps before the modulo
+    - multishift: a, b uniform 64-bit (Dietzfelbinger's multiply-add-shift,
+      pairwise independent for 32-bit keys and up to 2^31 columns)
+    - mersenne: a in [1, p-1], b in [0, p-1] with p = 2^61 - 1
+    Sketches with the same seed, family and depth hash identically, so
+    they can be merged whichever rank or binary built them.
+*/
+void cms_seed_hashes(CountMinSketch *cms, uint64_t seed) {
+    uint64_t state = seed;
+    cms->seed = seed;
+    for (int i = 0; i < cms->depth; i++) {
+        uint64_t a = cms_splitmix64(&state);
+        uint64_t b = cms_splitmix64(&state);
+        switch (cms->hash_family) {
+            case CMS_HASH_MULTISHIFT:
+                cms->hash_a[i] = a;
+                cms->hash_b[i] = b;
+                break;
+            case CMS_HASH_MERSENNE:
+                cms->hash_a[i] = 1 + a % (CMS_MERSENNE_61 - 1);
+                cms->hash_b[i] = b % CMS_MERSENNE_61;
+                break;
+            case CMS_HASH_MODPRIME:
+            default:
+                cms->hash_a[i] = 1 + a % (cms->prime - 1);
+                cms->hash_b[i] = b % cms->prime;
+                break;
+        }
+    }
+}
+
+/*
+    Seed that differs from run to run (time and process id), for
+    --seed=random. Only one rank should draw it and share it.
+*/
+uint64_t cms_random_seed(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t state = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+    return cms_splitmix64(&state);
+}
+
+/*
+    Same as cms_create, with an explicit configuration (NULL selects the defaults).
+    With CMS_HASH_MULTISHIFT the width is rounded up to the next power of two:
+    the sketch gets wider, so the epsilon guarantee still holds.
+*/
+CountMinSketch * cms_create_ex(int width, int depth, const CmsConfig *config) {
+    CmsConfig defaults;
+    if (config == NULL) {
+        cms_config_default(&defaults);
+        config = &defaults;
+    }
     if (width < 1) width = 1;
     if (depth < 1) depth = 1;
+
+    // Multiply-shift needs a power of two width (at least 2 to keep the shift < 64)
+    int shift = 64;
+    if (config->hash_family == CMS_HASH_MULTISHIFT) {
+        int pow2 = 2;
+        shift = 63;
+        while (pow2 < width && pow2 < (1 << 30)) {
+            pow2 <<= 1;
+            shift--;
+        }
+        width = pow2;
+    }
     
     // Allocate memory for CountMinSketch structure
     CountMinSketch *cms = malloc(sizeof(CountMinSketch));
@@ -34,55 +274,81 @@ CountMinSketch * cms_create(int width, int depth) {
     }
     cms->width = width;
     cms->depth = depth;
-    // Allocate the cms table, initialized as zeros
-    cms->table = calloc(width * depth, sizeof(uint32_t));
-    if (cms->table == NULL) {
+    cms->hash_family = config->hash_family;
+    cms->hash_shift = shift;
+    cms->scratch = NULL;
+    cms->update_one = cms_update_generic;
+    cms->query_one = cms_query_generic;
+    cms->cells_one = cms_cells_generic;
+    cms->scalar_batch = cms_batch_update_scalar;
+    cms->counters = config->counters;
+    cms->conservative = config->conservative;
+    cms->key_width = config->key_width;
+    cms->overflow = NULL;
+    cms->overflow_failed = 0;
+    cms->cell_size = cms_counter_cell_size(cms->counters);
+    // Allocate the cms table, initialized as zeros, unless the caller provides it
+    cms->owns_cells = (config->cells == NULL);
+    cms->cells = cms->owns_cells ? cms_mem_alloc((size_t)width * depth * cms->cell_size, CMS_MEM_TABLE)
+                                 : config->cells;
+    if (cms->cells == NULL) {
         fprintf(stderr, "Error: failed to allocate memory for table.\n");
         free(cms);
         return NULL;
     }
+    cms->table = (cms->counters == CMS_COUNTER_32) ? cms->cells : NULL;
     /* 
         Allocate hash function parameters. Every hash function will use
         2 parameters and the table needs n_rows many hash functions.
         This way we can define a family of pairwise indipendent functions
     */
-    cms->hash_a = malloc(depth * sizeof(uint32_t));
+    cms->hash_a = malloc(depth * sizeof(uint64_t));
     if (cms->hash_a == NULL) {
         fprintf(stderr, "Error: failed to allocate memory for hash_a.\n");
-        free(cms->table);
+        if (cms->owns_cells)
+            cms_mem_free(cms->cells, (size_t)width * depth * cms->cell_size);
         free(cms);
         return NULL;
     }
-    cms->hash_b = malloc(depth * sizeof(uint32_t));
-        if (cms->hash_b == NULL) {
+    cms->hash_b = malloc(depth * sizeof(uint64_t));
+    if (cms->hash_b == NULL) {
         fprintf(stderr, "Error: failed to allocate memory for hash_b.\n");
         free(cms->hash_a);
-        free(cms->table);
+        if (cms->owns_cells)
+            cms_mem_free(cms->cells, (size_t)width * depth * cms->cell_size);
         free(cms);
         return NULL;
     }
-    srand(0);
     // Use a large prime number
     cms->prime = 4294967291U;
-    
-    // Initialize parameters for all hash functions 
-    for (int i = 0; i < depth; i++) {
-        cms->hash_a[i] = rand() % cms->prime;
-        cms->hash_b[i] = rand() % cms->prime;
+    // Initialize parameters for all hash functions
+    cms_seed_hashes(cms, config->seed);
+
+    // Now that the dimensions are known, pay for the generality only once
+    cms->specialized = config->specialize ? cms_select_specialized(cms) : 0;
+    if (cms->counters != CMS_COUNTER_32 || cms->conservative) {
+        if (cms->counters == CMS_COUNTER_8 || cms->counters == CMS_COUNTER_16)
+            cms->overflow = cms_overflow_create();
+        if (cms_select_counter_kernels(cms) == -1 ||
+            ((cms->counters == CMS_COUNTER_8 || cms->counters == CMS_COUNTER_16) && cms->overflow == NULL)) {
+            cms_free(cms);
+            return NULL;
+        }
+    }
+
+    if (cms_select_kernel(cms, config->kernel) == -1) {
+        fprintf(stderr, "Warning: %s kernel not available for the %s hash or on this CPU, using %s.\n",
+                cms_kernel_name(config->kernel), cms_hash_family_name(cms->hash_family),
+                cms_kernel_name(cms->kernel));
+    }
+    if (cms_select_update_mode(cms, config->update_mode) == -1) {
+        cms_free(cms);
+        return NULL;
     }
     
     return cms;
 }
 
-/*
-    Universal Hash function for Count-Min Sketch.
-        h_a,b(x) = ax + b
-    The function must return an index [0, width - 1]
-*/
-uint32_t cms_hash(CountMinSketch *cms, uint32_t x, int row) {
-    return ((cms->hash_a[row] * x + cms->hash_b[row]) % cms->prime) % cms->width;
-}
-
 /*
     Update the Count-Min Sketch table for a single value x
 
@@ -94,32 +360,64 @@ uint32_t cms_hash(CountMinSketch *cms, uint32_t x, int row) {
     x   - the value to insert/update in the sketch (uint32_t, 32-bit unsigned integer)
 */
 void cms_update(CountMinSketch *cms, uint32_t x) {
+    cms->update_one(cms, x);
+}
+
+/*
+    Query the estimated count of x: the minimum of its counters over the rows
+*/
+uint64_t cms_query(const CountMinSketch *cms, uint32_t x) {
+    return cms->query_one(cms, x);
+}
+
+/*
+    Generic update kernel, for any depth and width
+*/
+void cms_update_generic(CountMinSketch *cms, uint32_t x) {
     for (int row = 0; row < cms->depth; row++) {
         int column = cms_hash(cms, x, row);
         cms->table[row * cms->width + column]++;
     }
 }
 
+/*
+    Generic query kernel, for any depth and width
+*/
+uint64_t cms_query_generic(const CountMinSketch *cms, uint32_t x) {
+    uint32_t min_count = UINT32_MAX;
+    for (int row = 0; row < cms->depth; row++) {
+        uint32_t count = cms->table[row * cms->width + cms_hash(cms, x, row)];
+        if (count < min_count)
+            min_count = count;
+    }
+    return min_count;
+}
+
+/*
+    Generic cell index kernel, for any depth and width
+*/
+void cms_cells_generic(const CountMinSketch *cms, uint32_t x, size_t *cells) {
+    for (int row = 0; row < cms->depth; row++)
+        cells[row] = (size_t)row * cms->width + cms_hash(cms, x, row);
+}
+
 /*
     Debug function to print the Count-Min Sketch table occurrences
 */
 void cms_debug_print(CountMinSketch *cms) {
-    int count = 0;
+    unsigned long long count = 0;
     for (int row = 0; row < cms->depth; row++) {
-        for (int col = 0; col < cms->width; col++) {
-            if(cms->table[row * cms->width + col] > 0)
-                count += cms->table[row * cms->width + col]; 
-        }
+        for (int col = 0; col < cms->width; col++)
+            count += cms_cell_value(cms, (size_t)row * cms->width + col);
     }
-    printf("There are %d occurences\n", count);
+    printf("There are %llu occurences\n", count);
 }
 
 /*
     Update the Count-Min Sketch with multiple keys at once
 
-    This function iterates over an array of keys, converts each key
-    (e.g., an IP address) into an integer representation, and updates
-    the Count-Min Sketch counters accordingly
+    Dispatches to the batch kernel selected when the sketch was created
+    (scalar, AVX2 or AVX-512, see cms_select_kernel)
 
     Parameters:
     cms    - pointer to the Count-Min Sketch data structure
@@ -127,18 +425,124 @@ void cms_debug_print(CountMinSketch *cms) {
     n_keys - number of keys in the array
 */
 void cms_batch_update(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) {
+    cms->batch_update(cms, keys, n_keys);
+}
+
+/*
+    Scalar batch kernel
+
+    This function iterates over an array of keys, converts each key
+    (e.g., an IP address) into an integer representation, and updates
+    the Count-Min Sketch counters accordingly
+*/
+void cms_batch_update_scalar(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) {
     for (size_t i = 0; i < n_keys; i++) {
         uint32_t key_int = ip_to_int(&keys[i * IP_SIZE]); 
-        cms_update(cms, key_int);
+        cms_update_generic(cms, key_int);
     }
 }
 
+/*
+    Estimate the counts of a batch of keys
+
+    Parameters:
+    cms       - pointer to the Count-Min Sketch data structure
+    keys      - pointer to the array of keys (each of size IP_SIZE)
+    n_keys    - number of keys in the array
+    estimates - receives the n_keys estimates, in the order of the keys
+*/
+void cms_batch_query(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint64_t *estimates) {
+    cms->batch_query(cms, keys, n_keys, estimates);
+}
+
+/*
+    Scalar batch query kernel, on top of the (possibly specialized) point query
+*/
+void cms_batch_query_scalar(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint64_t *estimates) {
+    for (size_t i = 0; i < n_keys; i++)
+        estimates[i] = cms->query_one(cms, ip_to_int(&keys[i * IP_SIZE]));
+}
+
+/*
+    Thread-safe variant of cms_batch_update for a table shared by several threads
+
+    Every cell is incremented with a relaxed atomic add: the counters only
+    need to be correct once all the threads are done, so no ordering
+    between the increments is required.
+*/
+void cms_batch_update_atomic(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) {
+    for (size_t i = 0; i < n_keys; i++) {
+        uint32_t key_int = ip_to_int(&keys[i * IP_SIZE]);
+        for (int row = 0; row < cms->depth; row++) {
+            int column = cms_hash(cms, key_int, row);
+            __atomic_fetch_add(&cms->table[row * cms->width + column], 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+    Update only the cells with flattened index in [cell_lo, cell_hi)
+
+    Used for striped ownership of a shared table: each thread owns a
+    contiguous range of cells (whole rows, or a block of columns when there
+    are more threads than rows) and walks the whole buffer, touching only
+    its own cells, so no synchronization is needed.
+*/
+void cms_batch_update_range(CountMinSketch *cms, const uint8_t *keys, size_t n_keys,
+                            size_t cell_lo, size_t cell_hi) {
+    if (cell_lo >= cell_hi)
+        return;
+    int row_lo = (int)(cell_lo / cms->width);
+    int row_hi = (int)((cell_hi - 1) / cms->width) + 1;
+    for (size_t i = 0; i < n_keys; i++) {
+        uint32_t key_int = ip_to_int(&keys[i * IP_SIZE]);
+        for (int row = row_lo; row < row_hi; row++) {
+            size_t cell = (size_t)row * cms->width + cms_hash(cms, key_int, row);
+            if (cell >= cell_lo && cell < cell_hi)
+                cms->table[cell]++;
+        }
+    }
+}
+
+/*
+    Merge the counters of src into dest (element-wise sum)
+
+    Both sketches must have been created with the same dimensions and the
+    same hash parameters, otherwise the sum has no meaning.
+*/
+void cms_merge_into(CountMinSketch *dest, const CountMinSketch *src) {
+    if (dest->width != src->width || dest->depth != src->depth) {
+        fprintf(stderr, "Error: cannot merge sketches of different size (%dx%d vs %dx%d).\n",
+                dest->depth, dest->width, src->depth, src->width);
+        return;
+    }
+    if (dest->hash_family != src->hash_family) {
+        fprintf(stderr, "Error: cannot merge sketches built with different hash families.\n");
+        return;
+    }
+    if (memcmp(dest->hash_a, src->hash_a, dest->depth * sizeof(uint64_t)) != 0 ||
+        memcmp(dest->hash_b, src->hash_b, dest->depth * sizeof(uint64_t)) != 0) {
+        fprintf(stderr, "Error: cannot merge sketches built with different hash parameters (seeds %llu and %llu).\n",
+                (unsigned long long)dest->seed, (unsigned long long)src->seed);
+        return;
+    }
+    if (dest->counters != src->counters) {
+        fprintf(stderr, "Error: cannot merge sketches with %s and %s-bit counters.\n",
+                cms_counter_width_name(dest->counters), cms_counter_width_name(src->counters));
+        return;
+    }
+    cms_merge_cells(dest, src);
+}
+
 /*
     Free all the memory allocated for Count-Min Sketch
 */
 void cms_free(CountMinSketch *cms) {
-    free(cms->table);
+    if (cms->owns_cells)
+        cms_mem_free(cms->cells, cms_table_bytes(cms));
+    cms_overflow_free(cms->overflow);
     free(cms->hash_a);
     free(cms->hash_b);
-    free(cms);      
-}
\ No newline at end of file
+    free(cms->scratch);
+    free(cms);
+}
@@ -0,0 +1,236 @@
+#include "headers/cms_kernels.h"
+#include "headers/util.h"
+
+#include <unistd.h>
+
+/*
+    Cache-aware batch update paths for tables that do not fit in L2.
+
+    With a large table every cms_update makes depth random writes that miss
+    the cache. Two strategies are available:
+    - prefetch: the cells of the next group of keys are computed and
+      prefetched while the increments of the current group are applied
+    - partition: the cells of a block of keys are radix-partitioned into
+      buckets covering a cache-sized slice of the table, then the
+      increments of each bucket are applied together
+*/
+
+#define PREFETCH_KEYS 16      // Keys per prefetch group (lookahead of one group)
+#define PARTITION_KEYS 4096   // Keys per partitioned block
+#define PARTITION_MAX_BUCKETS 1024
+
+/*
+    Size in bytes of the data/unified cache of the given level (1, 2, 3),
+    read from sysfs. Returns 0 if it cannot be detected.
+*/
+size_t cms_cache_size(int level) {
+    for (int index = 0; index < 8; index++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            break;
+        int cache_level = 0;
+        int ok = fscanf(fp, "%d", &cache_level) == 1;
+        fclose(fp);
+        if (!ok || cache_level != level)
+            continue;
+
+        // Skip instruction caches
+        char type[32] = "";
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        fp = fopen(path, "r");
+        if (fp != NULL) {
+            ok = fscanf(fp, "%31s", type) == 1;
+            fclose(fp);
+            if (ok && strcmp(type, "Instruction") == 0)
+                continue;
+        }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        unsigned long size = 0;
+        char unit = 0;
+        int n = fscanf(fp, "%lu%c", &size, &unit);
+        fclose(fp);
+        if (n < 1)
+            continue;
+        if (n == 2 && unit == 'K') size *= 1024UL;
+        if (n == 2 && unit == 'M') size *= 1024UL * 1024UL;
+        return (size_t)size;
+    }
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    // glibc fallback when sysfs is not available
+    long size = -1;
+    if (level == 1) size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    if (level == 2) size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (level == 3) size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (size > 0)
+        return (size_t)size;
+#endif
+    return 0;
+}
+
+/*
+    Flattened cell indices (row * width + column) of the given keys,
+    laid out key-major: cells[k * depth + row]
+*/
+static inline void compute_cells(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint32_t *cells) {
+    if (cms->hash_family == CMS_HASH_MULTISHIFT) {
+        // Branch-free loop the compiler can vectorize
+        for (size_t k = 0; k < n_keys; k++) {
+            uint64_t key_int = ip_to_int(&keys[k * IP_SIZE]);
+            for (int row = 0; row < cms->depth; row++)
+                cells[k * cms->depth + row] = (uint32_t)row * cms->width +
+                    (uint32_t)((cms->hash_a[row] * key_int + cms->hash_b[row]) >> cms->hash_shift);
+        }
+        return;
+    }
+    for (size_t k = 0; k < n_keys; k++) {
+        uint32_t key_int = ip_to_int(&keys[k * IP_SIZE]);
+        for (int row = 0; row < cms->depth; row++)
+            cells[k * cms->depth + row] = (uint32_t)row * cms->width + cms_hash(cms, key_int, row);
+    }
+}
+
+/*
+    Software-prefetching batch kernel
+*/
+void cms_batch_update_prefetch(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) {
+    uint32_t *table = cms->table;
+    uint32_t *current = cms->scratch;
+    uint32_t *next = cms->scratch + (size_t)PREFETCH_KEYS * cms->depth;
+
+    size_t group = (n_keys < PREFETCH_KEYS) ? n_keys : PREFETCH_KEYS;
+    compute_cells(cms, keys, group, current);
+
+    for (size_t i = 0; i < n_keys; i += PREFETCH_KEYS) {
+        size_t n_current = (n_keys - i < PREFETCH_KEYS) ? n_keys - i : PREFETCH_KEYS;
+
+        // Compute and prefetch the cells of the next group
+        size_t next_start = i + PREFETCH_KEYS;
+        size_t n_next = 0;
+        if (next_start < n_keys) {
+            n_next = (n_keys - next_start < PREFETCH_KEYS) ? n_keys - next_start : PREFETCH_KEYS;
+            compute_cells(cms, &keys[next_start * IP_SIZE], n_next, next);
+            for (size_t c = 0; c < n_next * cms->depth; c++)
+                __builtin_prefetch(&table[next[c]], 1, 0);
+        }
+
+        // Apply the increments of the current group
+        for (size_t c = 0; c < n_current * cms->depth; c++)
+            table[current[c]]++;
+
+        uint32_t *tmp = current;
+        current = next;
+        next = tmp;
+    }
+}
+
+/*
+    Radix-partitioned batch kernel
+*/
+void cms_batch_update_partition(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) {
+    uint32_t *table = cms->table;
+    uint32_t *cells = cms->scratch;
+    uint32_t *sorted = cms->scratch + (size_t)PARTITION_KEYS * cms->depth;
+    const int shift = cms->bucket_shift;
+    const int n_buckets = cms->n_buckets;
+    size_t offsets[PARTITION_MAX_BUCKETS];
+
+    for (size_t i = 0; i < n_keys; i += PARTITION_KEYS) {
+        size_t n_block = (n_keys - i < PARTITION_KEYS) ? n_keys - i : PARTITION_KEYS;
+        size_t n_cells = n_block * cms->depth;
+        compute_cells(cms, &keys[i * IP_SIZE], n_block, cells);
+
+        // Histogram and exclusive prefix sum of the bucket sizes
+        memset(offsets, 0, n_buckets * sizeof(size_t));
+        for (size_t c = 0; c < n_cells; c++)
+            offsets[cells[c] >> shift]++;
+        size_t sum = 0;
+        for (int b = 0; b < n_buckets; b++) {
+            size_t count = offsets[b];
+            offsets[b] = sum;
+            sum += count;
+        }
+
+        // Scatter into buckets, then apply them in table order
+        for (size_t c = 0; c < n_cells; c++)
+            sorted[offsets[cells[c] >> shift]++] = cells[c];
+        for (size_t c = 0; c < n_cells; c++)
+            table[sorted[c]]++;
+    }
+}
+
+/*
+    Choose the cache strategy of the sketch and prepare its scratch space.
+    CMS_UPDATE_AUTO compares the table size with the detected caches:
+    direct updates while the table fits in L2, prefetching while it fits
+    in this core's share of the last level cache, radix partitioning
+    beyond that. The crossovers depend on the machine: bench_update_sweep
+    measures them.
+    The direct mode keeps the kernel chosen by cms_select_kernel.
+    Returns 0 on success, -1 if the scratch space cannot be allocated.
+*/
+int cms_select_update_mode(CountMinSketch *cms, cms_update_mode mode) {
+    size_t n_cells = (size_t)cms->width * cms->depth;
+    size_t table_bytes = n_cells * sizeof(uint32_t);
+
+    // The cache-aware paths only implement the standard update of 32-bit cells
+    if (cms->counters != CMS_COUNTER_32 || cms->conservative)
+        mode = CMS_UPDATE_DIRECT;
+
+    if (mode == CMS_UPDATE_AUTO) {
+        size_t l2 = cms_cache_size(2);
+        size_t llc = cms_cache_size(3);
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (llc == 0)
+            llc = l2;
+        if (n_cpus > 1)
+            llc /= (size_t)n_cpus;
+        if (l2 == 0 || table_bytes <= l2)
+            mode = CMS_UPDATE_DIRECT;
+        else if (table_bytes <= llc)
+            mode = CMS_UPDATE_PREFETCH;
+        else
+            mode = CMS_UPDATE_PARTITION;
+    }
+
+    free(cms->scratch);
+    cms->scratch = NULL;
+    cms->update_mode = mode;
+    if (mode == CMS_UPDATE_DIRECT) {
+        // Back to the hashing kernel selected at creation
+        cms_select_kernel(cms, cms->kernel);
+        return 0;
+    }
+
+    size_t keys_per_block = (mode == CMS_UPDATE_PREFETCH) ? PREFETCH_KEYS : PARTITION_KEYS;
+    cms->scratch = malloc(2 * keys_per_block * cms->depth * sizeof(uint32_t));
+    if (cms->scratch == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for the update scratch space.\n");
+        cms->update_mode = CMS_UPDATE_DIRECT;
+        cms_select_kernel(cms, cms->kernel);
+        return -1;
+    }
+
+    if (mode == CMS_UPDATE_PREFETCH) {
+        cms->batch_update = cms_batch_update_prefetch;
+        return 0;
+    }
+
+    // Buckets of about half an L2, at most PARTITION_MAX_BUCKETS of them
+    size_t l2 = cms_cache_size(2);
+    size_t bucket_cells = (l2 > 0 ? l2 / 2 : 512 * 1024) / sizeof(uint32_t);
+    int shift = 0;
+    while (((size_t)1 << shift) < bucket_cells)
+        shift++;
+    while (((n_cells - 1) >> shift) + 1 > PARTITION_MAX_BUCKETS)
+        shift++;
+    cms->bucket_shift = shift;
+    cms->n_buckets = (int)(((n_cells - 1) >> shift) + 1);
+    cms->batch_update = cms_batch_update_partition;
+    return 0;
+}
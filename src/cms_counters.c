@@ -0,0 +1,423 @@
+#include "headers/cms_kernels.h"
+#include "headers/util.h"
+
+/*
+    Counter widths other than 32 bits, and the conservative update.
+
+    - 8/16-bit cells saturate. A cell holding the maximum value is a
+      marker: the exact count of the cell lives in the overflow table, a
+      small open-addressing hash map from cell index to a 64-bit count.
+      With skewed data only the few heavy cells ever get there, while the
+      table shrinks by 4x/2x and more of it stays in cache.
+    - 64-bit cells never wrap on long runs.
+    - The conservative update increments only the cells of a key that
+      hold its current minimum: the estimates stay upper bounds and are
+      never larger than with the standard update.
+
+    The update/query/batch kernels are instantiated from a macro template
+    for every width, on top of a get/increment pair of cell accessors. The
+    cells of a key come from cms->cells_one, the fixed-depth specialized
+    hashing when available.
+*/
+
+#define CMS_COUNTER_MAX_DEPTH 64 // Rows whose cells are kept on the stack by the kernels
+
+/* ---------------- Overflow table ---------------- */
+
+#define OVERFLOW_EMPTY SIZE_MAX
+
+struct CmsOverflow {
+    size_t *cells;      // Cell index of each slot (OVERFLOW_EMPTY if free)
+    uint64_t *counts;   // Exact count of the cell
+    size_t capacity;    // Slots, a power of two
+    size_t size;        // Used slots
+};
+
+static inline size_t overflow_home(const CmsOverflow *overflow, size_t cell) {
+    return (size_t)((cell * 0x9E3779B97F4A7C15ULL) >> 32) & (overflow->capacity - 1);
+}
+
+static int overflow_alloc(CmsOverflow *overflow, size_t capacity) {
+    overflow->cells = malloc(capacity * sizeof(size_t));
+    overflow->counts = malloc(capacity * sizeof(uint64_t));
+    if (overflow->cells == NULL || overflow->counts == NULL) {
+        free(overflow->cells);
+        free(overflow->counts);
+        return -1;
+    }
+    for (size_t s = 0; s < capacity; s++)
+        overflow->cells[s] = OVERFLOW_EMPTY;
+    overflow->capacity = capacity;
+    overflow->size = 0;
+    return 0;
+}
+
+CmsOverflow *cms_overflow_create(void) {
+    CmsOverflow *overflow = malloc(sizeof(CmsOverflow));
+    if (overflow == NULL || overflow_alloc(overflow, 64) == -1) {
+        fprintf(stderr, "Error: failed to allocate memory for the overflow table.\n");
+        free(overflow);
+        return NULL;
+    }
+    return overflow;
+}
+
+void cms_overflow_free(CmsOverflow *overflow) {
+    if (overflow == NULL)
+        return;
+    free(overflow->cells);
+    free(overflow->counts);
+    free(overflow);
+}
+
+void cms_overflow_clear(CmsOverflow *overflow) {
+    for (size_t s = 0; s < overflow->capacity; s++)
+        overflow->cells[s] = OVERFLOW_EMPTY;
+    overflow->size = 0;
+}
+
+/*
+    Exact count of a saturated cell (0 if the cell is not in the table)
+*/
+uint64_t cms_overflow_get(const CmsOverflow *overflow, size_t cell) {
+    size_t mask = overflow->capacity - 1;
+    for (size_t s = overflow_home(overflow, cell); overflow->cells[s] != OVERFLOW_EMPTY; s = (s + 1) & mask) {
+        if (overflow->cells[s] == cell)
+            return overflow->counts[s];
+    }
+    return 0;
+}
+
+/*
+    Set the exact count of a saturated cell, growing the table past half full.
+    Returns 0 on success, -1 if the table could not grow.
+*/
+int cms_overflow_set(CmsOverflow *overflow, size_t cell, uint64_t count) {
+    size_t mask = overflow->capacity - 1;
+    size_t s = overflow_home(overflow, cell);
+    for (; overflow->cells[s] != OVERFLOW_EMPTY; s = (s + 1) & mask) {
+        if (overflow->cells[s] == cell) {
+            overflow->counts[s] = count;
+            return 0;
+        }
+    }
+
+    if (2 * (overflow->size + 1) > overflow->capacity) {
+        CmsOverflow grown;
+        if (overflow_alloc(&grown, 2 * overflow->capacity) == -1) {
+            fprintf(stderr, "Error: failed to grow the overflow table.\n");
+            return -1;
+        }
+        for (size_t i = 0; i < overflow->capacity; i++) {
+            if (overflow->cells[i] != OVERFLOW_EMPTY)
+                cms_overflow_set(&grown, overflow->cells[i], overflow->counts[i]);
+        }
+        free(overflow->cells);
+        free(overflow->counts);
+        *overflow = grown;
+        return cms_overflow_set(overflow, cell, count);
+    }
+    overflow->cells[s] = cell;
+    overflow->counts[s] = count;
+    overflow->size++;
+    return 0;
+}
+
+/* ---------------- Cell accessors ---------------- */
+
+/*
+    Saturating cells: the maximum value defers to the overflow table.
+    A cell only becomes MAX once its count is in the table; if the table
+    cannot grow the cell stays at MAX - 1 and overflow_failed is set.
+*/
+#define CMS_DEFINE_SATURATING_CELLS(NAME, TYPE, MAX)                                         \
+    static inline uint64_t cell_get_##NAME(const CountMinSketch *cms, size_t c) {            \
+        TYPE v = ((const TYPE *)cms->cells)[c];                                              \
+        return (v == MAX) ? cms_overflow_get(cms->overflow, c) : v;                          \
+    }                                                                                        \
+    static inline void cell_inc_##NAME(CountMinSketch *cms, size_t c) {                      \
+        TYPE *cells = cms->cells;                                                            \
+        if (cells[c] < MAX - 1) {                                                            \
+            cells[c]++;                                                                      \
+        } else if (cells[c] == MAX - 1) {                                                    \
+            if (cms_overflow_set(cms->overflow, c, MAX) == 0)                                \
+                cells[c] = MAX;                                                              \
+            else                                                                             \
+                cms->overflow_failed = 1;                                                    \
+        } else if (cms_overflow_set(cms->overflow, c, cms_overflow_get(cms->overflow, c) + 1) == -1) { \
+            cms->overflow_failed = 1;                                                        \
+        }                                                                                    \
+    }
+
+#define CMS_DEFINE_PLAIN_CELLS(NAME, TYPE)                                                   \
+    static inline uint64_t cell_get_##NAME(const CountMinSketch *cms, size_t c) {            \
+        return ((const TYPE *)cms->cells)[c];                                                \
+    }                                                                                        \
+    static inline void cell_inc_##NAME(CountMinSketch *cms, size_t c) {                      \
+        ((TYPE *)cms->cells)[c]++;                                                           \
+    }
+
+CMS_DEFINE_SATURATING_CELLS(u8, uint8_t, UINT8_MAX)
+CMS_DEFINE_SATURATING_CELLS(u16, uint16_t, UINT16_MAX)
+CMS_DEFINE_PLAIN_CELLS(u32, uint32_t)
+CMS_DEFINE_PLAIN_CELLS(u64, uint64_t)
+
+/* ---------------- Kernels ---------------- */
+
+/*
+    Template of the standard and conservative update, query and batch
+    kernels for the cells NAME. Queries return the exact 64-bit count.
+*/
+#define CMS_DEFINE_COUNTER_KERNELS(NAME)                                                     \
+    static void cms_update_##NAME(CountMinSketch *cms, uint32_t x) {                         \
+        size_t cells[CMS_COUNTER_MAX_DEPTH];                                                 \
+        cms->cells_one(cms, x, cells);                                                       \
+        for (int row = 0; row < cms->depth; row++)                                           \
+            cell_inc_##NAME(cms, cells[row]);                                                \
+    }                                                                                        \
+    static void cms_update_conservative_##NAME(CountMinSketch *cms, uint32_t x) {            \
+        size_t cells[CMS_COUNTER_MAX_DEPTH];                                                 \
+        uint64_t min_count = UINT64_MAX;                                                     \
+        cms->cells_one(cms, x, cells);                                                       \
+        for (int row = 0; row < cms->depth; row++) {                                         \
+            uint64_t count = cell_get_##NAME(cms, cells[row]);                               \
+            min_count = (count < min_count) ? count : min_count;                             \
+        }                                                                                    \
+        for (int row = 0; row < cms->depth; row++) {                                         \
+            if (cell_get_##NAME(cms, cells[row]) == min_count)                               \
+                cell_inc_##NAME(cms, cells[row]);                                            \
+        }                                                                                    \
+    }                                                                                        \
+    static uint64_t cms_query_##NAME(const CountMinSketch *cms, uint32_t x) {                \
+        size_t cells[CMS_COUNTER_MAX_DEPTH];                                                 \
+        uint64_t min_count = UINT64_MAX;                                                     \
+        cms->cells_one(cms, x, cells);                                                       \
+        for (int row = 0; row < cms->depth; row++) {                                         \
+            uint64_t count = cell_get_##NAME(cms, cells[row]);                               \
+            min_count = (count < min_count) ? count : min_count;                             \
+        }                                                                                    \
+        return min_count;                                                                    \
+    }                                                                                        \
+    static void cms_batch_##NAME(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) {  \
+        for (size_t i = 0; i < n_keys; i++)                                                  \
+            cms_update_##NAME(cms, ip_to_int(&keys[i * IP_SIZE]));                           \
+    }                                                                                        \
+    static void cms_batch_conservative_##NAME(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) { \
+        for (size_t i = 0; i < n_keys; i++)                                                  \
+            cms_update_conservative_##NAME(cms, ip_to_int(&keys[i * IP_SIZE]));              \
+    }
+
+CMS_DEFINE_COUNTER_KERNELS(u8)
+CMS_DEFINE_COUNTER_KERNELS(u16)
+CMS_DEFINE_COUNTER_KERNELS(u32)
+CMS_DEFINE_COUNTER_KERNELS(u64)
+
+typedef struct {
+    cms_update_fn update;
+    cms_update_fn update_conservative;
+    cms_query_fn query;
+    cms_batch_fn batch;
+    cms_batch_fn batch_conservative;
+} CounterKernels;
+
+#define COUNTER_KERNELS(NAME) \
+    { cms_update_##NAME, cms_update_conservative_##NAME, cms_query_##NAME, cms_batch_##NAME, cms_batch_conservative_##NAME }
+
+// Indexed by cms_counter_width
+static const CounterKernels counter_kernels[] = {
+    [CMS_COUNTER_32] = COUNTER_KERNELS(u32),
+    [CMS_COUNTER_8]  = COUNTER_KERNELS(u8),
+    [CMS_COUNTER_16] = COUNTER_KERNELS(u16),
+    [CMS_COUNTER_64] = COUNTER_KERNELS(u64),
+};
+
+/*
+    Install the kernels of the counter width and update policy of cms.
+    Only called when they differ from the 32-bit standard update, whose
+    specialized and vector kernels are selected by cms_create_ex.
+    Returns 0 on success, -1 if the depth is too large.
+*/
+int cms_select_counter_kernels(CountMinSketch *cms) {
+    const CounterKernels *k = &counter_kernels[cms->counters];
+    if (cms->depth > CMS_COUNTER_MAX_DEPTH) {
+        fprintf(stderr, "Error: these counters support at most %d rows.\n", CMS_COUNTER_MAX_DEPTH);
+        return -1;
+    }
+    cms->update_one = cms->conservative ? k->update_conservative : k->update;
+    cms->scalar_batch = cms->conservative ? k->batch_conservative : k->batch;
+    cms->query_one = k->query;
+    return 0;
+}
+
+/* ---------------- Width-independent helpers ---------------- */
+
+/*
+    Convert the command-line name of a counter width to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int cms_counter_width_parse(const char *name, cms_counter_width *counters) {
+    if (strcmp(name, "32") == 0)
+        *counters = CMS_COUNTER_32;
+    else if (strcmp(name, "8") == 0)
+        *counters = CMS_COUNTER_8;
+    else if (strcmp(name, "16") == 0)
+        *counters = CMS_COUNTER_16;
+    else if (strcmp(name, "64") == 0)
+        *counters = CMS_COUNTER_64;
+    else
+        return -1;
+    return 0;
+}
+
+const char *cms_counter_width_name(cms_counter_width counters) {
+    switch (counters) {
+        case CMS_COUNTER_32: return "32";
+        case CMS_COUNTER_8:  return "8";
+        case CMS_COUNTER_16: return "16";
+        case CMS_COUNTER_64: return "64";
+    }
+    return "unknown";
+}
+
+/*
+    Bytes per cell of a counter width
+*/
+size_t cms_counter_cell_size(cms_counter_width counters) {
+    switch (counters) {
+        case CMS_COUNTER_8:  return sizeof(uint8_t);
+        case CMS_COUNTER_16: return sizeof(uint16_t);
+        case CMS_COUNTER_64: return sizeof(uint64_t);
+        case CMS_COUNTER_32:
+        default:             return sizeof(uint32_t);
+    }
+}
+
+/*
+    1 if a cell of an 8/16-bit table is saturated, its exact count being
+    in the overflow table (always 0 for the other widths)
+*/
+int cms_cell_saturated(const CountMinSketch *cms, size_t cell) {
+    switch (cms->counters) {
+        case CMS_COUNTER_8:  return ((const uint8_t *)cms->cells)[cell] == UINT8_MAX;
+        case CMS_COUNTER_16: return ((const uint16_t *)cms->cells)[cell] == UINT16_MAX;
+        default:             return 0;
+    }
+}
+
+/*
+    Exact value of a cell, whatever the counter width
+*/
+uint64_t cms_cell_value(const CountMinSketch *cms, size_t cell) {
+    switch (cms->counters) {
+        case CMS_COUNTER_8:  return cell_get_u8(cms, cell);
+        case CMS_COUNTER_16: return cell_get_u16(cms, cell);
+        case CMS_COUNTER_64: return cell_get_u64(cms, cell);
+        case CMS_COUNTER_32:
+        default:             return cell_get_u32(cms, cell);
+    }
+}
+
+/*
+    Bytes of the counter table (without the overflow table)
+*/
+size_t cms_table_bytes(const CountMinSketch *cms) {
+    return (size_t)cms->width * cms->depth * cms->cell_size;
+}
+
+/*
+    Returns 0 if every count of the sketch is exact, -1 if a saturated
+    cell could not be stored in the overflow table (its count is then
+    short). The error is sticky: it is not reset by cms_clear.
+*/
+int cms_status(const CountMinSketch *cms) {
+    return cms->overflow_failed ? -1 : 0;
+}
+
+/*
+    Reset every counter to zero
+*/
+void cms_clear(CountMinSketch *cms) {
+    memset(cms->cells, 0, cms_table_bytes(cms));
+    if (cms->overflow)
+        cms_overflow_clear(cms->overflow);
+}
+
+/*
+    dst[i] += src[i] for the cells [lo, hi) of two tables of the given
+    width. 8/16-bit cells saturate: the exact sums of the saturated cells
+    must be fixed from the overflow tables by the caller.
+*/
+void cms_cells_add(cms_counter_width counters, void *dst, const void *src, size_t lo, size_t hi) {
+    switch (counters) {
+        case CMS_COUNTER_8: {
+            uint8_t *d = dst;
+            const uint8_t *s = src;
+            for (size_t i = lo; i < hi; i++)
+                d[i] = (d[i] > UINT8_MAX - s[i]) ? UINT8_MAX : (uint8_t)(d[i] + s[i]);
+            break;
+        }
+        case CMS_COUNTER_16: {
+            uint16_t *d = dst;
+            const uint16_t *s = src;
+            for (size_t i = lo; i < hi; i++)
+                d[i] = (d[i] > UINT16_MAX - s[i]) ? UINT16_MAX : (uint16_t)(d[i] + s[i]);
+            break;
+        }
+        case CMS_COUNTER_64: {
+            uint64_t *d = dst;
+            const uint64_t *s = src;
+            for (size_t i = lo; i < hi; i++)
+                d[i] += s[i];
+            break;
+        }
+        case CMS_COUNTER_32:
+        default: {
+            uint32_t *d = dst;
+            const uint32_t *s = src;
+            for (size_t i = lo; i < hi; i++)
+                d[i] += s[i];
+            break;
+        }
+    }
+}
+
+/*
+    Merge of two sketches with saturating cells: the cells whose sum
+    saturates get their exact sum in the overflow table of dest (MAX - 1
+    and overflow_failed if the table cannot grow)
+*/
+#define CMS_DEFINE_SATURATING_MERGE(NAME, TYPE, MAX)                                         \
+    static void cms_merge_##NAME(CountMinSketch *dest, const CountMinSketch *src) {          \
+        TYPE *d = dest->cells;                                                               \
+        const TYPE *s = src->cells;                                                          \
+        size_t n_cells = (size_t)dest->width * dest->depth;                                  \
+        for (size_t i = 0; i < n_cells; i++) {                                               \
+            if (d[i] != MAX && s[i] != MAX && d[i] < MAX - s[i]) {                           \
+                d[i] += s[i];                                                                \
+            } else {                                                                         \
+                uint64_t sum = cell_get_##NAME(dest, i) + cell_get_##NAME(src, i);           \
+                if (cms_overflow_set(dest->overflow, i, sum) == 0) {                         \
+                    d[i] = MAX;                                                              \
+                } else {                                                                     \
+                    d[i] = MAX - 1;                                                          \
+                    dest->overflow_failed = 1;                                               \
+                }                                                                            \
+            }                                                                                \
+        }                                                                                    \
+    }
+
+CMS_DEFINE_SATURATING_MERGE(u8, uint8_t, UINT8_MAX)
+CMS_DEFINE_SATURATING_MERGE(u16, uint16_t, UINT16_MAX)
+
+/*
+    dest += src for sketches of the same dimensions and counter width
+*/
+void cms_merge_cells(CountMinSketch *dest, const CountMinSketch *src) {
+    switch (dest->counters) {
+        case CMS_COUNTER_8:  cms_merge_u8(dest, src); break;
+        case CMS_COUNTER_16: cms_merge_u16(dest, src); break;
+        default:
+            cms_cells_add(dest->counters, dest->cells, src->cells, 0, (size_t)dest->width * dest->depth);
+            break;
+    }
+}
@@ -0,0 +1,420 @@
+#include "headers/cms_file.h"
+#include "headers/cms_kernels.h"
+#include "headers/reduce.h"
+
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+    Sketch files: see cms_file.h for the layout.
+    Writers build the header and seed block in memory and add the table
+    and the overflow pairs; readers map the file and point a sketch to
+    the table inside the mapping.
+*/
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/*
+    Header of the file of cms
+*/
+static void header_init(const CountMinSketch *cms, uint64_t total_keys, uint64_t overflow_count,
+                        CmsFileHeader *header) {
+    memset(header, 0, sizeof(CmsFileHeader));
+    memcpy(header->magic, CMS_FILE_MAGIC, sizeof(header->magic));
+    header->version = CMS_FILE_VERSION;
+    header->byte_order = CMS_FILE_BYTE_ORDER;
+    header->width = (uint32_t)cms->width;
+    header->depth = (uint32_t)cms->depth;
+    header->hash_family = (uint32_t)cms->hash_family;
+    header->counters = (uint32_t)cms->counters;
+    header->conservative = (uint32_t)cms->conservative;
+    header->key_width = (uint32_t)cms->key_width;
+    header->total_keys = total_keys;
+    header->seed = cms->seed;
+    header->seeds_offset = sizeof(CmsFileHeader);
+    header->table_offset = align_up(header->seeds_offset + 2 * cms->depth * sizeof(uint64_t), CMS_FILE_ALIGN);
+    header->table_bytes = cms_table_bytes(cms);
+    header->overflow_offset = header->table_offset + header->table_bytes;
+    header->overflow_count = overflow_count;
+}
+
+/*
+    Everything that precedes the table: header, seeds and zero padding up
+    to table_offset bytes. Returns NULL if the allocation fails.
+*/
+static uint8_t *header_block(const CountMinSketch *cms, const CmsFileHeader *header) {
+    uint8_t *block = calloc(header->table_offset, 1);
+    if (block == NULL) {
+        fprintf(stderr, "Error: failed to allocate the sketch file header.\n");
+        return NULL;
+    }
+    memcpy(block, header, sizeof(CmsFileHeader));
+    memcpy(block + header->seeds_offset, cms->hash_a, cms->depth * sizeof(uint64_t));
+    memcpy(block + header->seeds_offset + cms->depth * sizeof(uint64_t), cms->hash_b,
+           cms->depth * sizeof(uint64_t));
+    return block;
+}
+
+/*
+    (cell, exact count) pairs of the saturated cells of an 8/16-bit table.
+    Returns the number of pairs (*pairs is NULL if there are none), or -1
+    if the allocation fails or the sketch lost the count of a saturated cell.
+*/
+static long long overflow_pairs(const CountMinSketch *cms, uint64_t **pairs) {
+    *pairs = NULL;
+    if (cms->overflow == NULL)
+        return 0;
+    if (cms_status(cms) == -1) {
+        fprintf(stderr, "Error: the sketch lost the count of a saturated cell, it cannot be saved.\n");
+        return -1;
+    }
+    size_t n_cells = (size_t)cms->width * cms->depth;
+    long long n_pairs = 0;
+    for (size_t i = 0; i < n_cells; i++)
+        n_pairs += cms_cell_saturated(cms, i);
+    if (n_pairs == 0)
+        return 0;
+
+    *pairs = malloc(2 * n_pairs * sizeof(uint64_t));
+    if (*pairs == NULL) {
+        fprintf(stderr, "Error: failed to allocate the overflow entries of the sketch file.\n");
+        return -1;
+    }
+    long long n = 0;
+    for (size_t i = 0; i < n_cells; i++) {
+        if (cms_cell_saturated(cms, i)) {
+            (*pairs)[2 * n] = i;
+            (*pairs)[2 * n + 1] = cms_overflow_get(cms->overflow, i);
+            n++;
+        }
+    }
+    return n_pairs;
+}
+
+/*
+    Write cms and the number of keys it holds to path.
+    The file is written next to path and renamed at the end, so path
+    always holds a complete sketch, even when it is one of the inputs of
+    a merge that is still mapped.
+    Returns 0 on success, -1 on error.
+*/
+int cms_file_write(const CountMinSketch *cms, uint64_t total_keys, const char *path) {
+    uint64_t *pairs;
+    long long n_pairs = overflow_pairs(cms, &pairs);
+    if (n_pairs == -1)
+        return -1;
+    CmsFileHeader header;
+    header_init(cms, total_keys, (uint64_t)n_pairs, &header);
+    uint8_t *block = header_block(cms, &header);
+    size_t tmp_length = strlen(path) + 5;
+    char *tmp_path = malloc(tmp_length);
+    if (block == NULL || tmp_path == NULL) {
+        free(pairs);
+        free(block);
+        free(tmp_path);
+        return -1;
+    }
+    snprintf(tmp_path, tmp_length, "%s.tmp", path);
+
+    int result = -1;
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: cannot create %s: %s\n", tmp_path, strerror(errno));
+    } else {
+        int written = fwrite(block, 1, header.table_offset, file) == header.table_offset &&
+                      fwrite(cms->cells, 1, header.table_bytes, file) == header.table_bytes &&
+                      fwrite(pairs, 2 * sizeof(uint64_t), (size_t)n_pairs, file) == (size_t)n_pairs;
+        if (fclose(file) != 0 || !written)
+            fprintf(stderr, "Error: failed to write %s: %s\n", tmp_path, strerror(errno));
+        else if (rename(tmp_path, path) != 0)
+            fprintf(stderr, "Error: cannot rename %s to %s: %s\n", tmp_path, path, strerror(errno));
+        else
+            result = 0;
+        if (result == -1)
+            remove(tmp_path);
+    }
+
+    free(pairs);
+    free(block);
+    free(tmp_path);
+    return result;
+}
+
+/*
+    Collective write of the global sketch left by cms_reduce.
+    The table is split in page-aligned slices, one per rank, written with
+    MPI_File_write_at_all so that the MPI-IO layer can aggregate them. If
+    only root holds the global table (replicated = 0) the slices are
+    scattered from it first; with replicated = 1 (after an allreduce or a
+    broadcast) every rank writes its slice of its own copy. The root
+    writes the header and the overflow pairs.
+    Returns 0 on success, -1 on error (on every rank).
+*/
+int cms_file_write_all(const CountMinSketch *cms, uint64_t total_keys, const char *path,
+                       int replicated, int root, MPI_Info info, MPI_Comm comm) {
+    int rank, comm_sz;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_sz);
+
+    // Header and overflow pairs are only built by the root
+    CmsFileHeader header;
+    uint64_t *pairs = NULL;
+    uint8_t *block = NULL;
+    int error = 0;
+    if (rank == root) {
+        long long n_pairs = overflow_pairs(cms, &pairs);
+        header_init(cms, total_keys, n_pairs > 0 ? (uint64_t)n_pairs : 0, &header);
+        block = (n_pairs == -1) ? NULL : header_block(cms, &header);
+        error = (block == NULL);
+    }
+    MPI_Bcast(&error, 1, MPI_INT, root, comm);
+    if (error) {
+        free(pairs);
+        return -1;
+    }
+    MPI_Bcast(&header, (int)sizeof(CmsFileHeader), MPI_BYTE, root, comm);
+
+    // Slices of whole pages
+    MPI_Datatype cell_type = cms_cell_datatype(cms);
+    long long n_cells = (long long)cms->width * cms->depth;
+    long long page_cells = CMS_FILE_ALIGN / (long long)cms->cell_size;
+    long long n_pages = (n_cells + page_cells - 1) / page_cells;
+    int *counts = malloc(comm_sz * sizeof(int));
+    int *displs = malloc(comm_sz * sizeof(int));
+    if (counts != NULL && displs != NULL) {
+        for (int r = 0; r < comm_sz; r++) {
+            long long first = (n_pages * r / comm_sz) * page_cells;
+            long long last = (n_pages * (r + 1) / comm_sz) * page_cells;
+            first = (first < n_cells) ? first : n_cells;
+            last = (last < n_cells) ? last : n_cells;
+            displs[r] = (int)first;
+            counts[r] = (int)(last - first);
+        }
+    }
+    void *slice = NULL;
+    if (counts != NULL && displs != NULL && !replicated && rank != root)
+        slice = malloc(counts[rank] > 0 ? counts[rank] * cms->cell_size : 1);
+    size_t tmp_length = strlen(path) + 5;
+    char *tmp_path = malloc(tmp_length);
+    error = (counts == NULL || displs == NULL || tmp_path == NULL || (!replicated && rank != root && slice == NULL));
+    MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_LOR, comm);
+    if (error) {
+        fprintf(stderr, "Error: failed to allocate the checkpoint slices on rank %d\n", rank);
+        free(tmp_path);
+        free(counts);
+        free(displs);
+        free(slice);
+        free(pairs);
+        free(block);
+        return -1;
+    }
+    const uint8_t *mine = (const uint8_t *)cms->cells + (size_t)displs[rank] * cms->cell_size;
+    if (!replicated) {
+        if (rank == root)
+            MPI_Scatterv(cms->cells, counts, displs, cell_type, MPI_IN_PLACE, counts[rank], cell_type, root, comm);
+        else
+            MPI_Scatterv(NULL, counts, displs, cell_type, slice, counts[rank], cell_type, root, comm);
+        if (rank != root)
+            mine = slice;
+    }
+
+    // Written next to path and renamed at the end, like cms_file_write
+    snprintf(tmp_path, tmp_length, "%s.tmp", path);
+    MPI_File fh = MPI_FILE_NULL;
+    error = (MPI_File_open(comm, tmp_path, MPI_MODE_CREATE | MPI_MODE_WRONLY, info, &fh) != MPI_SUCCESS);
+    MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_LOR, comm);
+    if (!error) {
+        MPI_Offset file_size = (MPI_Offset)(header.overflow_offset + 2 * header.overflow_count * sizeof(uint64_t));
+        MPI_File_set_size(fh, file_size);
+        MPI_Status status;
+        if (rank == root) {
+            error |= MPI_File_write_at(fh, 0, block, (int)header.table_offset, MPI_BYTE, &status) != MPI_SUCCESS;
+            if (header.overflow_count > 0)
+                error |= MPI_File_write_at(fh, (MPI_Offset)header.overflow_offset, pairs,
+                                           (int)(2 * header.overflow_count), MPI_UINT64_T, &status) != MPI_SUCCESS;
+        }
+        MPI_Offset offset = (MPI_Offset)(header.table_offset + (uint64_t)displs[rank] * cms->cell_size);
+        error |= MPI_File_write_at_all(fh, offset, mine, counts[rank], cell_type, &status) != MPI_SUCCESS;
+        error |= MPI_File_close(&fh) != MPI_SUCCESS;
+        MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_LOR, comm);
+        if (rank == root) {
+            if (!error && rename(tmp_path, path) != 0) {
+                fprintf(stderr, "Error: cannot rename %s to %s: %s\n", tmp_path, path, strerror(errno));
+                error = 1;
+            } else if (error) {
+                fprintf(stderr, "Error: failed to write %s\n", tmp_path);
+                remove(tmp_path);
+            }
+        }
+        MPI_Bcast(&error, 1, MPI_INT, root, comm);
+    } else if (rank == root) {
+        fprintf(stderr, "Error: cannot create %s\n", tmp_path);
+    }
+
+    free(tmp_path);
+    free(counts);
+    free(displs);
+    free(slice);
+    free(pairs);
+    free(block);
+    return error ? -1 : 0;
+}
+
+/*
+    Check that the header describes a complete sketch file of bytes bytes
+    written on a host with the same byte order
+*/
+static int header_valid(const CmsFileHeader *header, size_t bytes, const char *path) {
+    const char *problem = NULL;
+    if (bytes < sizeof(CmsFileHeader) || memcmp(header->magic, CMS_FILE_MAGIC, sizeof(header->magic)) != 0)
+        problem = "not a sketch file";
+    else if (header->version != CMS_FILE_VERSION)
+        problem = "unsupported version";
+    else if (header->byte_order != CMS_FILE_BYTE_ORDER)
+        problem = "written on a host with a different byte order";
+    else if (header->width == 0 || header->depth == 0 || header->width > INT32_MAX || header->depth > INT32_MAX ||
+             header->hash_family > CMS_HASH_MERSENNE || header->counters > CMS_COUNTER_64)
+        problem = "invalid sketch parameters";
+    else if (header->seeds_offset < sizeof(CmsFileHeader) ||
+             header->seeds_offset + 2 * header->depth * sizeof(uint64_t) > header->table_offset ||
+             header->table_offset % CMS_FILE_ALIGN != 0 ||
+             header->table_bytes != (uint64_t)header->width * header->depth *
+                                    cms_counter_cell_size((cms_counter_width)header->counters) ||
+             header->overflow_offset < header->table_offset + header->table_bytes ||
+             header->overflow_offset + 2 * header->overflow_count * sizeof(uint64_t) > bytes)
+        problem = "truncated or inconsistent layout";
+    if (problem) {
+        fprintf(stderr, "Error: %s: %s.\n", path, problem);
+        return 0;
+    }
+    return 1;
+}
+
+// Files written before the key width was recorded hold IPv4 addresses
+static int header_key_width(const CmsFileHeader *header) {
+    return header->key_width ? (int)header->key_width : IP_SIZE;
+}
+
+/*
+    Sketch with the parameters of header and the seeds of the file,
+    on the given cells (NULL for a zeroed table)
+*/
+static CountMinSketch *file_sketch(const CmsMappedFile *file, const CmsConfig *config, void *cells) {
+    const CmsFileHeader *header = file->header;
+    CmsConfig file_config;
+    if (config)
+        file_config = *config;
+    else
+        cms_config_default(&file_config);
+    file_config.hash_family = (cms_hash_family)header->hash_family;
+    file_config.counters = (cms_counter_width)header->counters;
+    file_config.conservative = (int)header->conservative;
+    file_config.key_width = header_key_width(header);
+    file_config.cells = cells;
+
+    CountMinSketch *cms = cms_create_ex((int)header->width, (int)header->depth, &file_config);
+    if (cms == NULL)
+        return NULL;
+    if ((uint32_t)cms->width != header->width) {
+        fprintf(stderr, "Error: a %s sketch cannot be %u columns wide.\n",
+                cms_hash_family_name(cms->hash_family), header->width);
+        cms_free(cms);
+        return NULL;
+    }
+    // The stored parameters are authoritative, the seed is kept for the record
+    const uint64_t *seeds = (const uint64_t *)((const uint8_t *)file->base + header->seeds_offset);
+    memcpy(cms->hash_a, seeds, cms->depth * sizeof(uint64_t));
+    memcpy(cms->hash_b, seeds + cms->depth, cms->depth * sizeof(uint64_t));
+    cms->seed = header->seed;
+    return cms;
+}
+
+/*
+    Map the sketch file at path. The table is used where it lies in the
+    mapping, only the overflow pairs of 8/16-bit tables are loaded into
+    the overflow table. The pages are private: updates and merges into
+    file->cms never reach the file.
+    config selects the kernels (NULL for the defaults); the dimensions,
+    hash functions and counters always come from the file.
+    Returns 0 on success, -1 on error.
+*/
+int cms_file_map(const char *path, const CmsConfig *config, CmsMappedFile *file) {
+    memset(file, 0, sizeof(CmsMappedFile));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CmsFileHeader)) {
+        fprintf(stderr, "Error: %s: not a sketch file.\n", path);
+        close(fd);
+        return -1;
+    }
+    file->bytes = (size_t)st.st_size;
+    void *base = mmap(NULL, file->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Error: cannot mmap %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    file->base = base;
+    file->header = base;
+    if (!header_valid(file->header, file->bytes, path)) {
+        cms_file_unmap(file);
+        return -1;
+    }
+
+    file->cms = file_sketch(file, config, (uint8_t *)base + file->header->table_offset);
+    if (file->cms == NULL) {
+        cms_file_unmap(file);
+        return -1;
+    }
+    if (file->cms->overflow) {
+        const uint64_t *pairs = (const uint64_t *)((const uint8_t *)base + file->header->overflow_offset);
+        size_t n_cells = (size_t)file->cms->width * file->cms->depth;
+        for (uint64_t i = 0; i < file->header->overflow_count; i++) {
+            if (pairs[2 * i] >= n_cells || cms_overflow_set(file->cms->overflow, pairs[2 * i], pairs[2 * i + 1]) == -1) {
+                fprintf(stderr, "Error: %s: invalid overflow entry.\n", path);
+                cms_file_unmap(file);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+void cms_file_unmap(CmsMappedFile *file) {
+    if (file->cms)
+        cms_free(file->cms);
+    if (file->base)
+        munmap(file->base, file->bytes);
+    memset(file, 0, sizeof(CmsMappedFile));
+}
+
+/*
+    Empty sketch hashing like the mapped file, to keep adding keys to a
+    restored sketch. Returns NULL on error.
+*/
+CountMinSketch *cms_file_create_like(const CmsMappedFile *file, const CmsConfig *config) {
+    return file_sketch(file, config, NULL);
+}
+
+/*
+    1 if the sketches of the two files can be merged, i.e. they share
+    dimensions, hash functions (family and seeds), counter width and key
+    width (a 16-byte key is counted by its digest, not by its value)
+*/
+int cms_file_compatible(const CmsMappedFile *a, const CmsMappedFile *b) {
+    const CmsFileHeader *ha = a->header, *hb = b->header;
+    if (ha->width != hb->width || ha->depth != hb->depth || ha->hash_family != hb->hash_family ||
+        ha->counters != hb->counters || header_key_width(ha) != header_key_width(hb))
+        return 0;
+    return memcmp((const uint8_t *)a->base + ha->seeds_offset, (const uint8_t *)b->base + hb->seeds_offset,
+                  2 * ha->depth * sizeof(uint64_t)) == 0;
+}
@@ -0,0 +1,426 @@
+#include "headers/cms_hierarchy.h"
+#include "headers/cms_memory.h"
+#include "headers/util.h"
+
+#include <math.h>
+
+#define HIER_MAX_CHILDREN (1UL << 24)  // Prefixes enumerated below one heavy prefix
+
+/*
+    Parse the prefix lengths of the levels:
+        "8,16,24"    the listed lengths (strictly increasing, 1 to 31)
+        "dyadic"     every length from 1 to 31 (binary dyadic decomposition)
+        "dyadic:B"   every multiple of B bits below 32
+    Returns 0 on success, -1 if the list is not valid.
+*/
+int cms_hier_levels_parse(const char *spec, CmsHierConfig *config) {
+    config->n_levels = 0;
+    if (strncmp(spec, "dyadic", 6) == 0) {
+        long step = 1;
+        if (spec[6] == ':') {
+            char *end;
+            step = strtol(spec + 7, &end, 10);
+            if (end == spec + 7 || *end != '\0' || step < 1 || step > 16)
+                return -1;
+        } else if (spec[6] != '\0') {
+            return -1;
+        }
+        for (long bits = step; bits < 32; bits += step)
+            config->prefix_bits[config->n_levels++] = (int)bits;
+        return 0;
+    }
+
+    const char *p = spec;
+    while (*p != '\0') {
+        char *end;
+        long bits = strtol(p, &end, 10);
+        if (end == p || bits < 1 || bits > 31 || config->n_levels == CMS_HIER_MAX_LEVELS ||
+            (config->n_levels > 0 && bits <= config->prefix_bits[config->n_levels - 1]))
+            return -1;
+        config->prefix_bits[config->n_levels++] = (int)bits;
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
+    }
+    return config->n_levels > 0 ? 0 : -1;
+}
+
+/*
+    Parse a dotted IPv4 address into a host order integer.
+    Returns the number of characters read, 0 if there is no address.
+*/
+static int parse_address(const char *text, uint32_t *address) {
+    unsigned int a, b, c, d;
+    int n = 0;
+    if (sscanf(text, "%3u.%3u.%3u.%3u%n", &a, &b, &c, &d, &n) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+        return 0;
+    *address = (a << 24) | (b << 16) | (c << 8) | d;
+    return n;
+}
+
+/*
+    Parse an address range: "a.b.c.d/len" (the host bits are ignored),
+    "a.b.c.d-e.f.g.h" (both ends included) or a single address.
+    Returns 0 on success, -1 if the range is not valid.
+*/
+int cms_hier_range_parse(const char *spec, uint32_t *lo, uint32_t *hi) {
+    int n = parse_address(spec, lo);
+    if (n == 0)
+        return -1;
+    const char *rest = spec + n;
+    if (*rest == '\0') {
+        *hi = *lo;
+        return 0;
+    }
+    if (*rest == '/') {
+        char *end;
+        long bits = strtol(rest + 1, &end, 10);
+        if (end == rest + 1 || *end != '\0' || bits < 0 || bits > 32)
+            return -1;
+        uint32_t host = (bits == 0) ? UINT32_MAX : (uint32_t)((1ULL << (32 - bits)) - 1);
+        *lo &= ~host;
+        *hi = *lo | host;
+        return 0;
+    }
+    if (*rest == '-') {
+        int m = parse_address(rest + 1, hi);
+        if (m == 0 || rest[1 + m] != '\0' || *hi < *lo)
+            return -1;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+    Take the next range of a comma-separated list: its text goes to spec
+    (CMS_HIER_RANGE_TEXT bytes) and *list moves past it.
+    Returns 1 on a range, 0 at the end of the list, -1 if the range is not valid.
+*/
+int cms_hier_ranges_next(const char **list, char *spec, uint32_t *lo, uint32_t *hi) {
+    const char *p = *list;
+    if (*p == '\0')
+        return 0;
+    size_t n = strcspn(p, ",");
+    size_t kept = (n < CMS_HIER_RANGE_TEXT) ? n : CMS_HIER_RANGE_TEXT - 1;
+    memcpy(spec, p, kept);
+    spec[kept] = '\0';
+    *list = p + n + (p[n] == ',');
+    if (n >= CMS_HIER_RANGE_TEXT)
+        return -1;
+    return cms_hier_range_parse(spec, lo, hi) == 0 ? 1 : -1;
+}
+
+/*
+    Create the levels of hconfig over the base sketch. Every sketched level
+    has the dimensions of cms_create_from_error(hconfig->epsilon, delta),
+    the settings of config and hash parameters drawn from the seed of
+    config and its prefix length, so that the levels of all the ranks can
+    be reduced. Returns NULL on error.
+*/
+HierarchicalSketch *cms_hier_create(CountMinSketch *base, const CmsHierConfig *hconfig, double delta,
+                                    const CmsConfig *config) {
+    int width, depth;
+    if (cms_dimensions_from_error(hconfig->epsilon, delta, &width, &depth) == -1) {
+        fprintf(stderr, "Error: invalid epsilon/delta for the prefix levels.\n");
+        return NULL;
+    }
+    HierarchicalSketch *hs = calloc(1, sizeof(HierarchicalSketch));
+    if (hs == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for HierarchicalSketch structure.\n");
+        return NULL;
+    }
+    hs->base = base;
+    hs->n_levels = hconfig->n_levels;
+
+    CmsConfig level_config = *config;
+    level_config.cells = NULL;
+    level_config.key_width = IP_SIZE;
+    const size_t sketch_bytes = (size_t)width * depth * cms_counter_cell_size(config->counters);
+
+    for (int l = 0; l < hs->n_levels; l++) {
+        CmsHierLevel *level = &hs->levels[l];
+        level->prefix_bits = hconfig->prefix_bits[l];
+        size_t n_prefixes = (size_t)1 << level->prefix_bits;
+        // Short prefixes are counted exactly when that takes no more memory than a sketch
+        if (n_prefixes * sizeof(uint64_t) <= sketch_bytes) {
+            hs->n_exact_cells += n_prefixes;
+            continue;
+        }
+        level_config.seed = config->seed + (uint64_t)level->prefix_bits * 0x9E3779B97F4A7C15ULL;
+        level->cms = cms_create_ex(width, depth, &level_config);
+        if (level->cms == NULL) {
+            cms_hier_free(hs);
+            return NULL;
+        }
+    }
+
+    if (hs->n_exact_cells > 0) {
+        hs->exact_cells = cms_mem_alloc(hs->n_exact_cells * sizeof(uint64_t), CMS_MEM_TABLE);
+        if (hs->exact_cells == NULL) {
+            fprintf(stderr, "Error: failed to allocate the exact prefix counters.\n");
+            cms_hier_free(hs);
+            return NULL;
+        }
+        uint64_t *next = hs->exact_cells;
+        for (int l = 0; l < hs->n_levels; l++) {
+            if (hs->levels[l].cms == NULL) {
+                hs->levels[l].exact = next;
+                next += (size_t)1 << hs->levels[l].prefix_bits;
+            }
+        }
+    }
+
+    hs->block = malloc(CMS_HIER_BLOCK * sizeof(uint32_t));
+    hs->prefix_keys = malloc(CMS_HIER_BLOCK * IP_SIZE);
+    if (hs->block == NULL || hs->prefix_keys == NULL) {
+        fprintf(stderr, "Error: failed to allocate the prefix buffers.\n");
+        cms_hier_free(hs);
+        return NULL;
+    }
+    return hs;
+}
+
+/*
+    Add a batch of keys to the base sketch and to every level. The keys
+    are processed by blocks small enough to stay in cache: each block is
+    counted by the batch kernel of the base sketch, converted once to
+    integers, and its prefixes are then counted by every level.
+*/
+void cms_hier_batch_update(HierarchicalSketch *hs, const uint8_t *keys, size_t n_keys) {
+    for (size_t i = 0; i < n_keys; i += CMS_HIER_BLOCK) {
+        const size_t count = (n_keys - i < CMS_HIER_BLOCK) ? n_keys - i : CMS_HIER_BLOCK;
+        const uint8_t *block_keys = keys + i * IP_SIZE;
+        cms_batch_update(hs->base, block_keys, count);
+        for (size_t j = 0; j < count; j++)
+            hs->block[j] = ip_to_int(block_keys + j * IP_SIZE);
+
+        for (int l = 0; l < hs->n_levels; l++) {
+            const CmsHierLevel *level = &hs->levels[l];
+            const int shift = 32 - level->prefix_bits;
+            if (level->exact) {
+                for (size_t j = 0; j < count; j++)
+                    level->exact[hs->block[j] >> shift]++;
+                continue;
+            }
+            // The sketched levels take their prefixes in the key format of the batch kernels
+            for (size_t j = 0; j < count; j++) {
+                uint32_t prefix = hs->block[j] >> shift;
+                uint8_t *out = hs->prefix_keys + j * IP_SIZE;
+                out[0] = (uint8_t)(prefix >> 24);
+                out[1] = (uint8_t)(prefix >> 16);
+                out[2] = (uint8_t)(prefix >> 8);
+                out[3] = (uint8_t)prefix;
+            }
+            cms_batch_update(level->cms, hs->prefix_keys, count);
+        }
+    }
+}
+
+/*
+    Sum the base sketch and the levels of all the ranks in comm, like
+    cms_reduce (same mode, same root); the exact counters of all the
+    levels are summed in one call. The time of the levels is added to
+    the inter-node time of timing.
+    Collective over comm. Returns 0 on success, -1 on error.
+*/
+int cms_hier_reduce(HierarchicalSketch *hs, cms_reduce_mode mode, int root, MPI_Comm comm, CmsReduceTiming *timing) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int result = cms_reduce(hs->base, mode, root, comm, timing);
+
+    double start = MPI_Wtime();
+    for (int l = 0; l < hs->n_levels; l++)
+        if (hs->levels[l].cms && cms_reduce(hs->levels[l].cms, mode, root, comm, NULL) == -1)
+            result = -1;
+    if (hs->n_exact_cells > 0) {
+        if (mode == CMS_REDUCE_ALL)
+            MPI_Allreduce(MPI_IN_PLACE, hs->exact_cells, (int)hs->n_exact_cells, MPI_UINT64_T, MPI_SUM, comm);
+        else if (rank == root)
+            MPI_Reduce(MPI_IN_PLACE, hs->exact_cells, (int)hs->n_exact_cells, MPI_UINT64_T, MPI_SUM, root, comm);
+        else
+            MPI_Reduce(hs->exact_cells, NULL, (int)hs->n_exact_cells, MPI_UINT64_T, MPI_SUM, root, comm);
+    }
+    if (timing)
+        timing->inter_time += MPI_Wtime() - start;
+    return result;
+}
+
+/*
+    Estimate of the prefix of address at level l (n_levels = the base
+    sketch), with the error rate of that estimate (0 for an exact level)
+*/
+static uint64_t level_estimate(const HierarchicalSketch *hs, int l, uint32_t address, double *error_rate) {
+    if (l == hs->n_levels) {
+        *error_rate = cms_error_rate(hs->base);
+        return cms_query(hs->base, address);
+    }
+    const CmsHierLevel *level = &hs->levels[l];
+    uint32_t prefix = address >> (32 - level->prefix_bits);
+    if (level->exact) {
+        *error_rate = 0.0;
+        return level->exact[prefix];
+    }
+    *error_rate = cms_error_rate(level->cms);
+    return cms_query(level->cms, prefix);
+}
+
+/*
+    Estimate the keys in [lo, hi]. The range is split, from its start,
+    into the largest aligned prefix blocks that a level counts, so a
+    prefix that is a level costs one query. Every sketched block may add
+    its epsilon * keys to the estimate: error_rate is the sum of these
+    epsilons. Needs the reduced levels.
+*/
+CmsHierEstimate cms_hier_range_query(const HierarchicalSketch *hs, uint32_t lo, uint32_t hi) {
+    CmsHierEstimate estimate = { 0, 0, 0.0 };
+    uint64_t address = lo;
+    while (address <= hi) {
+        int l = 0;
+        uint64_t size = 1;
+        // Coarsest level whose block at address is aligned and inside the range, the base sketch otherwise
+        for (; l < hs->n_levels; l++) {
+            size = 1ULL << (32 - hs->levels[l].prefix_bits);
+            if (address % size == 0 && address + size - 1 <= hi)
+                break;
+        }
+        if (l == hs->n_levels)
+            size = 1;
+        double error_rate;
+        estimate.count += level_estimate(hs, l, (uint32_t)address, &error_rate);
+        estimate.error_rate += error_rate;
+        estimate.n_blocks++;
+        address += size;
+    }
+    return estimate;
+}
+
+typedef struct {
+    uint32_t prefix;
+    int level;          // Index of the level, n_levels for the base sketch
+    int parent;         // Index of the enclosing heavy prefix (-1 at the first level)
+    uint64_t estimate;
+    uint64_t covered;   // Count of the heavy hitters found below the prefix
+    uint64_t residual;  // Estimate without that count
+    int heavy;          // 1 if the prefix is a hierarchical heavy hitter
+} HeavyNode;
+
+/*
+    Hierarchical heavy hitters with the given count threshold. The heavy
+    prefixes (estimate >= threshold) are found level by level, from the
+    coarsest one down to the whole keys, by querying only the prefixes
+    below a heavy one. Then, from the finest level up, a heavy prefix is a
+    hierarchical heavy hitter if its estimate minus the counts of the
+    hierarchical heavy hitters it contains is still above the threshold.
+    *hitters receives a malloc'ed array, coarsest prefixes first.
+    Returns the number of hitters, -1 on error.
+*/
+int cms_hier_heavy_hitters(const HierarchicalSketch *hs, uint64_t threshold, CmsHierHitter **hitters) {
+    *hitters = NULL;
+    if (threshold == 0)
+        threshold = 1;
+    size_t capacity = 1024, n_nodes = 0;
+    HeavyNode *nodes = malloc(capacity * sizeof(HeavyNode));
+    if (nodes == NULL) {
+        fprintf(stderr, "Error: failed to allocate the heavy prefixes.\n");
+        return -1;
+    }
+
+    // Parents of the first level: the whole address space
+    size_t first = 0, end = 0;
+    int parent_bits = 0;
+    for (int l = 0; l <= hs->n_levels; l++) {
+        const int bits = (l < hs->n_levels) ? hs->levels[l].prefix_bits : 32;
+        const unsigned long children = 1UL << (bits - parent_bits);
+        if (children > HIER_MAX_CHILDREN) {
+            fprintf(stderr, "Error: /%d to /%d is too wide a step for the heavy hitters, add levels between them\n",
+                    parent_bits, bits);
+            free(nodes);
+            return -1;
+        }
+        const long long n_parents = (l == 0) ? 1 : (long long)(end - first);
+        for (long long p = 0; p < n_parents; p++) {
+            uint32_t base = (l == 0) ? 0 : nodes[first + p].prefix;
+            for (unsigned long c = 0; c < children; c++) {
+                uint32_t address = base + (bits == 32 ? (uint32_t)c : (uint32_t)(c << (32 - bits)));
+                double error_rate;
+                uint64_t estimate = level_estimate(hs, l, address, &error_rate);
+                if (estimate < threshold)
+                    continue;
+                if (n_nodes == capacity) {
+                    HeavyNode *grown = realloc(nodes, 2 * capacity * sizeof(HeavyNode));
+                    if (grown == NULL) {
+                        fprintf(stderr, "Error: failed to allocate the heavy prefixes.\n");
+                        free(nodes);
+                        return -1;
+                    }
+                    nodes = grown;
+                    capacity *= 2;
+                }
+                nodes[n_nodes++] = (HeavyNode){ address, l, (l == 0) ? -1 : (int)(first + p), estimate, 0, 0, 0 };
+            }
+        }
+        first = end;
+        end = n_nodes;
+        parent_bits = bits;
+        if (first == end)
+            break;
+    }
+
+    // Children come after their parent: one backward pass gives every prefix the counts below it
+    int n_hitters = 0;
+    for (size_t i = n_nodes; i-- > 0;) {
+        HeavyNode *node = &nodes[i];
+        uint64_t contained = node->covered < node->estimate ? node->covered : node->estimate;
+        node->residual = node->estimate - contained;
+        node->heavy = (node->residual >= threshold);
+        n_hitters += node->heavy;
+        // What the parent must take out: the whole prefix if it is a hitter, else the hitters inside it
+        node->covered = node->heavy ? node->estimate : contained;
+        if (node->parent >= 0)
+            nodes[node->parent].covered += node->covered;
+    }
+
+    *hitters = malloc((n_hitters > 0 ? n_hitters : 1) * sizeof(CmsHierHitter));
+    if (*hitters == NULL) {
+        fprintf(stderr, "Error: failed to allocate the heavy hitters.\n");
+        free(nodes);
+        return -1;
+    }
+    int h = 0;
+    for (size_t i = 0; i < n_nodes; i++) {
+        if (!nodes[i].heavy)
+            continue;
+        (*hitters)[h].prefix = nodes[i].prefix;
+        (*hitters)[h].prefix_bits = (nodes[i].level < hs->n_levels) ? hs->levels[nodes[i].level].prefix_bits : 32;
+        (*hitters)[h].estimate = nodes[i].estimate;
+        (*hitters)[h].residual = nodes[i].residual;
+        h++;
+    }
+    free(nodes);
+    return n_hitters;
+}
+
+/*
+    Memory of the levels (the base sketch is not included)
+*/
+size_t cms_hier_bytes(const HierarchicalSketch *hs) {
+    size_t bytes = hs->n_exact_cells * sizeof(uint64_t);
+    for (int l = 0; l < hs->n_levels; l++)
+        if (hs->levels[l].cms)
+            bytes += cms_table_bytes(hs->levels[l].cms);
+    return bytes;
+}
+
+void cms_hier_free(HierarchicalSketch *hs) {
+    if (hs == NULL)
+        return;
+    for (int l = 0; l < hs->n_levels; l++)
+        if (hs->levels[l].cms)
+            cms_free(hs->levels[l].cms);
+    cms_mem_free(hs->exact_cells, hs->n_exact_cells * sizeof(uint64_t));
+    free(hs->block);
+    free(hs->prefix_keys);
+    free(hs);
+}
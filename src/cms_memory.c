@@ -0,0 +1,201 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS, MAP_HUGETLB, madvise
+#include "headers/cms_memory.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <omp.h>
+
+typedef struct {
+    void *ptr;     // NULL for a free slot
+    size_t length; // Mapped bytes
+} PoolBlock;
+
+static cms_page_mode page_mode = CMS_PAGES_AUTO;
+static int table_threads = 0;    // Threads that first touch the tables (0 = the caller)
+static int hugetlb_warned = 0;
+static PoolBlock pool[CMS_MEM_POOL_SLOTS];
+static CmsMemStats mem_stats;
+
+/*
+    Convert the command-line name of a page mode to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int cms_page_mode_parse(const char *name, cms_page_mode *mode) {
+    if (strcmp(name, "auto") == 0)
+        *mode = CMS_PAGES_AUTO;
+    else if (strcmp(name, "small") == 0)
+        *mode = CMS_PAGES_SMALL;
+    else if (strcmp(name, "hugetlb") == 0)
+        *mode = CMS_PAGES_HUGETLB;
+    else
+        return -1;
+    return 0;
+}
+
+const char *cms_page_mode_name(cms_page_mode mode) {
+    switch (mode) {
+        case CMS_PAGES_AUTO:    return "auto";
+        case CMS_PAGES_SMALL:   return "small";
+        case CMS_PAGES_HUGETLB: return "hugetlb";
+    }
+    return "unknown";
+}
+
+void cms_mem_set_pages(cms_page_mode mode) {
+    page_mode = mode;
+}
+
+/*
+    Threads that will update the tables allocated from now on
+    (0 or 1 = the calling thread)
+*/
+void cms_mem_set_threads(int n_threads) {
+    table_threads = n_threads;
+}
+
+/*
+    Bytes actually mapped for a block: whole huge pages for the large
+    blocks, so that the pool can match them and munmap gets a valid length
+*/
+static size_t mapped_length(size_t bytes) {
+    size_t unit = (bytes >= CMS_MEM_HUGE_PAGE) ? CMS_MEM_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+    if (bytes == 0)
+        bytes = 1;
+    return (bytes + unit - 1) / unit * unit;
+}
+
+/*
+    Map length bytes of anonymous memory, aligned on a huge page when the
+    block is made of huge pages. Returns NULL on failure.
+*/
+static void *map_block(size_t length) {
+    int huge = (length % CMS_MEM_HUGE_PAGE == 0) && page_mode != CMS_PAGES_SMALL;
+
+#ifdef MAP_HUGETLB
+    if (huge && page_mode == CMS_PAGES_HUGETLB) {
+        void *ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            mem_stats.hugetlb_bytes += length;
+            return ptr;
+        }
+        if (!hugetlb_warned) {
+            fprintf(stderr, "Warning: no reserved huge pages for %zu bytes (%s), using transparent huge pages\n",
+                    length, strerror(errno));
+            hugetlb_warned = 1;
+        }
+    }
+#endif
+    if (!huge) {
+        void *ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return (ptr == MAP_FAILED) ? NULL : ptr;
+    }
+
+    // Transparent huge pages only back 2 MB aligned ranges: over-map, then trim both ends
+    size_t padded = length + CMS_MEM_HUGE_PAGE;
+    uint8_t *raw = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+    uintptr_t aligned = ((uintptr_t)raw + CMS_MEM_HUGE_PAGE - 1) & ~(uintptr_t)(CMS_MEM_HUGE_PAGE - 1);
+    size_t head = aligned - (uintptr_t)raw;
+    if (head > 0)
+        munmap(raw, head);
+    if (padded - head - length > 0)
+        munmap((uint8_t *)aligned + length, padded - head - length);
+#ifdef MADV_HUGEPAGE
+    // A hint: the kernel may still use base pages (THP disabled, fragmentation)
+    if (madvise((void *)aligned, length, MADV_HUGEPAGE) == 0)
+        mem_stats.thp_bytes += length;
+#endif
+    return (void *)aligned;
+}
+
+/*
+    First write to the pages of a block, which places each page on the NUMA
+    node of the thread that writes it. A fresh block is already zero and
+    only needs one write per page; a pooled block is cleared completely.
+    The pages are split among the threads with the static schedule of the
+    threaded updates, so that every thread owns a contiguous slice.
+*/
+static void first_touch(uint8_t *ptr, size_t length, int n_threads, int clear) {
+    const long page = sysconf(_SC_PAGESIZE);
+    const long n_pages = (long)(length / (size_t)page);
+    if (n_threads < 1)
+        n_threads = 1;
+    #pragma omp parallel for schedule(static) num_threads(n_threads) if(n_threads > 1)
+    for (long p = 0; p < n_pages; p++) {
+        if (clear)
+            memset(ptr + p * page, 0, (size_t)page);
+        else
+            ((volatile uint8_t *)ptr)[p * page] = 0;
+    }
+}
+
+/*
+    Block of at least bytes bytes, page aligned. Tables are zeroed and first
+    touched by the update threads; buffers are left as they are, their pages
+    are placed by the I/O that fills them (a large read buffer is often only
+    partly used). Taken from the pool when a freed block of the same mapped
+    size is available. Returns NULL on failure.
+*/
+void *cms_mem_alloc(size_t bytes, cms_mem_kind kind) {
+    size_t length = mapped_length(bytes);
+    int table = (kind == CMS_MEM_TABLE);
+
+    for (int s = 0; s < CMS_MEM_POOL_SLOTS; s++) {
+        if (pool[s].ptr != NULL && pool[s].length == length) {
+            void *ptr = pool[s].ptr;
+            pool[s].ptr = NULL;
+            mem_stats.pooled_bytes -= length;
+            mem_stats.pool_hits++;
+            mem_stats.allocations++;
+            if (table)
+                first_touch(ptr, length, table_threads, 1);
+            return ptr;
+        }
+    }
+
+    void *ptr = map_block(length);
+    if (ptr == NULL)
+        return NULL;
+    mem_stats.allocations++;
+    if (table)
+        first_touch(ptr, length, table_threads, 0);
+    return ptr;
+}
+
+/*
+    Give back a block of cms_mem_alloc, with the size it was requested
+    with. The block goes to the pool if a slot is free, to the kernel
+    otherwise.
+*/
+void cms_mem_free(void *ptr, size_t bytes) {
+    if (ptr == NULL)
+        return;
+    size_t length = mapped_length(bytes);
+    for (int s = 0; s < CMS_MEM_POOL_SLOTS; s++) {
+        if (pool[s].ptr == NULL) {
+            pool[s].ptr = ptr;
+            pool[s].length = length;
+            mem_stats.pooled_bytes += length;
+            return;
+        }
+    }
+    munmap(ptr, length);
+}
+
+/*
+    Return the pooled blocks to the kernel
+*/
+void cms_mem_pool_release(void) {
+    for (int s = 0; s < CMS_MEM_POOL_SLOTS; s++) {
+        if (pool[s].ptr != NULL)
+            munmap(pool[s].ptr, pool[s].length);
+        pool[s].ptr = NULL;
+    }
+    mem_stats.pooled_bytes = 0;
+}
+
+void cms_mem_stats(CmsMemStats *stats) {
+    *stats = mem_stats;
+}
@@ -0,0 +1,189 @@
+#include "headers/cms_kernels.h"
+
+#include <immintrin.h>
+
+/*
+    Vectorized batch update kernels for the multiply-shift hash family.
+
+    The keys are loaded 8 at a time and byte-swapped in register (the input
+    is in network byte order). For every row the 8 columns are computed as
+        (a*x + b) >> (64 - log2(width))
+    on 64-bit lanes, then the cells are incremented with scalar stores:
+    x86 has no conflict-free scatter-add, and two keys of the same batch
+    may hit the same cell.
+*/
+
+#define SIMD_KEYS 8 // Keys processed per iteration by both kernels
+
+/*
+    Byte-swap the eight 32-bit lanes of v (network to host order)
+*/
+__attribute__((target("avx2")))
+static inline __m256i bswap32_avx2(__m256i v) {
+    const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    return _mm256_shuffle_epi8(v, mask);
+}
+
+/*
+    Low 64 bits of a*x + b for four 64-bit lanes, where x < 2^32.
+    AVX2 only has a 32x32->64 multiply, so a*x is split as
+        a_lo*x + (a_hi*x << 32)
+*/
+__attribute__((target("avx2")))
+static inline __m256i mul_add_avx2(__m256i x, __m256i a_lo, __m256i a_hi, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(x, a_lo);
+    __m256i hi = _mm256_slli_epi64(_mm256_mul_epu32(x, a_hi), 32);
+    return _mm256_add_epi64(_mm256_add_epi64(lo, hi), b);
+}
+
+/*
+    AVX2 kernel: two 4-lane halves per batch of 8 keys
+*/
+__attribute__((target("avx2")))
+void cms_batch_update_avx2(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) {
+    const int depth = cms->depth;
+    const int width = cms->width;
+    const __m128i shift = _mm_cvtsi32_si128(cms->hash_shift);
+    uint32_t *table = cms->table;
+    uint64_t cols[SIMD_KEYS];
+
+    size_t i = 0;
+    for (; i + SIMD_KEYS <= n_keys; i += SIMD_KEYS) {
+        __m256i k = bswap32_avx2(_mm256_loadu_si256((const __m256i *)&keys[i * IP_SIZE]));
+        __m256i x0 = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(k));
+        __m256i x1 = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(k, 1));
+
+        for (int row = 0; row < depth; row++) {
+            __m256i a_lo = _mm256_set1_epi64x((long long)cms->hash_a[row]);
+            __m256i a_hi = _mm256_set1_epi64x((long long)(cms->hash_a[row] >> 32));
+            __m256i b = _mm256_set1_epi64x((long long)cms->hash_b[row]);
+
+            __m256i h0 = _mm256_srl_epi64(mul_add_avx2(x0, a_lo, a_hi, b), shift);
+            __m256i h1 = _mm256_srl_epi64(mul_add_avx2(x1, a_lo, a_hi, b), shift);
+            _mm256_storeu_si256((__m256i *)&cols[0], h0);
+            _mm256_storeu_si256((__m256i *)&cols[4], h1);
+
+            uint32_t *row_cells = &table[(size_t)row * width];
+            for (int j = 0; j < SIMD_KEYS; j++)
+                row_cells[cols[j]]++;
+        }
+    }
+    // Tail of the batch
+    cms_batch_update_scalar(cms, &keys[i * IP_SIZE], n_keys - i);
+}
+
+/*
+    AVX-512 kernel: one 8-lane vector per batch of 8 keys,
+    with a native 64-bit multiply (AVX512DQ)
+*/
+__attribute__((target("avx2,avx512f,avx512dq")))
+void cms_batch_update_avx512(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) {
+    const int depth = cms->depth;
+    const int width = cms->width;
+    const __m128i shift = _mm_cvtsi32_si128(cms->hash_shift);
+    uint32_t *table = cms->table;
+    uint32_t cols[SIMD_KEYS];
+
+    size_t i = 0;
+    for (; i + SIMD_KEYS <= n_keys; i += SIMD_KEYS) {
+        __m256i k = bswap32_avx2(_mm256_loadu_si256((const __m256i *)&keys[i * IP_SIZE]));
+        __m512i x = _mm512_cvtepu32_epi64(k);
+
+        for (int row = 0; row < depth; row++) {
+            __m512i a = _mm512_set1_epi64((long long)cms->hash_a[row]);
+            __m512i b = _mm512_set1_epi64((long long)cms->hash_b[row]);
+            __m512i h = _mm512_srl_epi64(_mm512_add_epi64(_mm512_mullo_epi64(x, a), b), shift);
+            _mm256_storeu_si256((__m256i *)cols, _mm512_cvtepi64_epi32(h));
+
+            uint32_t *row_cells = &table[(size_t)row * width];
+            for (int j = 0; j < SIMD_KEYS; j++)
+                row_cells[cols[j]]++;
+        }
+    }
+    // Tail of the batch
+    cms_batch_update_scalar(cms, &keys[i * IP_SIZE], n_keys - i);
+}
+
+/*
+    Batch query kernels: the 8 columns of a row are computed as in the
+    update, the 8 counters are fetched with a single gather and the
+    running minimum over the rows is kept in a vector register
+*/
+__attribute__((target("avx2")))
+void cms_batch_query_avx2(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint64_t *estimates) {
+    const int depth = cms->depth;
+    const int width = cms->width;
+    const __m128i shift = _mm_cvtsi32_si128(cms->hash_shift);
+    // Low dword of each 64-bit lane first: columns fit in 31 bits
+    const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+    size_t i = 0;
+    for (; i + SIMD_KEYS <= n_keys; i += SIMD_KEYS) {
+        __m256i k = bswap32_avx2(_mm256_loadu_si256((const __m256i *)&keys[i * IP_SIZE]));
+        __m256i x0 = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(k));
+        __m256i x1 = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(k, 1));
+        __m256i min = _mm256_set1_epi32(-1);
+
+        for (int row = 0; row < depth; row++) {
+            __m256i a_lo = _mm256_set1_epi64x((long long)cms->hash_a[row]);
+            __m256i a_hi = _mm256_set1_epi64x((long long)(cms->hash_a[row] >> 32));
+            __m256i b = _mm256_set1_epi64x((long long)cms->hash_b[row]);
+
+            __m256i h0 = _mm256_permutevar8x32_epi32(_mm256_srl_epi64(mul_add_avx2(x0, a_lo, a_hi, b), shift), pack);
+            __m256i h1 = _mm256_permutevar8x32_epi32(_mm256_srl_epi64(mul_add_avx2(x1, a_lo, a_hi, b), shift), pack);
+            __m256i cols = _mm256_permute2x128_si256(h0, h1, 0x20);
+
+            const int *row_cells = (const int *)&cms->table[(size_t)row * width];
+            min = _mm256_min_epu32(min, _mm256_i32gather_epi32(row_cells, cols, 4));
+        }
+        _mm256_storeu_si256((__m256i *)&estimates[i], _mm256_cvtepu32_epi64(_mm256_castsi256_si128(min)));
+        _mm256_storeu_si256((__m256i *)&estimates[i + 4], _mm256_cvtepu32_epi64(_mm256_extracti128_si256(min, 1)));
+    }
+    // Tail of the batch
+    cms_batch_query_scalar(cms, &keys[i * IP_SIZE], n_keys - i, &estimates[i]);
+}
+
+__attribute__((target("avx2,avx512f,avx512dq")))
+void cms_batch_query_avx512(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint64_t *estimates) {
+    const int depth = cms->depth;
+    const int width = cms->width;
+    const __m128i shift = _mm_cvtsi32_si128(cms->hash_shift);
+
+    size_t i = 0;
+    for (; i + SIMD_KEYS <= n_keys; i += SIMD_KEYS) {
+        __m256i k = bswap32_avx2(_mm256_loadu_si256((const __m256i *)&keys[i * IP_SIZE]));
+        __m512i x = _mm512_cvtepu32_epi64(k);
+        __m256i min = _mm256_set1_epi32(-1);
+
+        for (int row = 0; row < depth; row++) {
+            __m512i a = _mm512_set1_epi64((long long)cms->hash_a[row]);
+            __m512i b = _mm512_set1_epi64((long long)cms->hash_b[row]);
+            __m512i h = _mm512_srl_epi64(_mm512_add_epi64(_mm512_mullo_epi64(x, a), b), shift);
+
+            const int *row_cells = (const int *)&cms->table[(size_t)row * width];
+            min = _mm256_min_epu32(min, _mm256_i32gather_epi32(row_cells, _mm512_cvtepi64_epi32(h), 4));
+        }
+        _mm256_storeu_si256((__m256i *)&estimates[i], _mm256_cvtepu32_epi64(_mm256_castsi256_si128(min)));
+        _mm256_storeu_si256((__m256i *)&estimates[i + 4], _mm256_cvtepu32_epi64(_mm256_extracti128_si256(min, 1)));
+    }
+    // Tail of the batch
+    cms_batch_query_scalar(cms, &keys[i * IP_SIZE], n_keys - i, &estimates[i]);
+}
+
+/*
+    Runtime CPU feature detection for the kernels
+*/
+int cms_kernel_supported(cms_kernel kernel) {
+    switch (kernel) {
+        case CMS_KERNEL_AUTO:
+        case CMS_KERNEL_SCALAR:
+            return 1;
+        case CMS_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case CMS_KERNEL_AVX512:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512f") &&
+                   __builtin_cpu_supports("avx512dq");
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include "headers/cms_kernels.h"
+#include "headers/util.h"
+
+/*
+    Compile-time specialized update/query kernels.
+
+    The generic kernels loop over a runtime depth and reduce the hash with
+    a runtime modulo. Here the kernels are instantiated from a macro
+    template for every depth in [1, CMS_SPECIALIZED_MAX_DEPTH] and for
+    power-of-two widths, so that the row loop is fully unrolled, the
+    modulo by the prime becomes a multiplication by a constant and the
+    modulo by the width becomes a mask or a shift.
+    Every kernel returns exactly the same columns as cms_hash.
+*/
+
+#define CMS_MODPRIME_P 4294967291ULL // Same prime as cms->prime
+
+// Hash value before the reduction to [0, width)
+#define RAW_MODPRIME(cms, x, row) \
+    (((cms)->hash_a[row] * (uint64_t)(x) + (cms)->hash_b[row]) % CMS_MODPRIME_P)
+
+static inline uint64_t raw_mersenne(const CountMinSketch *cms, uint32_t x, int row) {
+    unsigned __int128 v = (unsigned __int128)cms->hash_a[row] * x + cms->hash_b[row];
+    uint64_t h = (uint64_t)(v & CMS_MERSENNE_61) + (uint64_t)(v >> 61);
+    h = (h & CMS_MERSENNE_61) + (h >> 61);
+    if (h >= CMS_MERSENNE_61)
+        h -= CMS_MERSENNE_61;
+    return h;
+}
+
+/*
+    Column of x in row for each (family, width) specialization.
+    For power-of-two widths the fastrange reduction of the Mersenne family,
+    (h * width) >> 61, is the shift h >> (61 - log2(width)).
+*/
+#define COLUMN_MODPRIME_ANY(cms, x, row)  ((uint32_t)(RAW_MODPRIME(cms, x, row) % (uint32_t)(cms)->width))
+#define COLUMN_MODPRIME_POW2(cms, x, row) ((uint32_t)(RAW_MODPRIME(cms, x, row) & (uint32_t)((cms)->width - 1)))
+#define COLUMN_MERSENNE_ANY(cms, x, row) \
+    ((uint32_t)(((unsigned __int128)raw_mersenne(cms, x, row) * (uint32_t)(cms)->width) >> 61))
+#define COLUMN_MERSENNE_POW2(cms, x, row) \
+    ((uint32_t)(raw_mersenne(cms, x, row) >> ((cms)->hash_shift - 3)))
+#define COLUMN_MULTISHIFT(cms, x, row) \
+    ((uint32_t)(((cms)->hash_a[row] * (uint64_t)(x) + (cms)->hash_b[row]) >> (cms)->hash_shift))
+
+/*
+    Template of the update, query and batch kernels for a hash
+    specialization NAME and a fixed depth D
+*/
+#define CMS_DEFINE_KERNELS(NAME, COLUMN, D)                                                  \
+    static void cms_update_##NAME##_d##D(CountMinSketch *cms, uint32_t x) {                  \
+        uint32_t *table = cms->table;                                                        \
+        const size_t width = (size_t)cms->width;                                             \
+        _Pragma("GCC unroll 8")                                                              \
+        for (int row = 0; row < D; row++)                                                    \
+            table[row * width + COLUMN(cms, x, row)]++;                                      \
+    }                                                                                        \
+    static uint64_t cms_query_##NAME##_d##D(const CountMinSketch *cms, uint32_t x) {         \
+        const uint32_t *table = cms->table;                                                  \
+        const size_t width = (size_t)cms->width;                                             \
+        uint32_t min_count = UINT32_MAX;                                                     \
+        _Pragma("GCC unroll 8")                                                              \
+        for (int row = 0; row < D; row++) {                                                  \
+            uint32_t count = table[row * width + COLUMN(cms, x, row)];                       \
+            min_count = (count < min_count) ? count : min_count;                             \
+        }                                                                                    \
+        return min_count;                                                                    \
+    }                                                                                        \
+    static void cms_batch_##NAME##_d##D(CountMinSketch *cms, const uint8_t *keys, size_t n_keys) { \
+        for (size_t i = 0; i < n_keys; i++)                                                  \
+            cms_update_##NAME##_d##D(cms, ip_to_int(&keys[i * IP_SIZE]));                    \
+    }                                                                                        \
+    static void cms_cells_##NAME##_d##D(const CountMinSketch *cms, uint32_t x, size_t *cells) { \
+        const size_t width = (size_t)cms->width;                                             \
+        _Pragma("GCC unroll 8")                                                              \
+        for (int row = 0; row < D; row++)                                                    \
+            cells[row] = row * width + COLUMN(cms, x, row);                                  \
+    }
+
+// Instantiate the kernels of one specialization for every depth
+#define CMS_DEFINE_ALL_DEPTHS(NAME, COLUMN) \
+    CMS_DEFINE_KERNELS(NAME, COLUMN, 1)     \
+    CMS_DEFINE_KERNELS(NAME, COLUMN, 2)     \
+    CMS_DEFINE_KERNELS(NAME, COLUMN, 3)     \
+    CMS_DEFINE_KERNELS(NAME, COLUMN, 4)     \
+    CMS_DEFINE_KERNELS(NAME, COLUMN, 5)     \
+    CMS_DEFINE_KERNELS(NAME, COLUMN, 6)     \
+    CMS_DEFINE_KERNELS(NAME, COLUMN, 7)     \
+    CMS_DEFINE_KERNELS(NAME, COLUMN, 8)
+
+// Dispatch table of one specialization, indexed by depth - 1
+#define CMS_KERNEL_ENTRY(NAME, D) \
+    { cms_update_##NAME##_d##D, cms_query_##NAME##_d##D, cms_batch_##NAME##_d##D, cms_cells_##NAME##_d##D }
+#define CMS_KERNEL_TABLE(NAME)                                                   \
+    static const CmsKernelSet kernels_##NAME[CMS_SPECIALIZED_MAX_DEPTH] = {      \
+        CMS_KERNEL_ENTRY(NAME, 1), CMS_KERNEL_ENTRY(NAME, 2),                   \
+        CMS_KERNEL_ENTRY(NAME, 3), CMS_KERNEL_ENTRY(NAME, 4),                   \
+        CMS_KERNEL_ENTRY(NAME, 5), CMS_KERNEL_ENTRY(NAME, 6),                   \
+        CMS_KERNEL_ENTRY(NAME, 7), CMS_KERNEL_ENTRY(NAME, 8)                    \
+    };
+
+typedef struct {
+    cms_update_fn update;
+    cms_query_fn query;
+    cms_batch_fn batch;
+    cms_cells_fn cells;
+} CmsKernelSet;
+
+CMS_DEFINE_ALL_DEPTHS(modprime_any, COLUMN_MODPRIME_ANY)
+CMS_DEFINE_ALL_DEPTHS(modprime_pow2, COLUMN_MODPRIME_POW2)
+CMS_DEFINE_ALL_DEPTHS(mersenne_any, COLUMN_MERSENNE_ANY)
+CMS_DEFINE_ALL_DEPTHS(mersenne_pow2, COLUMN_MERSENNE_POW2)
+CMS_DEFINE_ALL_DEPTHS(multishift, COLUMN_MULTISHIFT)
+
+CMS_KERNEL_TABLE(modprime_any)
+CMS_KERNEL_TABLE(modprime_pow2)
+CMS_KERNEL_TABLE(mersenne_any)
+CMS_KERNEL_TABLE(mersenne_pow2)
+CMS_KERNEL_TABLE(multishift)
+
+/*
+    Point the per-key update/query/cells functions and the scalar batch
+    kernel of the sketch to the specialized kernels matching its dimensions.
+    Returns 1 if a specialized kernel was found, 0 if the sketch keeps the
+    generic kernels (depth > CMS_SPECIALIZED_MAX_DEPTH).
+*/
+int cms_select_specialized(CountMinSketch *cms) {
+    if (cms->depth < 1 || cms->depth > CMS_SPECIALIZED_MAX_DEPTH)
+        return 0;
+
+    int pow2 = (cms->width & (cms->width - 1)) == 0;
+    const CmsKernelSet *set;
+    switch (cms->hash_family) {
+        case CMS_HASH_MULTISHIFT:
+            set = kernels_multishift;
+            break;
+        case CMS_HASH_MERSENNE:
+            // The shift form needs 2 <= width <= 2^61
+            if (pow2 && cms->width >= 2) {
+                int log2w = 0;
+                while ((1 << log2w) < cms->width)
+                    log2w++;
+                cms->hash_shift = 64 - log2w;
+                set = kernels_mersenne_pow2;
+            } else {
+                set = kernels_mersenne_any;
+            }
+            break;
+        case CMS_HASH_MODPRIME:
+        default:
+            set = pow2 ? kernels_modprime_pow2 : kernels_modprime_any;
+            break;
+    }
+
+    cms->update_one = set[cms->depth - 1].update;
+    cms->query_one = set[cms->depth - 1].query;
+    cms->scalar_batch = set[cms->depth - 1].batch;
+    cms->cells_one = set[cms->depth - 1].cells;
+    return 1;
+}
@@ -0,0 +1,195 @@
+#include "headers/cms_window.h"
+
+/*
+    Create a window of n_epochs sketches of width x depth.
+    All the epochs and the aggregate are created with the same
+    configuration, hence the same seed and hash functions, so their
+    tables can be added and subtracted cell by cell.
+    Returns NULL on error.
+*/
+WindowedSketch *cms_window_create(int width, int depth, int n_epochs, const CmsConfig *config) {
+    if (n_epochs < 1) {
+        fprintf(stderr, "Error: a window needs at least one epoch.\n");
+        return NULL;
+    }
+    // Expiring an epoch relies on the modular subtraction of 32-bit cells
+    if (config != NULL && config->counters != CMS_COUNTER_32) {
+        fprintf(stderr, "Error: a window needs 32-bit counters.\n");
+        return NULL;
+    }
+    WindowedSketch *ws = calloc(1, sizeof(WindowedSketch));
+    if (ws == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for WindowedSketch structure.\n");
+        return NULL;
+    }
+    ws->n_epochs = n_epochs;
+    ws->epochs = calloc(n_epochs, sizeof(CountMinSketch *));
+    ws->epoch_keys = calloc(n_epochs, sizeof(unsigned long long));
+    if (ws->epochs == NULL || ws->epoch_keys == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for the window epochs.\n");
+        cms_window_free(ws);
+        return NULL;
+    }
+
+    ws->aggregate = cms_create_ex(width, depth, config);
+    if (ws->aggregate == NULL) {
+        cms_window_free(ws);
+        return NULL;
+    }
+    for (int e = 0; e < n_epochs; e++) {
+        CountMinSketch *epoch = cms_create_ex(width, depth, config);
+        if (epoch == NULL) {
+            cms_window_free(ws);
+            return NULL;
+        }
+        ws->epochs[e] = epoch;
+    }
+    return ws;
+}
+
+/*
+    Same as cms_window_create, with the dimensions of cms_create_from_error
+*/
+WindowedSketch *cms_window_create_from_error(double eps, double delta, int n_epochs, const CmsConfig *config) {
+    int width, depth;
+    if (cms_dimensions_from_error(eps, delta, &width, &depth) == -1) return NULL;
+    return cms_window_create(width, depth, n_epochs, config);
+}
+
+void cms_window_update(WindowedSketch *ws, uint32_t key) {
+    cms_update(ws->epochs[ws->current], key);
+    ws->epoch_keys[ws->current]++;
+}
+
+void cms_window_batch_update(WindowedSketch *ws, const uint8_t *keys, size_t n_keys) {
+    cms_batch_update(ws->epochs[ws->current], keys, n_keys);
+    ws->epoch_keys[ws->current] += n_keys;
+}
+
+/*
+    Add a sketch built with the same hash functions (e.g. the reduced
+    counts of the other ranks) holding n_keys keys to the current epoch
+*/
+void cms_window_merge(WindowedSketch *ws, const CountMinSketch *delta, unsigned long long n_keys) {
+    cms_merge_into(ws->epochs[ws->current], delta);
+    ws->epoch_keys[ws->current] += n_keys;
+}
+
+/*
+    Close the current epoch: it joins the aggregate, the oldest epoch
+    leaves it and is reused, empty, as the new current epoch.
+    Counters are modular, so the subtraction is exact even if a cell of
+    the aggregate wrapped around in between.
+*/
+void cms_window_rotate(WindowedSketch *ws) {
+    size_t n_cells = (size_t)ws->aggregate->width * ws->aggregate->depth;
+    uint32_t *aggregate = ws->aggregate->table;
+    const uint32_t *closed = ws->epochs[ws->current]->table;
+
+    ws->current = (ws->current + 1) % ws->n_epochs;
+    uint32_t *expired = ws->epochs[ws->current]->table;
+    for (size_t i = 0; i < n_cells; i++)
+        aggregate[i] = aggregate[i] + closed[i] - expired[i];
+    memset(expired, 0, n_cells * sizeof(uint32_t));
+    ws->epoch_keys[ws->current] = 0;
+    ws->rotations++;
+}
+
+/*
+    Clamp last_n to [1, n_epochs]
+*/
+static int window_span(const WindowedSketch *ws, int last_n) {
+    if (last_n < 1)
+        return 1;
+    return (last_n > ws->n_epochs) ? ws->n_epochs : last_n;
+}
+
+/*
+    Counter of a cell summed over the last n epochs. Past half the window
+    it is cheaper to start from the whole window and remove the oldest
+    epochs, but the 32-bit aggregate wraps: that shortcut is only taken
+    while the window holds fewer than 2^32 keys (no cell can wrap then).
+*/
+static uint64_t window_cell(const WindowedSketch *ws, size_t cell, int last_n, int wrap_free) {
+    int k = ws->n_epochs;
+    if (wrap_free && 2 * last_n > k) {
+        uint32_t count = ws->aggregate->table[cell] + ws->epochs[ws->current]->table[cell];
+        for (int i = last_n; i < k; i++)
+            count -= ws->epochs[(ws->current - i + k) % k]->table[cell];
+        return count;
+    }
+    uint64_t count = 0;
+    for (int i = 0; i < last_n; i++)
+        count += ws->epochs[(ws->current - i + k) % k]->table[cell];
+    return count;
+}
+
+/*
+    Estimated count of key over the last last_n epochs (the current one
+    included, clamped to the window length)
+*/
+uint64_t cms_window_query(const WindowedSketch *ws, uint32_t key, int last_n) {
+    const CountMinSketch *ref = ws->aggregate;
+    last_n = window_span(ws, last_n);
+    int wrap_free = (cms_window_keys(ws, ws->n_epochs) <= UINT32_MAX);
+    uint64_t min_count = UINT64_MAX;
+    for (int row = 0; row < ref->depth; row++) {
+        size_t cell = (size_t)row * ref->width + cms_hash(ref, key, row);
+        uint64_t count = window_cell(ws, cell, last_n, wrap_free);
+        if (count < min_count)
+            min_count = count;
+    }
+    return min_count;
+}
+
+/*
+    Number of keys counted in the last last_n epochs
+*/
+unsigned long long cms_window_keys(const WindowedSketch *ws, int last_n) {
+    last_n = window_span(ws, last_n);
+    unsigned long long total = 0;
+    for (int i = 0; i < last_n; i++)
+        total += ws->epoch_keys[(ws->current - i + ws->n_epochs) % ws->n_epochs];
+    return total;
+}
+
+/*
+    Materialize the last last_n epochs in out, a sketch created with the
+    configuration of the window, to run several queries or a merge on a
+    plain sketch.
+    Returns 0 on success, -1 if the dimensions or hash functions differ.
+*/
+int cms_window_snapshot(const WindowedSketch *ws, int last_n, CountMinSketch *out) {
+    const CountMinSketch *ref = ws->aggregate;
+    if (out->width != ref->width || out->depth != ref->depth || out->hash_family != ref->hash_family ||
+        memcmp(out->hash_a, ref->hash_a, ref->depth * sizeof(uint64_t)) != 0 ||
+        memcmp(out->hash_b, ref->hash_b, ref->depth * sizeof(uint64_t)) != 0) {
+        fprintf(stderr, "Error: snapshot sketch does not match the window dimensions and hash functions.\n");
+        return -1;
+    }
+    last_n = window_span(ws, last_n);
+    size_t n_cells = (size_t)ref->width * ref->depth;
+    int wrap_free = (cms_window_keys(ws, ws->n_epochs) <= UINT32_MAX);
+    for (size_t i = 0; i < n_cells; i++)
+        out->table[i] = (uint32_t)window_cell(ws, i, last_n, wrap_free);
+    return 0;
+}
+
+/*
+    Free the window and all its epochs
+*/
+void cms_window_free(WindowedSketch *ws) {
+    if (ws == NULL)
+        return;
+    if (ws->epochs) {
+        for (int e = 0; e < ws->n_epochs; e++) {
+            if (ws->epochs[e])
+                cms_free(ws->epochs[e]);
+        }
+    }
+    if (ws->aggregate)
+        cms_free(ws->aggregate);
+    free(ws->epochs);
+    free(ws->epoch_keys);
+    free(ws);
+}
@@ -1,4 +1,6 @@
 #include "headers/file_io.h"
+
+#include <limits.h>
 /*
     Read IP addresses from a binary file using MPI I/O
     The function takes as input:
@@ -37,47 +39,271 @@ int read_buffer(MPI_File fh, uint8_t *buffer, MPI_Offset start_index, MPI_Offset
 }
 
 /*
-    Write the execution information to the output csv file
-    The file format is:
-        n_process,total_size,time_seconds
-    Each execution will append a new line to the file.
+    Default read configuration: two BUFFER_SIZE buffers, independent reads
+*/
+void read_config_default(ReadConfig *config) {
+    config->n_buffers = 2;
+    config->chunk_size = BUFFER_SIZE;
+    config->collective = 0;
+    config->info = MPI_INFO_NULL;
+    config->scheduler = NULL;
+    config->record_size = IP_SIZE;
+    config->data_offset = 0;
+}
+
+/*
+    Records per chunk: the chunk size rounded down to whole records (at least one)
 */
-int write_execution_info(const char *filename, int n_process, MPI_Offset n_elements, double time_seconds, double io_time, double compute_time) {
-    // Open the file in append mode
-    FILE *fp = fopen(filename, "a");
-    if (fp == NULL) {
-        fprintf(stderr, "File size is not a multiple of IP address size\n");
+MPI_Offset read_config_chunk_records(const ReadConfig *config) {
+    MPI_Offset records = config->chunk_size / config->record_size;
+    return records > 0 ? records : 1;
+}
+
+/*
+    Build an MPI_Info object holding the given hints.
+    With no hints *info is MPI_INFO_NULL. Returns 0 on success, -1 on error.
+*/
+int io_info_create(const IoHint *hints, int n_hints, MPI_Info *info) {
+    *info = MPI_INFO_NULL;
+    if (n_hints == 0)
+        return 0;
+    if (MPI_Info_create(info) != MPI_SUCCESS) {
+        fprintf(stderr, "Error: failed to create the MPI-IO hints\n");
         return -1;
     }
+    for (int i = 0; i < n_hints; i++)
+        MPI_Info_set(*info, hints[i].key, hints[i].value);
+    return 0;
+}
 
-    // Getting the POSIX file descriptor from the FILE pointer
-    int fd = fileno(fp);
-    if (fd == -1) {
-        fprintf(stderr, "Failed to get file descriptor\n");
-        fclose(fp);
-        return -1;
+/*
+    Record the completion time of the reads in flight that have finished.
+    Completion is only observed at pipeline calls, so done_times is the
+    first call that saw the read complete (0 while it is still pending).
+*/
+static void read_pipeline_poll(ReadPipeline *pipe, double now) {
+    for (int b = 0; b < pipe->n_buffers; b++) {
+        if (pipe->requests[b] == MPI_REQUEST_NULL || pipe->done_times[b] > 0.0)
+            continue;
+        int flag = 0;
+        MPI_Request_get_status(pipe->requests[b], &flag, MPI_STATUS_IGNORE);
+        if (flag)
+            pipe->done_times[b] = now;
+    }
+}
+
+/*
+    Issue the nonblocking read of the next chunk of the range into buffer b.
+    In collective mode every rank issues the same sequence of reads, the
+    ranks whose range is exhausted take part with an empty read.
+    In dynamic mode the chunk is claimed from the scheduler; once the file
+    is exhausted the buffer is left without a pending read.
+*/
+static int read_pipeline_issue(ReadPipeline *pipe, int b) {
+    if (pipe->scheduler) {
+        MPI_Offset first, count;
+        pipe->counts[b] = 0;
+        if (!chunk_scheduler_claim(pipe->scheduler, &first, &count))
+            return 0;
+        if (MPI_File_iread_at(pipe->fh, pipe->data_offset + first * pipe->record_size, pipe->buffers[b],
+                              (int)(count * pipe->record_size),
+                              MPI_BYTE, &pipe->requests[b]) != MPI_SUCCESS) {
+            fprintf(stderr, "Error: nonblocking read failed at address %lld\n", (long long)first);
+            return -1;
+        }
+        pipe->issue_times[b] = MPI_Wtime();
+        pipe->done_times[b] = 0.0;
+        read_pipeline_poll(pipe, pipe->issue_times[b]);
+        pipe->counts[b] = count;
+        pipe->issued += count;
+        return 0;
     }
-    // Lock the file for exclusive access
-    if (flock(fd, LOCK_EX) == -1) {
-        fprintf(stderr, "Failed to lock file\n");
-        fclose(fp);
+
+    MPI_Offset remaining = pipe->n_addresses - pipe->issued;
+    MPI_Offset count = (remaining > pipe->chunk_addresses) ? pipe->chunk_addresses : remaining;
+
+    pipe->counts[b] = count;
+    int err;
+    if (pipe->collective) {
+        // Offsets are relative to the view, which starts at the first address of the rank
+        MPI_Offset offset = pipe->issued * pipe->record_size;
+        err = MPI_File_iread_at_all(pipe->fh, offset, pipe->buffers[b], (int)(count * pipe->record_size),
+                                    MPI_BYTE, &pipe->requests[b]);
+    } else {
+        MPI_Offset offset = pipe->data_offset + (pipe->start_index + pipe->issued) * pipe->record_size;
+        err = MPI_File_iread_at(pipe->fh, offset, pipe->buffers[b], (int)(count * pipe->record_size),
+                                MPI_BYTE, &pipe->requests[b]);
+    }
+    if (err != MPI_SUCCESS) {
+        fprintf(stderr, "Error: nonblocking read failed at address %lld\n",
+                (long long)(pipe->start_index + pipe->issued));
         return -1;
     }
+    // The read can progress in the background from here on
+    pipe->issue_times[b] = MPI_Wtime();
+    pipe->done_times[b] = 0.0;
+    // A read the MPI-IO layer completed inside the call was never in flight
+    read_pipeline_poll(pipe, pipe->issue_times[b]);
+    pipe->issued += count;
+    return 0;
+}
 
-    // Write the execution info (note: MPI_Offset is typically a long long)
-    if (fprintf(fp, "%d,%lld,%.6f,,%.6f,,%.6f\n", n_process, (long long)n_elements, time_seconds, io_time, compute_time) == -1) {
-        fprintf(stderr, "Failed to write to file\n");
+/*
+    Prepare a pipelined read of n_addresses addresses starting at start_index.
+    With config->n_buffers == 1 every chunk is read and waited for before
+    being returned, as read_buffer does; with more buffers up to
+    n_buffers - 1 reads stay in flight while the caller processes the
+    current chunk.
+    In collective mode the call is collective over comm (the communicator
+    the file was opened on): the rank view starts at start_index and
+    the reads go through MPI_File_iread_at_all, letting the MPI-IO layer
+    aggregate them according to the hints.
+    With config->scheduler the range is ignored and the chunks are
+    claimed dynamically (independent reads only).
+    Returns 0 on success, -1 on error; in collective mode an allocation
+    failure on any rank makes every rank return -1 before a read is posted.
+*/
+int read_pipeline_init(ReadPipeline *pipe, MPI_File fh, MPI_Comm comm, const ReadConfig *config,
+                       MPI_Offset start_index, MPI_Offset n_addresses) {
+    memset(pipe, 0, sizeof(*pipe));
+    int n_buffers = (config->n_buffers < 1) ? 1 : config->n_buffers;
+    pipe->fh = fh;
+    pipe->n_buffers = n_buffers;
+    pipe->collective = config->collective;
+    pipe->record_size = config->record_size;
+    pipe->data_offset = config->data_offset;
+    pipe->chunk_addresses = read_config_chunk_records(config);
+    pipe->start_index = start_index;
+    pipe->n_addresses = n_addresses;
+    pipe->n_chunks = (long)((n_addresses + pipe->chunk_addresses - 1) / pipe->chunk_addresses);
+    pipe->scheduler = config->scheduler;
+    if (pipe->scheduler) {
+        // The end is reached when a claim fails
+        pipe->collective = 0;
+        pipe->n_chunks = LONG_MAX;
+    }
 
-        flock(fd, LOCK_UN);
-        fclose(fp);
+    if (pipe->collective) {
+        // All the ranks must take part in the same number of collective reads
+        long local_chunks = pipe->n_chunks;
+        MPI_Allreduce(&local_chunks, &pipe->n_chunks, 1, MPI_LONG, MPI_MAX, comm);
+        MPI_File_set_view(fh, config->data_offset + start_index * config->record_size, MPI_BYTE, MPI_BYTE, "native", config->info);
+    }
+
+    pipe->buffers = calloc(n_buffers, sizeof(uint8_t *));
+    pipe->requests = malloc(n_buffers * sizeof(MPI_Request));
+    pipe->counts = calloc(n_buffers, sizeof(MPI_Offset));
+    pipe->issue_times = calloc(n_buffers, sizeof(double));
+    pipe->done_times = calloc(n_buffers, sizeof(double));
+    int error = 0;
+    if (pipe->requests) {
+        for (int b = 0; b < n_buffers; b++)
+            pipe->requests[b] = MPI_REQUEST_NULL;
+    }
+    if (!pipe->buffers || !pipe->requests || !pipe->counts || !pipe->issue_times || !pipe->done_times) {
+        fprintf(stderr, "Error: failed to allocate the read pipeline\n");
+        error = 1;
+    }
+    for (int b = 0; b < n_buffers && !error; b++) {
+        pipe->buffers[b] = cms_mem_alloc((size_t)pipe->chunk_addresses * pipe->record_size, CMS_MEM_BUFFER);
+        if (pipe->buffers[b] == NULL) {
+            fprintf(stderr, "Error: failed to allocate read buffer %d of the pipeline\n", b);
+            error = 1;
+        }
+    }
+    // Collective reads are only posted once every rank has its buffers
+    if (pipe->collective)
+        MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_LOR, comm);
+    if (error) {
+        read_pipeline_free(pipe);
         return -1;
     }
 
-    // Flush to ensure the data is actually written
-    fflush(fp);
-    
-    // Release lock and close the file
-    flock(fd, LOCK_UN);       
-    fclose(fp);
+    // Fill all the buffers but the one that will be returned last
+    double start = MPI_Wtime();
+    for (int b = 0; b < n_buffers - 1 && b < pipe->n_chunks; b++) {
+        if (read_pipeline_issue(pipe, b) == -1)
+            return -1;
+    }
+    pipe->exposed_time += MPI_Wtime() - start;
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+    Return the next chunk of the range.
+    The buffer returned by the previous call is recycled for a new read,
+    so the caller must be done with it. On success *data points to the
+    chunk and *count holds its number of addresses.
+    Returns 1 if a chunk was returned, 0 at the end of the range, -1 on error.
+*/
+int read_pipeline_next(ReadPipeline *pipe, uint8_t **data, MPI_Offset *count) {
+    if (pipe->next_chunk >= pipe->n_chunks)
+        return 0;
+
+    double start = MPI_Wtime();
+    read_pipeline_poll(pipe, start);
+    // Recycle the buffer released by the caller (or the last empty one on the first call)
+    long refill_chunk = pipe->next_chunk + pipe->n_buffers - 1;
+    if (refill_chunk < pipe->n_chunks) {
+        if (read_pipeline_issue(pipe, (int)(refill_chunk % pipe->n_buffers)) == -1)
+            return -1;
+    }
+
+    int b = (int)(pipe->next_chunk % pipe->n_buffers);
+    if (pipe->requests[b] == MPI_REQUEST_NULL) {
+        // Dynamic mode: no chunk left to claim
+        pipe->exposed_time += MPI_Wtime() - start;
+        pipe->n_chunks = pipe->next_chunk;
+        return 0;
+    }
+    double wait_start = MPI_Wtime();
+    MPI_Status status;
+    MPI_Wait(&pipe->requests[b], &status);
+    double wait_end = MPI_Wtime();
+    pipe->exposed_time += wait_end - start;
+    // Only the time the read was in flight before the wait counts as hidden
+    double done = (pipe->done_times[b] > 0.0) ? pipe->done_times[b] : wait_start;
+    pipe->hidden_time += done - pipe->issue_times[b];
+
+    int bytes_read = 0;
+    MPI_Get_count(&status, MPI_BYTE, &bytes_read);
+    if (bytes_read != pipe->counts[b] * pipe->record_size) {
+        fprintf(stderr, "Error: Process failed to read the expected number of bytes. Expected %lld, got %d\n",
+                (long long)(pipe->counts[b] * pipe->record_size), bytes_read);
+        return -1;
+    }
+
+    *data = pipe->buffers[b];
+    *count = pipe->counts[b];
+    pipe->next_chunk++;
+    return 1;
+}
+
+/*
+    Fraction of the time reads were in flight that was covered by the
+    caller's work (0 = fully serialized, 1 = I/O completely hidden).
+    Completion is observed at pipeline calls, so the hidden time is an
+    upper bound within the processing time of one chunk.
+*/
+double read_pipeline_overlap(const ReadPipeline *pipe) {
+    double total = pipe->hidden_time + pipe->exposed_time;
+    return (total > 0.0) ? pipe->hidden_time / total : 0.0;
+}
+
+/*
+    Wait for the pending reads and free the buffers of the pipeline
+*/
+void read_pipeline_free(ReadPipeline *pipe) {
+    for (int b = 0; b < pipe->n_buffers; b++) {
+        if (pipe->requests && pipe->requests[b] != MPI_REQUEST_NULL)
+            MPI_Wait(&pipe->requests[b], MPI_STATUS_IGNORE);
+        if (pipe->buffers)
+            cms_mem_free(pipe->buffers[b], (size_t)pipe->chunk_addresses * pipe->record_size);
+    }
+    free(pipe->buffers);
+    free(pipe->requests);
+    free(pipe->counts);
+    free(pipe->issue_times);
+    free(pipe->done_times);
+    memset(pipe, 0, sizeof(*pipe));
+}
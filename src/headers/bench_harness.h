@@ -0,0 +1,67 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Support code shared by the microbenchmarks of src/bench:
+    timing, hardware counters and JSON output.
+*/
+
+/*
+    Hardware counters of a measured region, read with perf_event_open.
+    valid is 0 when the counters are not available (non-Linux system,
+    perf_event_paranoid, containers without the syscall), and the
+    benchmarks then report null instead of a count.
+*/
+typedef struct {
+    int valid;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t cache_references;  // Last level cache accesses
+    uint64_t cache_misses;      // Last level cache misses
+} BenchCounters;
+
+#define BENCH_N_EVENTS 4
+
+typedef struct {
+    int fds[BENCH_N_EVENTS];  // Group of events, fds[0] is the leader (-1 if not open)
+    int available;
+} BenchPerf;
+
+double bench_now(void);
+
+void bench_perf_open(BenchPerf *perf);
+void bench_perf_start(BenchPerf *perf);
+void bench_perf_stop(BenchPerf *perf, BenchCounters *counters);
+void bench_perf_close(BenchPerf *perf);
+
+/*
+    Minimal JSON writer: one document per run,
+    {"benchmark": ..., "machine": {...}, "results": [ {record}, ... ]}
+*/
+typedef struct {
+    FILE *out;
+    int n_records;   // Records already written
+    int n_fields;    // Fields already written in the current record
+} BenchJson;
+
+void bench_json_open(BenchJson *json, FILE *out, const char *benchmark, const BenchPerf *perf);
+void bench_json_record_begin(BenchJson *json);
+void bench_json_string(BenchJson *json, const char *key, const char *value);
+void bench_json_number(BenchJson *json, const char *key, double value);
+void bench_json_integer(BenchJson *json, const char *key, long long value);
+/*
+    Timing and counter fields of a measured region over n_items items.
+    The fields are named per key; unit says what an item is ("key", or
+    "cell" for the merge).
+*/
+void bench_json_measure(BenchJson *json, const char *unit, double seconds, size_t n_items,
+                        const BenchCounters *counters);
+void bench_json_record_end(BenchJson *json);
+void bench_json_close(BenchJson *json);
+
+#endif
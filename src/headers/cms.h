@@ -6,30 +6,202 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #define IP_SIZE 4 // Each IPv4 address is 4 bytes
 
+#define CMS_MERSENNE_61 ((1ULL << 61) - 1) // Mersenne prime 2^61 - 1
+#define CMS_DEFAULT_SEED 0                 // Seed of the hash parameters unless one is given
+#define CMS_E 2.718281828459045            // Base of the width bound: width = e / epsilon
+
+/*
+    Pairwise independent hash families available for the rows of the sketch
+*/
+typedef enum {
+    CMS_HASH_MODPRIME,    // ((a*x + b) mod p) mod width, p = 2^32 - 5
+    CMS_HASH_MULTISHIFT,  // (a*x + b) >> (64 - log2(width)), width rounded up to a power of two
+    CMS_HASH_MERSENNE     // (a*x + b) mod 2^61 - 1, mapped to [0, width) with a multiply-shift
+} cms_hash_family;
+
+/*
+    Batch update kernels. AUTO picks the widest vector kernel supported
+    by the CPU for the chosen hash family, falling back to the scalar one.
+*/
+typedef enum {
+    CMS_KERNEL_AUTO,
+    CMS_KERNEL_SCALAR,
+    CMS_KERNEL_AVX2,
+    CMS_KERNEL_AVX512
+} cms_kernel;
+
+/*
+    Cache strategy of the batch update. AUTO compares the table size
+    with the detected L2 and last level cache sizes.
+*/
+typedef enum {
+    CMS_UPDATE_AUTO,
+    CMS_UPDATE_DIRECT,     // Hash and increment key by key
+    CMS_UPDATE_PREFETCH,   // Software prefetch of the cells of the next keys
+    CMS_UPDATE_PARTITION   // Radix-partition the cells in cache-sized buckets first
+} cms_update_mode;
+
+/*
+    Width of the counters. The 8 and 16-bit cells saturate: a full cell
+    only says "look in the overflow table", which holds the exact count.
+*/
+typedef enum {
+    CMS_COUNTER_32,   // uint32_t cells (default), wrap around
+    CMS_COUNTER_8,    // uint8_t saturating cells + overflow table
+    CMS_COUNTER_16,   // uint16_t saturating cells + overflow table
+    CMS_COUNTER_64    // uint64_t cells
+} cms_counter_width;
+
+/*
+    Creation-time configuration of a sketch
+*/
 typedef struct {
+    cms_hash_family hash_family;
+    cms_kernel kernel;
+    cms_update_mode update_mode;
+    int specialize;     // Use the fixed-depth kernels when available (default: 1)
+    cms_counter_width counters; // Cell width (default: CMS_COUNTER_32)
+    int conservative;   // Conservative update: only the minimal cells of a key are incremented
+    void *cells;        // Existing counter storage, e.g. a mapped sketch file (NULL = allocate a zeroed table)
+    uint64_t seed;      // Seed of the hash parameters (default: CMS_DEFAULT_SEED)
+    int key_width;      // Bytes of the input keys (default: IP_SIZE), wider keys are counted by their digest
+} CmsConfig;
+
+typedef struct CountMinSketch CountMinSketch;
+typedef struct CmsOverflow CmsOverflow;
+typedef void (*cms_batch_fn)(CountMinSketch *cms, const uint8_t *keys, size_t n_keys);
+typedef void (*cms_update_fn)(CountMinSketch *cms, uint32_t key);
+typedef uint64_t (*cms_query_fn)(const CountMinSketch *cms, uint32_t key);
+typedef void (*cms_cells_fn)(const CountMinSketch *cms, uint32_t key, size_t *cells);
+typedef void (*cms_batch_query_fn)(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint64_t *estimates);
+
+#define CMS_SPECIALIZED_MAX_DEPTH 8 // Depths with compile-time specialized kernels
+
+struct CountMinSketch {
     int width;       // columns
     int depth;       // rows
-    uint32_t *table;   // 2D array for counts
-    uint32_t *hash_a;   // Universal hash function parameters: we need two hash seeds
-    uint32_t *hash_b;
-    uint32_t prime;     // A large prime number for hashing
-} CountMinSketch;
+    uint32_t *table;   // 2D array for counts (32-bit counters only, NULL otherwise)
+    void *cells;       // Counter storage of any width (same memory as table for 32-bit counters)
+    int owns_cells;    // 0 if the cells come from CmsConfig.cells and are not freed with the sketch
+    cms_counter_width counters; // Width of the cells
+    size_t cell_size;  // Bytes per cell
+    int conservative;  // 1 with conservative update
+    CmsOverflow *overflow; // Exact counts of the saturated 8/16-bit cells
+    int overflow_failed;   // 1 once a saturated cell could not be stored in the overflow table (cms_status)
+    uint64_t *hash_a;   // Universal hash function parameters: we need two hash seeds
+    uint64_t *hash_b;
+    uint64_t seed;      // Seed hash_a and hash_b were drawn from (cms_seed_hashes)
+    int key_width;      // Bytes of the input keys (see keys.h), only recorded with the sketch
+    uint32_t prime;     // A large prime number for hashing (CMS_HASH_MODPRIME)
+    cms_hash_family hash_family; // Hash family used by every row
+    int hash_shift;     // 64 - log2(width), used by the multiply-shift reductions
+    cms_kernel kernel;  // Batch update kernel in use (never CMS_KERNEL_AUTO)
+    cms_batch_fn batch_update; // Function implementing the kernel
+    cms_batch_query_fn batch_query; // Batch query kernel matching the update kernel
+    int specialized;    // 1 if the kernels below are the fixed-depth ones
+    cms_update_fn update_one;   // Single key update
+    cms_query_fn query_one;     // Single key query
+    cms_cells_fn cells_one;     // Cell index of a key in every row (row * width + column)
+    cms_batch_fn scalar_batch;  // Batch kernel used when CMS_KERNEL_SCALAR is selected
+    cms_update_mode update_mode; // Cache strategy in use (never CMS_UPDATE_AUTO)
+    uint32_t *scratch;  // Cell indices buffer of the prefetch/partition paths
+    int bucket_shift;   // Cell index >> bucket_shift = bucket (partition path)
+    int n_buckets;
+};
 
 // Functions to create and free Count-Min Sketch
+void cms_config_default(CmsConfig *config);
 CountMinSketch *cms_create(int width, int depth);
 CountMinSketch *cms_create_from_error(double eps, double delta);
+CountMinSketch *cms_create_ex(int width, int depth, const CmsConfig *config);
+CountMinSketch *cms_create_from_error_ex(double eps, double delta, const CmsConfig *config);
+int cms_dimensions_from_error(double eps, double delta, int *width, int *depth);
+double cms_error_rate(const CountMinSketch *cms);
 void cms_free(CountMinSketch *cms);
 
+// Hash parameters drawn from a seed with splitmix64
+void cms_seed_hashes(CountMinSketch *cms, uint64_t seed);
+uint64_t cms_random_seed(void);
+
+// Parse/print helpers for the counter width
+int cms_counter_width_parse(const char *name, cms_counter_width *counters);
+const char *cms_counter_width_name(cms_counter_width counters);
+size_t cms_counter_cell_size(cms_counter_width counters);
+
+// Width-independent access to the cells
+uint64_t cms_cell_value(const CountMinSketch *cms, size_t cell);
+size_t cms_table_bytes(const CountMinSketch *cms);
+void cms_clear(CountMinSketch *cms);
+int cms_status(const CountMinSketch *cms);
+void cms_cells_add(cms_counter_width counters, void *dst, const void *src, size_t lo, size_t hi);
+
+// Parse/print helpers for the hash family
+int cms_hash_family_parse(const char *name, cms_hash_family *family);
+const char *cms_hash_family_name(cms_hash_family family);
+
+// Parse/print helpers and runtime selection of the batch update kernel
+int cms_kernel_parse(const char *name, cms_kernel *kernel);
+const char *cms_kernel_name(cms_kernel kernel);
+int cms_select_kernel(CountMinSketch *cms, cms_kernel kernel);
+
+// Parse/print helpers and selection of the cache strategy of the batch update
+int cms_update_mode_parse(const char *name, cms_update_mode *mode);
+const char *cms_update_mode_name(cms_update_mode mode);
+int cms_select_update_mode(CountMinSketch *cms, cms_update_mode mode);
+size_t cms_cache_size(int level);
+
+/*
+    splitmix64 generator: advances state and returns the next 64-bit value.
+    Fully defined by the seed, so every rank, machine and build draws the
+    same sequence (unlike rand()).
+*/
+static inline uint64_t cms_splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+    Hash x with the function of the given row. Returns a column in [0, width - 1].
+    None of the families needs a division except CMS_HASH_MODPRIME,
+    which is kept as the reference for accuracy/speed comparisons.
+*/
+static inline uint32_t cms_hash(const CountMinSketch *cms, uint32_t x, int row) {
+    switch (cms->hash_family) {
+        case CMS_HASH_MULTISHIFT:
+            return (uint32_t)((cms->hash_a[row] * x + cms->hash_b[row]) >> cms->hash_shift);
+        case CMS_HASH_MERSENNE: {
+            unsigned __int128 v = (unsigned __int128)cms->hash_a[row] * x + cms->hash_b[row];
+            uint64_t h = (uint64_t)(v & CMS_MERSENNE_61) + (uint64_t)(v >> 61);
+            h = (h & CMS_MERSENNE_61) + (h >> 61);
+            if (h >= CMS_MERSENNE_61)
+                h -= CMS_MERSENNE_61;
+            return (uint32_t)(((unsigned __int128)h * (uint32_t)cms->width) >> 61);
+        }
+        case CMS_HASH_MODPRIME:
+        default:
+            return (uint32_t)(((cms->hash_a[row] * x + cms->hash_b[row]) % cms->prime) % cms->width);
+    }
+}
+
 // Update and query functions
 void cms_update(CountMinSketch *cms, uint32_t key);
 void cms_batch_update(CountMinSketch *cms, const uint8_t *keys, size_t n_keys);
-uint32_t cms_query(const CountMinSketch *cms, uint32_t key);
+uint64_t cms_query(const CountMinSketch *cms, uint32_t key);
+void cms_batch_query(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint64_t *estimates);
+
+// Batch updates on a table shared by several threads
+void cms_batch_update_atomic(CountMinSketch *cms, const uint8_t *keys, size_t n_keys);
+void cms_batch_update_range(CountMinSketch *cms, const uint8_t *keys, size_t n_keys,
+                            size_t cell_lo, size_t cell_hi);
 
-// Merge two Count-Min Sketches (src into dest)
+// Merge two Count-Min Sketches (src into dest); both must share size, family, counters and seed
 void cms_merge_into(CountMinSketch *dest, const CountMinSketch *src);
 
 // Debug function to print the Count-Min Sketch table occurrences
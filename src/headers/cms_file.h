@@ -0,0 +1,76 @@
+#ifndef CMS_FILE_H
+#define CMS_FILE_H
+
+#include "cms.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <mpi.h>
+
+/*
+    On-disk sketch format (host byte order):
+
+        offset 0             CmsFileHeader
+        seeds_offset         hash_a[depth], then hash_b[depth] (uint64)
+        table_offset         depth * width cells of the counter width, row-major,
+                             aligned on CMS_FILE_ALIGN bytes
+        overflow_offset      overflow_count (cell, exact count) uint64 pairs,
+                             the saturated cells of 8/16-bit tables
+
+    The table is stored exactly as in memory, so a mapped file is queried
+    in place by a sketch whose cells point into the mapping.
+*/
+
+#define CMS_FILE_MAGIC "CMSKETCH"
+#define CMS_FILE_VERSION 2               // 2: hash seed in the header
+#define CMS_FILE_BYTE_ORDER 0x01020304U  // Reads back differently on a host of the other endianness
+#define CMS_FILE_ALIGN 4096              // Alignment of the table (page size)
+
+typedef struct {
+    char magic[8];            // CMS_FILE_MAGIC, not NUL terminated
+    uint32_t version;         // CMS_FILE_VERSION
+    uint32_t byte_order;      // CMS_FILE_BYTE_ORDER
+    uint32_t width;
+    uint32_t depth;
+    uint32_t hash_family;     // cms_hash_family
+    uint32_t counters;        // cms_counter_width
+    uint32_t conservative;    // 1 if the counts come from the conservative update
+    uint32_t key_width;       // Bytes of the input keys (0 in older files: IP_SIZE)
+    uint64_t total_keys;      // Keys added to the sketch
+    uint64_t seed;            // Seed the hash parameters were drawn from
+    uint64_t seeds_offset;
+    uint64_t table_offset;
+    uint64_t table_bytes;
+    uint64_t overflow_offset;
+    uint64_t overflow_count;
+} CmsFileHeader;
+
+/*
+    Sketch file mapped in memory. cms is a regular sketch whose table is
+    the mapping itself (private copy-on-write pages), ready for queries
+    and merges without reading the table first.
+*/
+typedef struct {
+    void *base;                   // Start of the mapping
+    size_t bytes;                 // Mapped bytes (the whole file)
+    const CmsFileHeader *header;  // Header, at the start of the mapping
+    CountMinSketch *cms;
+} CmsMappedFile;
+
+// Write cms and the number of keys it holds to path (through a temporary file renamed at the end)
+int cms_file_write(const CountMinSketch *cms, uint64_t total_keys, const char *path);
+// Collective write of the global sketch of a reduction, each rank writing a slice of the table
+int cms_file_write_all(const CountMinSketch *cms, uint64_t total_keys, const char *path,
+                       int replicated, int root, MPI_Info info, MPI_Comm comm);
+
+// Map a sketch file, optionally overriding the kernel choices with config (may be NULL)
+int cms_file_map(const char *path, const CmsConfig *config, CmsMappedFile *file);
+void cms_file_unmap(CmsMappedFile *file);
+// Empty sketch with the dimensions, hash functions and counters of a mapped file
+CountMinSketch *cms_file_create_like(const CmsMappedFile *file, const CmsConfig *config);
+// 1 if the two sketches can be merged (same dimensions, hash functions, counters and keys)
+int cms_file_compatible(const CmsMappedFile *a, const CmsMappedFile *b);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef CMS_HIERARCHY_H
+#define CMS_HIERARCHY_H
+
+#include "cms.h"
+#include "reduce.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+/*
+    Hierarchical (prefix) Count-Min Sketch over IPv4 keys: besides the
+    base sketch, which counts the whole keys (/32), one level per prefix
+    length counts the keys truncated to that prefix, e.g. /8, /16 and /24,
+    or every length for a full dyadic decomposition. A prefix or range
+    query then adds up a few aligned prefix blocks instead of one point
+    query per address, and the heavy prefixes can be found by descending
+    the levels.
+    A level whose prefixes fit in no more memory than its sketch (short
+    prefixes) keeps one exact counter per prefix; the other levels are
+    sketches sized by the epsilon budget of the hierarchy.
+*/
+
+#define CMS_HIER_MAX_LEVELS 31  // Prefix lengths 1 to 31, /32 is the base sketch
+#define CMS_HIER_BLOCK 8192     // Keys converted once and shared by all the levels
+#define CMS_HIER_RANGE_TEXT 40  // Longest range of a list ("a.b.c.d-e.f.g.h")
+
+/*
+    Prefix lengths of the levels, without the base sketch (strictly
+    increasing, in [1, 31])
+*/
+typedef struct {
+    int n_levels;
+    int prefix_bits[CMS_HIER_MAX_LEVELS];
+    double epsilon;             // Error of a prefix query on a sketched level, relative to the keys counted
+} CmsHierConfig;
+
+typedef struct {
+    int prefix_bits;            // Length of the prefixes counted by the level
+    uint64_t *exact;            // One counter per prefix (NULL for a sketched level)
+    CountMinSketch *cms;        // Sketch of the prefixes (NULL for an exact level)
+} CmsHierLevel;
+
+typedef struct {
+    CountMinSketch *base;       // Sketch of the whole keys, owned by the caller
+    int n_levels;
+    CmsHierLevel levels[CMS_HIER_MAX_LEVELS]; // Coarsest first
+    uint64_t *exact_cells;      // Counters of all the exact levels, contiguous so they are reduced at once
+    size_t n_exact_cells;
+    uint32_t *block;            // Host order keys of the block being updated
+    uint8_t *prefix_keys;       // Prefixes of the block, in the key format of the sketches
+} HierarchicalSketch;
+
+/*
+    Estimate of a range query
+*/
+typedef struct {
+    uint64_t count;             // Sum of the estimates of the prefix blocks
+    long long n_blocks;         // Aligned prefix blocks the range was split into
+    double error_rate;          // The estimate exceeds the count by at most error_rate * keys (w.h.p.)
+} CmsHierEstimate;
+
+/*
+    Hierarchical heavy hitter: a prefix whose count, once the counts of
+    the heavy hitters below it are taken out, is above the threshold
+*/
+typedef struct {
+    uint32_t prefix;            // First address of the prefix
+    int prefix_bits;
+    uint64_t estimate;          // Estimated count of the whole prefix
+    uint64_t residual;          // ... without the heavy hitters it contains
+} CmsHierHitter;
+
+// Parse helpers: levels ("8,16,24", "dyadic", "dyadic:BITS") and ranges ("a.b.c.d/len", "a.b.c.d-e.f.g.h")
+int cms_hier_levels_parse(const char *spec, CmsHierConfig *config);
+int cms_hier_range_parse(const char *spec, uint32_t *lo, uint32_t *hi);
+int cms_hier_ranges_next(const char **list, char *spec, uint32_t *lo, uint32_t *hi);
+
+HierarchicalSketch *cms_hier_create(CountMinSketch *base, const CmsHierConfig *hconfig, double delta,
+                                    const CmsConfig *config);
+void cms_hier_batch_update(HierarchicalSketch *hs, const uint8_t *keys, size_t n_keys);
+int cms_hier_reduce(HierarchicalSketch *hs, cms_reduce_mode mode, int root, MPI_Comm comm, CmsReduceTiming *timing);
+
+// Queries
+CmsHierEstimate cms_hier_range_query(const HierarchicalSketch *hs, uint32_t lo, uint32_t hi);
+int cms_hier_heavy_hitters(const HierarchicalSketch *hs, uint64_t threshold, CmsHierHitter **hitters);
+
+size_t cms_hier_bytes(const HierarchicalSketch *hs);
+void cms_hier_free(HierarchicalSketch *hs);
+
+#endif
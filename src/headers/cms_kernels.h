@@ -0,0 +1,56 @@
+#ifndef CMS_KERNELS_H
+#define CMS_KERNELS_H
+
+#include "cms.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    Batch update kernels selected at creation time by cms_select_kernel.
+    The vectorized kernels only implement CMS_HASH_MULTISHIFT, the other
+    hash families always run on the scalar kernel.
+*/
+void cms_batch_update_scalar(CountMinSketch *cms, const uint8_t *keys, size_t n_keys);
+void cms_batch_update_avx2(CountMinSketch *cms, const uint8_t *keys, size_t n_keys);
+void cms_batch_update_avx512(CountMinSketch *cms, const uint8_t *keys, size_t n_keys);
+
+/*
+    Batch query kernels: estimates[i] = minimum over the rows of the
+    counters of key i, for keys in the input format
+*/
+void cms_batch_query_scalar(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint64_t *estimates);
+void cms_batch_query_avx2(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint64_t *estimates);
+void cms_batch_query_avx512(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys, uint64_t *estimates);
+
+/*
+    Cache-aware paths used when the table does not fit in L2
+    (selected by cms_select_update_mode, they hash with the scalar cms_hash)
+*/
+void cms_batch_update_prefetch(CountMinSketch *cms, const uint8_t *keys, size_t n_keys);
+void cms_batch_update_partition(CountMinSketch *cms, const uint8_t *keys, size_t n_keys);
+
+// Generic kernels, for any depth and width
+void cms_update_generic(CountMinSketch *cms, uint32_t key);
+uint64_t cms_query_generic(const CountMinSketch *cms, uint32_t key);
+void cms_cells_generic(const CountMinSketch *cms, uint32_t key, size_t *cells);
+
+// Fixed-depth kernels chosen from the dimensions of the sketch
+int cms_select_specialized(CountMinSketch *cms);
+
+// Kernels of the 8/16/64-bit counters and of the conservative update
+int cms_select_counter_kernels(CountMinSketch *cms);
+void cms_merge_cells(CountMinSketch *dest, const CountMinSketch *src);
+
+// Overflow table of the saturating counters: cell index -> exact count
+CmsOverflow *cms_overflow_create(void);
+void cms_overflow_free(CmsOverflow *overflow);
+void cms_overflow_clear(CmsOverflow *overflow);
+uint64_t cms_overflow_get(const CmsOverflow *overflow, size_t cell);
+int cms_overflow_set(CmsOverflow *overflow, size_t cell, uint64_t count);
+int cms_cell_saturated(const CountMinSketch *cms, size_t cell);
+
+// Returns 1 if the CPU running the program can execute the given kernel
+int cms_kernel_supported(cms_kernel kernel);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef CMS_MEMORY_H
+#define CMS_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Allocator of the large blocks of the program: sketch tables and I/O
+    buffers. Blocks are mapped directly (page aligned, hence cache-line
+    aligned) and backed by 2 MB pages when possible. Tables are touched
+    right away by the threads that will update them, so that their pages
+    are placed on the NUMA node of those threads and no page fault is left
+    for the update loop. Freed blocks are kept in a small pool and
+    handed out again to the next allocation of the same size, so that the
+    sketches created and freed over and over (window epochs, reductions,
+    tuning runs) do not go back to the kernel.
+    The allocator is not thread-safe: allocate and free from one thread.
+*/
+
+#define CMS_MEM_HUGE_PAGE  (2UL * 1024 * 1024)
+#define CMS_MEM_POOL_SLOTS 16  // Freed blocks kept for reuse
+
+/*
+    Page size backing the blocks of at least CMS_MEM_HUGE_PAGE bytes
+    (smaller blocks always use the base pages)
+*/
+typedef enum {
+    CMS_PAGES_AUTO,     // Transparent huge pages where the kernel allows them (madvise)
+    CMS_PAGES_SMALL,    // Base pages only
+    CMS_PAGES_HUGETLB,  // Reserved huge pages (MAP_HUGETLB), transparent ones if none is free
+} cms_page_mode;
+
+/*
+    What a block holds, which decides the threads that touch it first
+*/
+typedef enum {
+    CMS_MEM_TABLE,   // Sketch table: zeroed by the update threads (see cms_mem_set_threads)
+    CMS_MEM_BUFFER   // I/O buffer: not cleared, first touched by the thread that fills it
+} cms_mem_kind;
+
+typedef struct {
+    unsigned long long allocations;  // Blocks handed out
+    unsigned long long pool_hits;    // ... of which taken from the pool
+    unsigned long long hugetlb_bytes;  // Bytes mapped with MAP_HUGETLB
+    unsigned long long thp_bytes;      // Bytes advised for transparent huge pages
+    size_t pooled_bytes;             // Bytes currently held by the pool
+} CmsMemStats;
+
+// Parse/print helpers for the page mode
+int cms_page_mode_parse(const char *name, cms_page_mode *mode);
+const char *cms_page_mode_name(cms_page_mode mode);
+
+void cms_mem_set_pages(cms_page_mode mode);
+void cms_mem_set_threads(int n_threads);
+void *cms_mem_alloc(size_t bytes, cms_mem_kind kind);
+void cms_mem_free(void *ptr, size_t bytes);
+void cms_mem_pool_release(void);
+void cms_mem_stats(CmsMemStats *stats);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef CMS_WINDOW_H
+#define CMS_WINDOW_H
+
+#include "cms.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Sliding-window Count-Min Sketch: a ring of n_epochs sub-sketches
+    sharing the same hash functions. Updates go to the current epoch
+    only; the aggregate holds the sum of the other epochs and is kept up
+    to date incrementally when the window rotates, so the whole window
+    is queried with two tables and an epoch expires in O(table).
+*/
+typedef struct {
+    int n_epochs;                 // Epochs in the window (K)
+    int current;                  // Epoch receiving the updates
+    long long rotations;          // Epochs closed since the creation
+    CountMinSketch **epochs;      // Ring of n_epochs sub-sketches
+    CountMinSketch *aggregate;    // Sum of every epoch but the current one
+    unsigned long long *epoch_keys; // Keys counted in each epoch
+} WindowedSketch;
+
+WindowedSketch *cms_window_create(int width, int depth, int n_epochs, const CmsConfig *config);
+WindowedSketch *cms_window_create_from_error(double eps, double delta, int n_epochs, const CmsConfig *config);
+
+// Updates of the current epoch
+void cms_window_update(WindowedSketch *ws, uint32_t key);
+void cms_window_batch_update(WindowedSketch *ws, const uint8_t *keys, size_t n_keys);
+void cms_window_merge(WindowedSketch *ws, const CountMinSketch *delta, unsigned long long n_keys);
+
+// Close the current epoch and expire the oldest one
+void cms_window_rotate(WindowedSketch *ws);
+
+// Queries over the last n epochs (the current one included)
+uint64_t cms_window_query(const WindowedSketch *ws, uint32_t key, int last_n);
+unsigned long long cms_window_keys(const WindowedSketch *ws, int last_n);
+int cms_window_snapshot(const WindowedSketch *ws, int last_n, CountMinSketch *out);
+
+void cms_window_free(WindowedSketch *ws);
+
+#endif
@@ -5,14 +5,74 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
-#include <sys/file.h>
+
+#include "schedule.h"
+#include "cms_memory.h"
 
 #define IP_SIZE 4 // Each IPv4 address is 4 bytes
 #define BUFFER_SIZE 67108864 // 64 MB buffer size
 #define BUFFER_IP_COUNT (BUFFER_SIZE / IP_SIZE)
+#define MAX_IO_HINTS 16      // MPI_Info hints accepted on the command line
+
+/*
+    MPI-IO hint passed to MPI_File_open/MPI_File_set_view
+    (e.g. cb_buffer_size, cb_nodes, romio_cb_read, striping_factor)
+*/
+typedef struct {
+    char key[64];
+    char value[64];
+} IoHint;
+
+/*
+    How the input file is read
+*/
+typedef struct {
+    int n_buffers;            // Read buffers (1 = blocking reads)
+    MPI_Offset chunk_size;    // Bytes per buffer, a multiple of IP_SIZE (default BUFFER_SIZE)
+    int collective;           // Use a file view and MPI_File_iread_at_all
+    MPI_Info info;            // Hints for the file view (MPI_INFO_NULL for none)
+    ChunkScheduler *scheduler; // Dynamic schedule: chunks are claimed from it (NULL = static range)
+    int record_size;          // Bytes per record of the file (IP_SIZE, see keys.h for the other formats)
+    MPI_Offset data_offset;   // Bytes before the first record (key header of the file)
+} ReadConfig;
+
+/*
+    Pipelined reader: n_buffers buffers of chunk_size bytes, the following
+    chunks of the rank range are fetched with MPI_File_iread_at (or its
+    collective variant) while the current one is being processed
+*/
+typedef struct {
+    MPI_File fh;
+    int n_buffers;
+    int collective;
+    ChunkScheduler *scheduler;  // Dynamic schedule (NULL = read the range)
+    MPI_Offset chunk_addresses; // Addresses per chunk
+    int record_size;          // Bytes per address (record)
+    MPI_Offset data_offset;   // Bytes before the first record
+    uint8_t **buffers;        // n_buffers buffers of chunk_size bytes
+    MPI_Request *requests;    // Pending read of each buffer
+    MPI_Offset *counts;       // Addresses requested in each buffer
+    double *issue_times;      // When the read of each buffer was issued
+    double *done_times;       // When the read was first seen complete (0 = pending)
+    MPI_Offset start_index;   // First address of the range
+    MPI_Offset n_addresses;   // Addresses in the range
+    MPI_Offset issued;        // Addresses already requested
+    long next_chunk;          // Chunk returned by the next read_pipeline_next
+    long n_chunks;            // Chunks to read (same on all the ranks in collective mode, unknown in dynamic mode)
+    double exposed_time;      // Time blocked issuing/waiting for reads
+    double hidden_time;       // Time reads were in flight while the caller computed (until seen complete)
+} ReadPipeline;
 
 int read_buffer(MPI_File fh, uint8_t *buffer, MPI_Offset start_index, MPI_Offset count);
-int write_execution_info(const char *filename, int n_process, MPI_Offset n_elements, double time_seconds, double io_time, double compute_time);
+void read_config_default(ReadConfig *config);
+MPI_Offset read_config_chunk_records(const ReadConfig *config);
+int io_info_create(const IoHint *hints, int n_hints, MPI_Info *info);
+int read_pipeline_init(ReadPipeline *pipe, MPI_File fh, MPI_Comm comm, const ReadConfig *config,
+                       MPI_Offset start_index, MPI_Offset n_addresses);
+int read_pipeline_next(ReadPipeline *pipe, uint8_t **data, MPI_Offset *count);
+double read_pipeline_overlap(const ReadPipeline *pipe);
+void read_pipeline_free(ReadPipeline *pipe);
 
 #endif
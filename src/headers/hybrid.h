@@ -0,0 +1,32 @@
+#ifndef HYBRID_H
+#define HYBRID_H
+
+#include "cms.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <omp.h>
+
+/*
+    How the worker threads of a rank share its single Count-Min Sketch
+*/
+typedef enum {
+    CMS_THREADS_ATOMIC,   // Threads split the buffer and use relaxed atomic increments
+    CMS_THREADS_STRIPED   // Threads own a slice of the table and walk the whole buffer
+} cms_thread_strategy;
+
+// Parse/print helpers for the threading strategy
+int cms_thread_strategy_parse(const char *name, cms_thread_strategy *strategy);
+const char *cms_thread_strategy_name(cms_thread_strategy strategy);
+
+// Update the sketch with n_threads OpenMP threads feeding the same table
+void cms_threaded_batch_update(CountMinSketch *cms, const uint8_t *keys, size_t n_keys,
+                               int n_threads, cms_thread_strategy strategy);
+
+// Batch query with n_threads OpenMP threads (read-only on the table)
+void cms_threaded_batch_query(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys,
+                              uint64_t *estimates, int n_threads);
+
+#endif
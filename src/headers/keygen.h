@@ -0,0 +1,53 @@
+#ifndef KEYGEN_H
+#define KEYGEN_H
+
+#include "cms.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Distributions of the synthetic keys
+*/
+typedef enum {
+    KEYGEN_UNIFORM,   // Uniform over the 2^32 addresses
+    KEYGEN_ZIPF,      // Zipf(s) over n_distinct addresses: rank r drawn with probability ~ 1 / r^s
+    KEYGEN_HOTSET     // hot_share of the keys uniform over n_distinct hot addresses, the others uniform
+} keygen_distribution;
+
+#define KEYGEN_HOT_SHARE 0.9  // Default share of the keys drawn from the hot set
+
+/*
+    Deterministic key generator. The Zipf ranks are drawn by inverting a
+    precomputed CDF, then mapped to addresses by a 32-bit bijection, so
+    distinct ranks give distinct, well scattered addresses (the hot
+    addresses are ranks too). Key i of the stream only depends on the seed
+    and on i (keygen_key_at), so a stream can be generated in pieces.
+*/
+typedef struct {
+    keygen_distribution distribution;
+    uint64_t state;       // splitmix64 state
+    uint64_t origin;      // State before the first key of the stream
+    uint32_t n_distinct;  // KEYGEN_ZIPF: number of distinct addresses
+    double skew;          // KEYGEN_ZIPF: exponent s
+    double *cdf;          // KEYGEN_ZIPF: cdf[r] = P(rank <= r), n_distinct entries
+    uint32_t salt;        // Mixed into the rank -> address bijection
+    double hot_share;     // KEYGEN_HOTSET: share of the hot keys (KEYGEN_HOT_SHARE, may be set after keygen_init)
+} KeyGenerator;
+
+// Parse/print helpers for the distribution
+int keygen_distribution_parse(const char *name, keygen_distribution *distribution);
+const char *keygen_distribution_name(keygen_distribution distribution);
+
+int keygen_init(KeyGenerator *gen, keygen_distribution distribution, uint32_t n_distinct, double skew, uint64_t seed);
+void keygen_free(KeyGenerator *gen);
+uint32_t keygen_next(KeyGenerator *gen);
+uint32_t keygen_key_at(const KeyGenerator *gen, uint64_t index);
+uint32_t keygen_key_of_rank(const KeyGenerator *gen, uint32_t rank);
+uint32_t keygen_rank_of_key(const KeyGenerator *gen, uint32_t key);
+// n_keys addresses in the input file format (IP_SIZE bytes, network byte order)
+void keygen_fill(KeyGenerator *gen, uint8_t *keys, size_t n_keys);
+
+#endif
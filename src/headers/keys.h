@@ -0,0 +1,84 @@
+#ifndef KEYS_H
+#define KEYS_H
+
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Key formats of the input and query files.
+
+    The sketch kernels work on 4-byte keys (IP_SIZE, network byte order).
+    An input in another format is turned into such keys chunk by chunk,
+    right before the update:
+        - keys of at most 4 bytes are copied (zero-extended), so the sketch
+          counts the keys themselves;
+        - wider keys (IPv6 addresses, generic fields) are replaced by a
+          seeded 32-bit digest, computed with 32x32->64 multiplies in the
+          style of xxHash/wyhash. Two distinct keys share a digest with
+          probability 2^-32, which adds at most N / 2^32 to an estimate on
+          average, far below the epsilon * N of the sketch.
+
+    A file may start with a KeyFileHeader describing its records; without
+    one, the format comes from the command line (IPv4 by default).
+*/
+
+#define KEY_FILE_MAGIC "CMSKEYS1"
+#define KEY_FILE_VERSION 1
+#define KEY_MAX_RECORD 4096       // Largest record accepted
+#define KEY_MAX_WIDTH 256         // Widest key accepted
+#define KEY_DIGEST_SECRETS 8      // 64-bit digest parameters, used in turn by the 8-byte words of a key
+
+typedef enum {
+    KEY_IPV4,    // 4-byte records, the whole record is the key (the original format)
+    KEY_IPV6,    // 16-byte records, the whole record is the key
+    KEY_RECORD   // Fixed-size records, key_width bytes at key_offset
+} key_format_kind;
+
+/*
+    Optional header of an input file (host byte order), followed by the records
+*/
+typedef struct {
+    char magic[8];            // KEY_FILE_MAGIC, not NUL terminated
+    uint32_t version;         // KEY_FILE_VERSION
+    uint32_t header_bytes;    // Bytes before the first record (at least sizeof(KeyFileHeader))
+    uint32_t kind;            // key_format_kind
+    uint32_t record_size;
+    uint32_t key_offset;
+    uint32_t key_width;
+} KeyFileHeader;
+
+typedef struct {
+    key_format_kind kind;
+    int record_size;          // Bytes per record
+    int key_offset;           // First byte of the key in the record
+    int key_width;            // Bytes of the key
+    uint64_t secrets[KEY_DIGEST_SECRETS]; // Digest parameters, drawn from the sketch seed (key_format_seed)
+    uint64_t digest_init;     // Initial digest state, depends on the key width
+} KeyFormat;
+
+// Parse/print helpers for the key format ("ipv4", "ipv6", "record:SIZE[:OFFSET:WIDTH]")
+void key_format_default(KeyFormat *fmt);
+int key_format_parse(const char *spec, KeyFormat *fmt);
+const char *key_format_kind_name(key_format_kind kind);
+void key_format_describe(const KeyFormat *fmt, char *text, size_t size);
+
+int key_format_probe(const char *path, int from_cli, KeyFormat *fmt, MPI_Offset *data_offset);
+void key_format_seed(KeyFormat *fmt, uint64_t seed);
+int key_format_write_header(FILE *out, const KeyFormat *fmt);
+
+/*
+    1 if the records are already the 4-byte keys of the kernels
+*/
+static inline int key_format_native(const KeyFormat *fmt) {
+    return fmt->record_size == 4 && fmt->key_offset == 0 && fmt->key_width == 4;
+}
+
+uint32_t key_digest(const KeyFormat *fmt, const uint8_t *key);
+void key_extract(const KeyFormat *fmt, const uint8_t *records, size_t n_records, uint8_t *keys);
+void key_extract_threaded(const KeyFormat *fmt, const uint8_t *records, size_t n_records, uint8_t *keys,
+                          int n_threads);
+
+#endif
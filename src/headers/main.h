@@ -2,7 +2,17 @@
 #define MAIN_H
 
 #include "file_io.h"
+#include "reader.h"
 #include "cms.h"
+#include "reduce.h"
+#include "options.h"
+#include "hybrid.h"
+#include "stream.h"
+#include "cms_window.h"
+#include "topk.h"
+#include "query.h"
+#include "cms_file.h"
+#include "profile.h"
 #include "headers/util.h"
 
 #include <stdio.h>
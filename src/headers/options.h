@@ -0,0 +1,58 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "reduce.h"
+#include "file_io.h"
+#include "reader.h"
+#include "hybrid.h"
+#include "stream.h"
+#include "keys.h"
+#include "cms_hierarchy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+    Run configuration parsed from the command line.
+    The four positional arguments are mandatory, the others are
+    optional "--name=value" switches that follow them.
+*/
+typedef struct {
+    const char *input_file;       // Binary file with the IP addresses
+    KeyFormat key_format;         // Records of the input file (--key or the key header of the file)
+    int key_from_cli;             // 1 if key_format was given with --key
+    const char *output_file;      // CSV file where the execution record is appended
+    const char *profile_file;     // JSON execution record with the per-rank measures (NULL = none)
+    double epsilon;               // Error rate of the sketch
+    double delta;                 // Confidence of the sketch
+    cms_reduce_mode reduce_mode;  // How the per-rank sketches are combined
+    int n_threads;                // Worker threads per rank (0 = pure MPI mode)
+    cms_thread_strategy thread_strategy; // How the threads share the rank sketch
+    reader_backend reader;        // Input backend (MPI-IO, mmap, pread)
+    schedule_mode schedule;       // Static rank ranges or chunks claimed dynamically
+    ReadConfig read_config;       // Buffers, chunk size and independent/collective reads
+    IoHint io_hints[MAX_IO_HINTS]; // MPI-IO hints for MPI_File_open and the file view
+    int n_io_hints;
+    CmsConfig cms_config;         // Creation-time settings of the sketch (hash, kernel, cache strategy)
+    cms_page_mode pages;          // Pages backing the tables and read buffers
+    int random_seed;              // Hash seed drawn at run time by rank 0 (--seed=random)
+    const char *query_file;       // Keys to estimate once the sketch is built (NULL = none)
+    const char *query_output;     // Estimates of the query keys, one uint32 per key
+    int topk;                     // Heavy hitters reported at the end (0 = none)
+    CmsHierConfig hierarchy;      // Prefix levels counted with the sketch (n_levels = 0: none)
+    const char *ranges;           // Comma-separated prefixes/ranges estimated at the end (NULL = none)
+    double hhh_phi;               // Hierarchical heavy hitters above this fraction of the keys (0 = none)
+    const char *checkpoint_file;  // Where the global sketch is saved at the end (NULL = not saved)
+    const char *restore_file;     // Saved sketch the run starts from (NULL = empty sketch)
+    int stream;                   // Streaming mode: the input is stdin, a FIFO or a UNIX socket
+    StreamConfig stream_config;   // Batches, queue depth and merge interval of the streaming mode
+    int window_epochs;            // Streaming mode: sliding window of N merge intervals (0 = whole stream)
+    int window_query;             // Streaming mode: epochs covered by the --query estimates (0 = the whole window)
+} RunOptions;
+
+int parse_options(int argc, char **argv, RunOptions *opts);
+void print_usage(const char *prog);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+/*
+    Version of the execution record (CSV columns and JSON fields).
+    Bump it whenever a column is added, removed or changes meaning.
+*/
+#define PROFILE_SCHEMA_VERSION 2
+
+/*
+    Quantities measured on every rank: the time of each phase of the run,
+    then the totals. The phases are not nested, their sum is at most the
+    total time.
+*/
+typedef enum {
+    PROFILE_OPEN,        // MPI_File_open and reader setup
+    PROFILE_READ,        // Exposed read time (not hidden behind the update)
+    PROFILE_UPDATE,      // Hashing and sketch update
+    PROFILE_IDLE,        // Waiting for the slowest rank before the reduction
+    PROFILE_REDUCE,      // Sketch reduction (and top-k merge)
+    PROFILE_QUERY,       // Bulk queries, including the broadcast of the sketch
+    PROFILE_WRITE,       // Checkpoint of the global sketch
+    PROFILE_TOTAL,       // Wall time of the rank
+    PROFILE_BYTES_READ,  // Input bytes read by the rank
+    PROFILE_KEYS,        // Keys added to the rank sketch
+    PROFILE_N_METRICS
+} profile_metric;
+
+#define PROFILE_N_PHASES PROFILE_TOTAL
+
+/*
+    Measures of one rank
+*/
+typedef struct {
+    double values[PROFILE_N_METRICS];
+    double started[PROFILE_N_PHASES];  // Start of the phase being timed
+} RankProfile;
+
+typedef struct {
+    double min, avg, max, stddev;
+} ProfileStat;
+
+/*
+    Measures of all the ranks, only filled on the root of profile_gather
+*/
+typedef struct {
+    int n_ranks;
+    ProfileStat stats[PROFILE_N_METRICS];
+    double *per_rank;  // n_ranks x PROFILE_N_METRICS, row-major
+} ProfileSummary;
+
+/*
+    Description of the run stored with the measures
+*/
+typedef struct {
+    const char *mode;          // "mpi", "hybrid" or "stream"
+    int n_processes;
+    int n_threads;             // Threads per rank (0 = pure MPI)
+    long long dataset_size;    // Keys in the input
+} ProfileRun;
+
+const char *profile_metric_name(profile_metric metric);
+
+void profile_init(RankProfile *profile);
+void profile_begin(RankProfile *profile, profile_metric phase);
+void profile_end(RankProfile *profile, profile_metric phase);
+void profile_add(RankProfile *profile, profile_metric metric, double value);
+
+int profile_gather(const RankProfile *profile, int root, MPI_Comm comm, ProfileSummary *summary);
+void profile_summary_free(ProfileSummary *summary);
+void profile_print(const ProfileSummary *summary, FILE *out);
+int profile_write_csv(const char *filename, const ProfileRun *run, const ProfileSummary *summary);
+int profile_write_json(const char *filename, const ProfileRun *run, const ProfileSummary *summary);
+
+#endif
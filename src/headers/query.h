@@ -0,0 +1,29 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "cms.h"
+#include "file_io.h"
+#include "keys.h"
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+    Counters of a bulk query run (local to the rank)
+*/
+typedef struct {
+    MPI_Offset n_queries;     // Queries answered by this rank
+    MPI_Offset total_queries; // Queries in the file
+    double read_time;         // Exposed time reading the query file
+    double query_time;        // Time in the batch query kernel
+    double write_time;        // Time in the collective writes of the estimates
+} QueryStats;
+
+int query_file_run(const CountMinSketch *cms, const char *query_path, const char *output_path,
+                   const ReadConfig *config, const KeyFormat *keys, int n_threads, MPI_Comm comm,
+                   QueryStats *stats);
+
+#endif
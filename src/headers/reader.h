@@ -0,0 +1,58 @@
+#ifndef READER_H
+#define READER_H
+
+#include "file_io.h"
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+    Input backends able to feed the sketch with the rank range of the file
+*/
+typedef enum {
+    READER_MPIIO,   // MPI-IO pipeline (independent or collective), see ReadPipeline
+    READER_MMAP,    // mmap of the rank range, chunks handed out without any copy
+    READER_PREAD    // POSIX pread into a single buffer
+} reader_backend;
+
+/*
+    Small reader interface: reader_next returns the next chunk of the
+    rank range until it is exhausted, whatever the backend
+*/
+typedef struct InputReader InputReader;
+struct InputReader {
+    reader_backend backend;
+    int (*next)(InputReader *reader, uint8_t **data, MPI_Offset *count);
+    void (*close)(InputReader *reader);
+
+    MPI_Offset start_index;      // First address of the range
+    MPI_Offset n_addresses;      // Addresses in the range
+    MPI_Offset position;         // Addresses already returned
+    MPI_Offset chunk_addresses;  // Addresses per returned chunk
+    int record_size;             // Bytes per address (record)
+    MPI_Offset data_offset;      // Bytes before the first record
+    double exposed_time;         // Time spent blocked in the backend
+    ChunkScheduler *scheduler;   // Dynamic schedule: chunks claimed instead of walking the range
+
+    ReadPipeline pipe;           // READER_MPIIO
+    int fd;                      // READER_MMAP, READER_PREAD
+    uint8_t *map;                // READER_MMAP: page-aligned mapping
+    size_t map_length;
+    size_t map_skip;             // Bytes between the mapping start and the first address
+    uint8_t *buffer;             // READER_PREAD
+};
+
+// Parse/print helpers for the backend
+int reader_backend_parse(const char *name, reader_backend *backend);
+const char *reader_backend_name(reader_backend backend);
+
+int reader_open(InputReader *reader, reader_backend backend, const char *path, MPI_File fh, MPI_Comm comm,
+                const ReadConfig *config, MPI_Offset start_index, MPI_Offset n_addresses);
+int reader_next(InputReader *reader, uint8_t **data, MPI_Offset *count);
+double reader_overlap(const InputReader *reader);
+void reader_close(InputReader *reader);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include "cms.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <mpi.h>
+
+/*
+    Strategies available to combine the per-rank sketches into the global one
+*/
+typedef enum {
+    CMS_REDUCE_ROOT,     // MPI_Reduce of the whole table on the root rank
+    CMS_REDUCE_ALL,      // MPI_Allreduce, every rank ends up with the global table
+    CMS_REDUCE_SCATTER,  // MPI_Reduce_scatter by row blocks, then gather on the root
+    CMS_REDUCE_HIER      // Shared-memory sum inside each node, then MPI_Reduce among node leaders
+} cms_reduce_mode;
+
+/*
+    Time spent in each level of the reduction.
+    Flat modes only fill inter_time.
+*/
+typedef struct {
+    double intra_time;   // Summation inside the node (shared window)
+    double inter_time;   // Reduction across ranks/node leaders
+} CmsReduceTiming;
+
+// Parse/print helpers for the reduction mode
+int cms_reduce_mode_parse(const char *name, cms_reduce_mode *mode);
+const char *cms_reduce_mode_name(cms_reduce_mode mode);
+
+// Sum the tables of all the ranks of comm according to mode (timing may be NULL)
+int cms_reduce(CountMinSketch *cms, cms_reduce_mode mode, int root, MPI_Comm comm, CmsReduceTiming *timing);
+// MPI datatype matching the cells of cms
+MPI_Datatype cms_cell_datatype(const CountMinSketch *cms);
+// Copy the table of root to every rank of comm
+int cms_broadcast(CountMinSketch *cms, int root, MPI_Comm comm);
+
+#endif
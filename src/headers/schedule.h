@@ -0,0 +1,39 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    How the input file is split among the ranks
+*/
+typedef enum {
+    SCHEDULE_STATIC,   // One contiguous range per rank, fixed before reading
+    SCHEDULE_DYNAMIC   // Ranks claim chunks from a shared counter until the file is exhausted
+} schedule_mode;
+
+/*
+    Shared chunk counter for the dynamic schedule: a single long long
+    exposed by rank 0 in an RMA window, advanced with MPI_Fetch_and_op
+*/
+typedef struct {
+    MPI_Win win;
+    long long *counter;          // Next chunk to hand out (only allocated on rank 0)
+    long long n_chunks;          // Chunks in the file
+    MPI_Offset n_addresses;      // Addresses in the file
+    MPI_Offset chunk_addresses;  // Addresses per chunk (the last one may be shorter)
+    long long claimed;           // Chunks claimed by this rank
+    double claim_time;           // Time spent claiming chunks
+} ChunkScheduler;
+
+// Parse/print helpers for the schedule
+int schedule_mode_parse(const char *name, schedule_mode *mode);
+const char *schedule_mode_name(schedule_mode mode);
+
+int chunk_scheduler_init(ChunkScheduler *sched, MPI_Comm comm, MPI_Offset n_addresses, MPI_Offset chunk_addresses);
+int chunk_scheduler_claim(ChunkScheduler *sched, MPI_Offset *first, MPI_Offset *count);
+void chunk_scheduler_free(ChunkScheduler *sched);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "cms.h"
+#include "reduce.h"
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define STREAM_TAG_DATA   1 // Batch of keys, reader -> worker
+#define STREAM_TAG_CREDIT 2 // Batch processed, worker -> reader
+#define STREAM_TAG_MERGE  3 // Periodic merge, reader -> workers
+#define STREAM_TAG_STOP   4 // End of stream (final merge), reader -> workers
+
+/*
+    Streaming ingestion settings
+*/
+typedef struct {
+    size_t batch_keys;      // Keys per batch handed to a worker
+    int queue_depth;        // Batches in flight per worker (bounded queue)
+    double merge_interval;  // Seconds between two merges of the worker sketches
+    cms_reduce_mode reduce_mode; // Reduction used by the merges (result on rank 0)
+} StreamConfig;
+
+/*
+    Counters of a streaming run (rank 0 holds the reader side)
+*/
+typedef struct {
+    unsigned long long keys;     // Keys received from the source
+    unsigned long long batches;  // Batches sent (or processed, on a worker)
+    int merges;                  // Merges done
+    double read_time;            // Time spent waiting for the source
+    double compute_time;         // Time spent updating the local sketch
+    double merge_time;           // Time spent in the merges
+} StreamStats;
+
+void stream_config_default(StreamConfig *config);
+
+/*
+    Called on rank 0 after every merge, with the global sketch up to date
+    (may be NULL)
+*/
+typedef void (*stream_merge_hook)(CountMinSketch *global, const StreamStats *stats, void *arg);
+
+int stream_run(const char *source, const StreamConfig *config, CountMinSketch *local, CountMinSketch *global,
+               stream_merge_hook hook, void *hook_arg, MPI_Comm comm, StreamStats *stats);
+
+#endif
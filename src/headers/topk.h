@@ -0,0 +1,54 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include "cms.h"
+
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOPK_LOCAL_FACTOR 4 // Local candidates per global heavy hitter kept by every rank
+
+/*
+    Tracked key and its latest estimate
+*/
+typedef struct {
+    uint32_t key;
+    uint64_t count;
+    int slot;        // Position of the key in the index
+} TopKEntry;
+
+/*
+    Heavy-hitter tracker: the capacity keys with the largest sketch
+    estimates seen so far, in a min-heap on the estimate, plus an open
+    addressing index from key to heap position. A key that does not beat
+    the smallest tracked estimate costs a single comparison.
+*/
+typedef struct {
+    int capacity;
+    int size;
+    TopKEntry *heap;     // Min-heap on count
+    int *index;          // Heap position + 1 of the key hashed there, 0 if empty
+    int index_bits;      // log2 of the index size (at least twice the capacity)
+} TopK;
+
+TopK *topk_create(int capacity);
+void topk_free(TopK *topk);
+void topk_clear(TopK *topk);
+
+// Record a new estimate of key (estimates of a key only grow)
+void topk_offer(TopK *topk, uint32_t key, uint64_t count);
+
+// Copy the tracked keys to out (capacity entries), largest estimates first. Returns their number.
+int topk_sorted(const TopK *topk, TopKEntry *out);
+
+// Update the sketch and offer the fresh estimate of every key of the batch
+void cms_topk_batch_update(CountMinSketch *cms, TopK *topk, const uint8_t *keys, size_t n_keys);
+// Offer the estimates of a batch already counted in the sketch
+void cms_topk_offer_batch(const CountMinSketch *cms, TopK *topk, const uint8_t *keys, size_t n_keys);
+
+int topk_merge(TopK *topk, const CountMinSketch *global, int root, MPI_Comm comm);
+
+#endif
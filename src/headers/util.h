@@ -8,8 +8,16 @@
 #include <stdio.h>
 #include <mpi.h>
   
-/* Existing declarations */
-uint32_t ip_to_int(const uint8_t *ip_addr);
+/*
+    Convert an IPv4 address (4 bytes, network byte order) to a 32-bit integer.
+    Inline since it runs once per key in every update kernel.
+*/
+static inline uint32_t ip_to_int(const uint8_t *ip_addr) {
+    return (uint32_t)ip_addr[0] << 24 |
+           (uint32_t)ip_addr[1] << 16 |
+           (uint32_t)ip_addr[2] << 8  |
+           (uint32_t)ip_addr[3];
+}
 
 /* Cleanup helper */
 void safe_cleanup(uint8_t *buffer, CountMinSketch *cms, MPI_File *fh);
@@ -0,0 +1,91 @@
+#include "headers/hybrid.h"
+
+/*
+    Convert the command-line name of a threading strategy to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int cms_thread_strategy_parse(const char *name, cms_thread_strategy *strategy) {
+    if (strcmp(name, "atomic") == 0)
+        *strategy = CMS_THREADS_ATOMIC;
+    else if (strcmp(name, "striped") == 0)
+        *strategy = CMS_THREADS_STRIPED;
+    else
+        return -1;
+    return 0;
+}
+
+const char *cms_thread_strategy_name(cms_thread_strategy strategy) {
+    switch (strategy) {
+        case CMS_THREADS_ATOMIC:  return "atomic";
+        case CMS_THREADS_STRIPED: return "striped";
+    }
+    return "unknown";
+}
+
+/*
+    Update a single shared Count-Min Sketch with n_threads threads
+
+    - CMS_THREADS_ATOMIC: the keys are split statically among the threads,
+      every increment is a relaxed atomic add on the shared table.
+    - CMS_THREADS_STRIPED: the table cells are split among the threads
+      (by rows, or by column blocks when there are more threads than rows);
+      every thread hashes the whole buffer and only writes its own cells.
+
+    Parameters:
+    cms       - pointer to the shared Count-Min Sketch
+    keys      - pointer to the array of keys (each of size IP_SIZE)
+    n_keys    - number of keys in the array
+    n_threads - number of OpenMP threads to use
+    strategy  - how the threads share the table
+*/
+void cms_threaded_batch_update(CountMinSketch *cms, const uint8_t *keys, size_t n_keys,
+                               int n_threads, cms_thread_strategy strategy) {
+    size_t n_cells = (size_t)cms->width * cms->depth;
+
+    #pragma omp parallel num_threads(n_threads)
+    {
+        int tid = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+
+        if (strategy == CMS_THREADS_ATOMIC) {
+            // Contiguous slice of the buffer for this thread
+            size_t base = n_keys / nt;
+            size_t remainder = n_keys % nt;
+            size_t first = tid * base + ((size_t)tid < remainder ? (size_t)tid : remainder);
+            size_t count = base + ((size_t)tid < remainder ? 1 : 0);
+            cms_batch_update_atomic(cms, &keys[first * IP_SIZE], count);
+        } else {
+            // Whole rows when possible, otherwise equal blocks of cells
+            size_t cell_lo, cell_hi;
+            if (nt <= cms->depth) {
+                int row_lo = tid * cms->depth / nt;
+                int row_hi = (tid + 1) * cms->depth / nt;
+                cell_lo = (size_t)row_lo * cms->width;
+                cell_hi = (size_t)row_hi * cms->width;
+            } else {
+                cell_lo = tid * n_cells / nt;
+                cell_hi = (tid + 1) * n_cells / nt;
+            }
+            cms_batch_update_range(cms, keys, n_keys, cell_lo, cell_hi);
+        }
+    }
+}
+
+/*
+    Answer a batch of queries with n_threads OpenMP threads.
+    The sketch is only read, so every thread runs the batch query
+    kernel on its own contiguous slice of the keys.
+*/
+void cms_threaded_batch_query(const CountMinSketch *cms, const uint8_t *keys, size_t n_keys,
+                              uint64_t *estimates, int n_threads) {
+    #pragma omp parallel num_threads(n_threads)
+    {
+        int tid = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t base = n_keys / nt;
+        size_t remainder = n_keys % nt;
+        size_t first = tid * base + ((size_t)tid < remainder ? (size_t)tid : remainder);
+        size_t count = base + ((size_t)tid < remainder ? 1 : 0);
+        cms_batch_query(cms, &keys[first * IP_SIZE], count, &estimates[first]);
+    }
+}
@@ -0,0 +1,154 @@
+#include "headers/keygen.h"
+
+#include <math.h>
+
+/*
+    Convert the command-line name of a key distribution to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int keygen_distribution_parse(const char *name, keygen_distribution *distribution) {
+    if (strcmp(name, "uniform") == 0)
+        *distribution = KEYGEN_UNIFORM;
+    else if (strcmp(name, "zipf") == 0)
+        *distribution = KEYGEN_ZIPF;
+    else if (strcmp(name, "hotset") == 0)
+        *distribution = KEYGEN_HOTSET;
+    else
+        return -1;
+    return 0;
+}
+
+const char *keygen_distribution_name(keygen_distribution distribution) {
+    switch (distribution) {
+        case KEYGEN_UNIFORM: return "uniform";
+        case KEYGEN_ZIPF:    return "zipf";
+        case KEYGEN_HOTSET:  return "hotset";
+    }
+    return "unknown";
+}
+
+/*
+    Prepare a generator. n_distinct is the number of Zipf ranks or of hot
+    addresses, skew is only used by KEYGEN_ZIPF.
+    Returns 0 on success, -1 on error.
+*/
+int keygen_init(KeyGenerator *gen, keygen_distribution distribution, uint32_t n_distinct, double skew, uint64_t seed) {
+    gen->distribution = distribution;
+    gen->state = seed;
+    gen->n_distinct = n_distinct;
+    gen->skew = skew;
+    gen->cdf = NULL;
+    gen->salt = (uint32_t)cms_splitmix64(&gen->state);
+    gen->origin = gen->state;
+    gen->hot_share = KEYGEN_HOT_SHARE;
+    if (distribution == KEYGEN_HOTSET && n_distinct == 0) {
+        fprintf(stderr, "Error: hot-set keys need n_distinct > 0.\n");
+        return -1;
+    }
+    if (distribution != KEYGEN_ZIPF)
+        return 0;
+
+    if (n_distinct == 0 || skew <= 0.0) {
+        fprintf(stderr, "Error: Zipf keys need n_distinct > 0 and a positive skew.\n");
+        return -1;
+    }
+    gen->cdf = malloc(n_distinct * sizeof(double));
+    if (gen->cdf == NULL) {
+        fprintf(stderr, "Error: failed to allocate the Zipf CDF (%u ranks).\n", n_distinct);
+        return -1;
+    }
+    double sum = 0.0;
+    for (uint32_t r = 0; r < n_distinct; r++) {
+        sum += pow((double)r + 1.0, -skew);
+        gen->cdf[r] = sum;
+    }
+    for (uint32_t r = 0; r < n_distinct; r++)
+        gen->cdf[r] /= sum;
+    gen->cdf[n_distinct - 1] = 1.0;
+    return 0;
+}
+
+void keygen_free(KeyGenerator *gen) {
+    free(gen->cdf);
+    gen->cdf = NULL;
+}
+
+/*
+    Address of a Zipf rank (0 = most frequent): the murmur3 finalizer is a
+    bijection of the 32-bit integers
+*/
+uint32_t keygen_key_of_rank(const KeyGenerator *gen, uint32_t rank) {
+    uint32_t h = rank ^ gen->salt;
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35U;
+    h ^= h >> 16;
+    return h;
+}
+
+/*
+    Rank of an address (the inverse of keygen_key_of_rank), e.g. to count
+    the keys of every rank. An address of no rank gives a rank >= n_distinct.
+*/
+uint32_t keygen_rank_of_key(const KeyGenerator *gen, uint32_t key) {
+    uint32_t h = key;
+    h ^= h >> 16;
+    h *= 0x7ED1B41DU;  // Inverse of 0xC2B2AE35 mod 2^32
+    h ^= (h >> 13) ^ (h >> 26);
+    h *= 0xA5CB9243U;  // Inverse of 0x85EBCA6B mod 2^32
+    h ^= h >> 16;
+    return h ^ gen->salt;
+}
+
+/*
+    Key of a 64-bit draw of the splitmix64 stream
+*/
+static uint32_t key_of_draw(const KeyGenerator *gen, uint64_t r) {
+    if (gen->distribution == KEYGEN_UNIFORM)
+        return (uint32_t)(r >> 32);
+    if (gen->distribution == KEYGEN_HOTSET) {
+        // Low half: hot or not, high half: the address
+        if ((double)(uint32_t)r < gen->hot_share * 4294967296.0)
+            return keygen_key_of_rank(gen, (uint32_t)((r >> 32) % gen->n_distinct));
+        return (uint32_t)(r >> 32);
+    }
+
+    // First rank whose cumulative probability exceeds u
+    double u = (double)(r >> 11) * (1.0 / 9007199254740992.0);
+    uint32_t lo = 0, hi = gen->n_distinct - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (gen->cdf[mid] > u)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return keygen_key_of_rank(gen, lo);
+}
+
+/*
+    Next key of the stream
+*/
+uint32_t keygen_next(KeyGenerator *gen) {
+    return key_of_draw(gen, cms_splitmix64(&gen->state));
+}
+
+/*
+    Key index of the stream (0 = the first keygen_next), without
+    advancing it: splitmix64 can jump to any position of its sequence
+*/
+uint32_t keygen_key_at(const KeyGenerator *gen, uint64_t index) {
+    uint64_t state = gen->origin + index * 0x9E3779B97F4A7C15ULL;
+    return key_of_draw(gen, cms_splitmix64(&state));
+}
+
+void keygen_fill(KeyGenerator *gen, uint8_t *keys, size_t n_keys) {
+    for (size_t i = 0; i < n_keys; i++) {
+        uint32_t ip = keygen_next(gen);
+        keys[i * IP_SIZE + 0] = (uint8_t)(ip >> 24);
+        keys[i * IP_SIZE + 1] = (uint8_t)(ip >> 16);
+        keys[i * IP_SIZE + 2] = (uint8_t)(ip >> 8);
+        keys[i * IP_SIZE + 3] = (uint8_t)ip;
+    }
+}
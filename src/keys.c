@@ -0,0 +1,273 @@
+#include "headers/keys.h"
+#include "headers/cms.h"
+
+#include <immintrin.h>
+#include <omp.h>
+
+#define KEY_EXTRACT_BLOCK 4096  // Records per OpenMP work item
+
+void key_format_default(KeyFormat *fmt) {
+    memset(fmt, 0, sizeof(*fmt));
+    fmt->kind = KEY_IPV4;
+    fmt->record_size = 4;
+    fmt->key_offset = 0;
+    fmt->key_width = 4;
+}
+
+/*
+    Parse a key format: "ipv4", "ipv6" or "record:SIZE[:OFFSET:WIDTH]"
+    (the whole record is the key when OFFSET and WIDTH are omitted).
+    Returns 0 on success, -1 if the format is not valid.
+*/
+int key_format_parse(const char *spec, KeyFormat *fmt) {
+    key_format_default(fmt);
+    if (strcmp(spec, "ipv4") == 0)
+        return 0;
+    if (strcmp(spec, "ipv6") == 0) {
+        fmt->kind = KEY_IPV6;
+        fmt->record_size = 16;
+        fmt->key_width = 16;
+        return 0;
+    }
+    if (strncmp(spec, "record:", 7) != 0)
+        return -1;
+
+    long size, offset = 0, width;
+    char *end;
+    size = strtol(spec + 7, &end, 10);
+    width = size;
+    if (*end == ':') {
+        offset = strtol(end + 1, &end, 10);
+        if (*end != ':')
+            return -1;
+        width = strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || size < 1 || size > KEY_MAX_RECORD || offset < 0 || width < 1 || width > KEY_MAX_WIDTH ||
+        offset + width > size)
+        return -1;
+    fmt->kind = KEY_RECORD;
+    fmt->record_size = (int)size;
+    fmt->key_offset = (int)offset;
+    fmt->key_width = (int)width;
+    return 0;
+}
+
+const char *key_format_kind_name(key_format_kind kind) {
+    switch (kind) {
+        case KEY_IPV4:   return "ipv4";
+        case KEY_IPV6:   return "ipv6";
+        case KEY_RECORD: return "record";
+    }
+    return "unknown";
+}
+
+void key_format_describe(const KeyFormat *fmt, char *text, size_t size) {
+    if (fmt->kind == KEY_RECORD)
+        snprintf(text, size, "record:%d:%d:%d (%s)", fmt->record_size, fmt->key_offset, fmt->key_width,
+                 fmt->key_width > 4 ? "32-bit digest" : "exact");
+    else
+        snprintf(text, size, "%s%s", key_format_kind_name(fmt->kind), fmt->key_width > 4 ? " (32-bit digest)" : "");
+}
+
+static int key_format_equal(const KeyFormat *a, const KeyFormat *b) {
+    return a->record_size == b->record_size && a->key_offset == b->key_offset && a->key_width == b->key_width;
+}
+
+/*
+    Look for a KeyFileHeader at the start of path. With a header, fmt is
+    set from it (if from_cli, fmt already holds the format of the command
+    line and the two must agree) and *data_offset is the header size;
+    without one fmt is left as it is and *data_offset is 0.
+    Returns 0 on success, -1 on error.
+*/
+int key_format_probe(const char *path, int from_cli, KeyFormat *fmt, MPI_Offset *data_offset) {
+    *data_offset = 0;
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+    KeyFileHeader header;
+    size_t n = fread(&header, 1, sizeof(header), in);
+    fclose(in);
+    if (n < sizeof(header) || memcmp(header.magic, KEY_FILE_MAGIC, 8) != 0)
+        return 0;
+
+    KeyFormat file_fmt;
+    key_format_default(&file_fmt);
+    file_fmt.kind = (key_format_kind)header.kind;
+    file_fmt.record_size = (int)header.record_size;
+    file_fmt.key_offset = (int)header.key_offset;
+    file_fmt.key_width = (int)header.key_width;
+    if (header.version != KEY_FILE_VERSION || header.header_bytes < sizeof(header) || header.kind > KEY_RECORD ||
+        file_fmt.record_size < 1 || file_fmt.record_size > KEY_MAX_RECORD || file_fmt.key_width < 1 ||
+        file_fmt.key_width > KEY_MAX_WIDTH || file_fmt.key_offset < 0 ||
+        file_fmt.key_offset + file_fmt.key_width > file_fmt.record_size) {
+        fprintf(stderr, "Error: %s has an invalid key header\n", path);
+        return -1;
+    }
+    if (from_cli && !key_format_equal(fmt, &file_fmt)) {
+        fprintf(stderr, "Error: the key header of %s (record:%d:%d:%d) does not match --key\n", path,
+                file_fmt.record_size, file_fmt.key_offset, file_fmt.key_width);
+        return -1;
+    }
+    *fmt = file_fmt;
+    *data_offset = (MPI_Offset)header.header_bytes;
+    return 0;
+}
+
+/*
+    Write the KeyFileHeader of fmt, for the generators of input files.
+    Returns 0 on success, -1 on error.
+*/
+int key_format_write_header(FILE *out, const KeyFormat *fmt) {
+    KeyFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, KEY_FILE_MAGIC, 8);
+    header.version = KEY_FILE_VERSION;
+    header.header_bytes = sizeof(header);
+    header.kind = (uint32_t)fmt->kind;
+    header.record_size = (uint32_t)fmt->record_size;
+    header.key_offset = (uint32_t)fmt->key_offset;
+    header.key_width = (uint32_t)fmt->key_width;
+    return fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+}
+
+/*
+    Draw the digest parameters from the seed of the sketch, so that every
+    rank, and every sketch built with the same seed, digests a key the same way
+*/
+void key_format_seed(KeyFormat *fmt, uint64_t seed) {
+    uint64_t state = seed ^ 0x6B65797366726D74ULL;  // Not the stream of the row hash parameters
+    for (int i = 0; i < KEY_DIGEST_SECRETS; i++)
+        fmt->secrets[i] = cms_splitmix64(&state);
+    fmt->digest_init = cms_splitmix64(&state) ^ ((uint64_t)fmt->key_width * 0x9E3779B97F4A7C15ULL);
+}
+
+/* ---------------- Digest ---------------- */
+
+static inline uint64_t digest_mul32(uint64_t x) {
+    return (x & 0xFFFFFFFFULL) * (x >> 32);
+}
+
+static inline uint64_t digest_rot32(uint64_t x) {
+    return (x << 32) | (x >> 32);
+}
+
+// murmur3 finalizer
+static inline uint32_t digest_fmix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35U;
+    h ^= h >> 16;
+    return h;
+}
+
+/*
+    32-bit digest of a key of fmt->key_width bytes. Every 8-byte word w of
+    the key (the last one zero-padded) adds
+        lo32(w ^ s) * hi32(w ^ s) + rot32(w)
+    to a 64-bit accumulator, whose two halves are folded and finalized.
+    Only 32x32->64 multiplies are used, so the AVX2 kernel computes the
+    exact same digest 4 words at a time.
+*/
+uint32_t key_digest(const KeyFormat *fmt, const uint8_t *key) {
+    uint64_t acc = fmt->digest_init;
+    int w = 0;
+    for (int pos = 0; pos < fmt->key_width; pos += 8, w++) {
+        uint64_t word = 0;
+        int n = fmt->key_width - pos < 8 ? fmt->key_width - pos : 8;
+        memcpy(&word, key + pos, (size_t)n);
+        acc += digest_mul32(word ^ fmt->secrets[w % KEY_DIGEST_SECRETS]) + digest_rot32(word);
+    }
+    return digest_fmix32((uint32_t)acc ^ (uint32_t)(acc >> 32));
+}
+
+static inline void store_key(uint8_t *out, uint32_t key) {
+    out[0] = (uint8_t)(key >> 24);
+    out[1] = (uint8_t)(key >> 16);
+    out[2] = (uint8_t)(key >> 8);
+    out[3] = (uint8_t)key;
+}
+
+/*
+    AVX2 digest of 16-byte records (IPv6): 8 records per iteration, two
+    per register. Returns the number of records done, the caller finishes
+    the tail.
+*/
+__attribute__((target("avx2")))
+static size_t extract16_avx2(const KeyFormat *fmt, const uint8_t *records, size_t n_records, uint8_t *keys) {
+    const __m256i secrets = _mm256_setr_epi64x((long long)fmt->secrets[0], (long long)fmt->secrets[1],
+                                               (long long)fmt->secrets[0], (long long)fmt->secrets[1]);
+    const __m256i init = _mm256_set1_epi64x((long long)fmt->digest_init);
+    const __m256i c1 = _mm256_set1_epi32((int)0x85EBCA6BU);
+    const __m256i c2 = _mm256_set1_epi32((int)0xC2B2AE35U);
+    // Digest of the two records of a register in 32-bit lanes 0 and 4
+    const __m256i pick = _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4);
+    // Byte swap of the 32-bit lanes: the kernels read the keys in network byte order
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    size_t i = 0;
+    for (; i + 8 <= n_records; i += 8) {
+        __m128i out[4];
+        for (int r = 0; r < 4; r++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(records + (i + 2 * r) * 16));
+            __m256i x = _mm256_xor_si256(v, secrets);
+            __m256i t = _mm256_add_epi64(_mm256_mul_epu32(x, _mm256_srli_epi64(x, 32)),
+                                         _mm256_shuffle_epi32(v, 0xB1));       // rot32 of each word
+            t = _mm256_add_epi64(t, _mm256_shuffle_epi32(t, 0x4E));            // Sum of the two words
+            t = _mm256_add_epi64(t, init);
+            __m256i h = _mm256_xor_si256(t, _mm256_srli_epi64(t, 32));         // Fold in the low half
+            h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+            h = _mm256_mullo_epi32(h, c1);
+            h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+            h = _mm256_mullo_epi32(h, c2);
+            h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+            out[r] = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(h, pick));
+        }
+        __m128i lo = _mm_unpacklo_epi64(out[0], out[1]);
+        __m128i hi = _mm_unpacklo_epi64(out[2], out[3]);
+        _mm_storeu_si128((__m128i *)(keys + i * 4), _mm_shuffle_epi8(lo, bswap));
+        _mm_storeu_si128((__m128i *)(keys + i * 4 + 16), _mm_shuffle_epi8(hi, bswap));
+    }
+    return i;
+}
+
+/*
+    Turn n_records records of fmt into 4-byte keys in network byte order,
+    the input of the sketch kernels. keys may not overlap records.
+*/
+void key_extract(const KeyFormat *fmt, const uint8_t *records, size_t n_records, uint8_t *keys) {
+    const size_t size = (size_t)fmt->record_size;
+    const uint8_t *key = records + fmt->key_offset;
+    size_t i = 0;
+
+    if (fmt->key_width <= 4) {
+        // Exact keys, right-aligned like a shorter big-endian integer
+        const int pad = 4 - fmt->key_width;
+        for (; i < n_records; i++) {
+            memset(keys + i * 4, 0, (size_t)pad);
+            memcpy(keys + i * 4 + pad, key + i * size, (size_t)fmt->key_width);
+        }
+        return;
+    }
+    if (fmt->key_width == 16 && size == 16 && __builtin_cpu_supports("avx2"))
+        i = extract16_avx2(fmt, records, n_records, keys);
+    for (; i < n_records; i++)
+        store_key(keys + i * 4, key_digest(fmt, key + i * size));
+}
+
+/*
+    key_extract split among n_threads OpenMP threads
+*/
+void key_extract_threaded(const KeyFormat *fmt, const uint8_t *records, size_t n_records, uint8_t *keys,
+                          int n_threads) {
+    const long n_blocks = (long)((n_records + KEY_EXTRACT_BLOCK - 1) / KEY_EXTRACT_BLOCK);
+    #pragma omp parallel for schedule(static) num_threads(n_threads)
+    for (long b = 0; b < n_blocks; b++) {
+        size_t first = (size_t)b * KEY_EXTRACT_BLOCK;
+        size_t count = n_records - first < KEY_EXTRACT_BLOCK ? n_records - first : KEY_EXTRACT_BLOCK;
+        key_extract(fmt, records + first * fmt->record_size, count, keys + first * 4);
+    }
+}
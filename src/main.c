@@ -3,76 +3,293 @@
     * Main function for parallel Count-Min Sketch using MPI
     The program reads IP addresses from a binary file in parallel,
     updates a Count-Min Sketch data structure, and prints debugging information.
-    Usage: mpirun -n <num_processes> ./CMsketch <input_file> <output_file> <epsilon> <delta>
+    Usage: mpirun -n <num_processes> ./CMsketch <input_file> <output_file> <epsilon> <delta> [options]
     TODO: 
-        1)ADD timing to different part of the code -> we can sum the time spent in each zone
-        2)PASS number of CPUS and NODE used, to be able to add id to the output
+        1)PASS number of CPUS and NODE used, to be able to add id to the output
 */
 
-int main(int argc, char **argv) {
-    // Check the validity of command-line arguments
-    if (argc < 5) {
-        fprintf(stderr, "Usage: %s <input_file> <output_file> <epsilon> <delta>\n", argv[0]);
+/*
+    Gather the measures of every rank on rank 0, which prints them and
+    records the run in the CSV output file (and the JSON profile).
+    Collective. Returns 0 on success, -1 on error.
+*/
+static int report_profile(const RankProfile *profile, const RunOptions *opts, const char *mode,
+                          long long dataset_size, int rank, int comm_sz) {
+    ProfileSummary summary;
+    if (profile_gather(profile, 0, MPI_COMM_WORLD, &summary) == -1)
         return -1;
+    int result = 0;
+    if (rank == 0) {
+        ProfileRun run = { mode, comm_sz, opts->n_threads, dataset_size };
+        profile_print(&summary, stdout);
+        if (profile_write_csv(opts->output_file, &run, &summary) == -1)
+            result = -1;
+        if (opts->profile_file && profile_write_json(opts->profile_file, &run, &summary) == -1)
+            result = -1;
     }
-    if (access(argv[1], F_OK) == -1) {
-        fprintf(stderr, "Input file %s does not exist.\n", argv[1]);
-        return -1;
+    profile_summary_free(&summary);
+    return result;
+}
+
+static void print_address(uint32_t address) {
+    printf("%u.%u.%u.%u", address >> 24, (address >> 16) & 0xFF, (address >> 8) & 0xFF, address & 0xFF);
+}
+
+/*
+    Rank 0 report of the prefix levels: their sizes, the estimates of the
+    --range list and the hierarchical heavy hitters of --hhh
+*/
+static void report_hierarchy(const HierarchicalSketch *hier, const RunOptions *opts, uint64_t total_keys) {
+    printf("Hierarchy:");
+    for (int l = 0; l < hier->n_levels; l++) {
+        const CmsHierLevel *level = &hier->levels[l];
+        if (level->exact)
+            printf(" /%d exact", level->prefix_bits);
+        else
+            printf(" /%d %dx%d", level->prefix_bits, level->cms->width, level->cms->depth);
     }
-    if (access(argv[2], F_OK) == -1) {
-        fprintf(stderr, "Output file %s does not exist.\n", argv[2]);
-        return -1;
+    printf(", %.1f MiB (epsilon %g)\n", cms_hier_bytes(hier) / (1024.0 * 1024.0), opts->hierarchy.epsilon);
+
+    const char *list = opts->ranges;
+    char spec[CMS_HIER_RANGE_TEXT];
+    uint32_t lo, hi;
+    while (list && cms_hier_ranges_next(&list, spec, &lo, &hi) == 1) {
+        CmsHierEstimate estimate = cms_hier_range_query(hier, lo, hi);
+        printf("  %s: %llu keys (error <= %.0f, %lld blocks)\n", spec, (unsigned long long)estimate.count,
+               estimate.error_rate * (double)total_keys, estimate.n_blocks);
+    }
+
+    if (opts->hhh_phi > 0.0) {
+        uint64_t threshold = (uint64_t)ceil(opts->hhh_phi * (double)total_keys);
+        CmsHierHitter *hitters;
+        int n_hitters = cms_hier_heavy_hitters(hier, threshold, &hitters);
+        if (n_hitters < 0)
+            return;
+        printf("Hierarchical heavy hitters above %llu keys: %d\n", (unsigned long long)threshold, n_hitters);
+        for (int i = 0; i < n_hitters; i++) {
+            printf("  ");
+            print_address(hitters[i].prefix);
+            printf("/%d %llu (%llu outside the hitters below)\n", hitters[i].prefix_bits,
+                   (unsigned long long)hitters[i].estimate, (unsigned long long)hitters[i].residual);
+        }
+        free(hitters);
     }
+}
+
+/*
+    Sliding window fed by the merges of the streaming mode: every merge
+    interval is an epoch
+*/
+typedef struct {
+    WindowedSketch *window;
+    unsigned long long merged_keys;  // Keys already added to the window
+} StreamWindow;
+
+static void stream_window_hook(CountMinSketch *global, const StreamStats *stats, void *arg) {
+    StreamWindow *sw = arg;
+    // The previous interval is complete, a new epoch starts with this merge
+    if (stats->merges > 1)
+        cms_window_rotate(sw->window);
+    cms_window_merge(sw->window, global, stats->keys - sw->merged_keys);
+    sw->merged_keys = stats->keys;
+    cms_clear(global);
+}
 
-    /* Parse and validate epsilon and delta */
-    char *endptr;
-    double epsilon = strtod(argv[3], &endptr);
-    if (endptr == argv[3] || *endptr != '\0') {
-        fprintf(stderr, "Invalid epsilon: '%s' (not a number)\n", argv[3]);
+/*
+    Rank 0 answers --query at the end of the stream with a snapshot of the
+    last window_query epochs of the window (the whole window if 0).
+    Returns 0 on success, -1 on error.
+*/
+static int stream_window_query(const RunOptions *opts, const WindowedSketch *window, RankProfile *profile) {
+    int last_n = (opts->window_query > 0) ? opts->window_query : window->n_epochs;
+    CountMinSketch *snapshot = cms_create_from_error_ex(opts->epsilon, opts->delta, &opts->cms_config);
+    if (snapshot == NULL || cms_window_snapshot(window, last_n, snapshot) == -1) {
+        fprintf(stderr, "Error: failed to build the snapshot of the window\n");
+        if (snapshot)
+            cms_free(snapshot);
         return -1;
     }
-    double delta = strtod(argv[4], &endptr);
-    if (endptr == argv[4] || *endptr != '\0') {
-        fprintf(stderr, "Invalid delta: '%s' (not a number)\n", argv[4]);
+    QueryStats query_stats;
+    profile_begin(profile, PROFILE_QUERY);
+    int result = query_file_run(snapshot, opts->query_file, opts->query_output, &opts->read_config,
+                                &opts->key_format, 0, MPI_COMM_SELF, &query_stats);
+    profile_end(profile, PROFILE_QUERY);
+    if (result == 0)
+        printf("Queries: %lld over the last %d epochs (%llu keys) in %.6f s, read %.6f s, query %.6f s, write %.6f s\n",
+               (long long)query_stats.total_queries, last_n, cms_window_keys(window, last_n),
+               profile->values[PROFILE_QUERY], query_stats.read_time, query_stats.query_time,
+               query_stats.write_time);
+    cms_free(snapshot);
+    return result;
+}
+
+/*
+    Streaming mode: rank 0 reads the source and distributes batches to the
+    other ranks, the global sketch is merged periodically on rank 0.
+    With a window, each merge is added to the current epoch instead.
+    Finalizes MPI before returning.
+*/
+static int stream_main(RunOptions *opts, int rank, int comm_sz, double start_time) {
+    RankProfile profile;
+    profile_init(&profile);
+    CountMinSketch *cms = cms_create_from_error_ex(opts->epsilon, opts->delta, &opts->cms_config);
+    CountMinSketch *global = NULL;
+    StreamWindow sw = { NULL, 0 };
+    if (rank == 0 && cms != NULL)
+        global = cms_create_from_error_ex(opts->epsilon, opts->delta, &opts->cms_config);
+    if (rank == 0 && global != NULL && opts->window_epochs > 0) {
+        // Same configuration, hence same seed: the merged deltas are hashed like the window epochs
+        sw.window = cms_window_create_from_error(opts->epsilon, opts->delta, opts->window_epochs, &opts->cms_config);
+    }
+    if (cms == NULL || (rank == 0 && global == NULL) || (rank == 0 && opts->window_epochs > 0 && sw.window == NULL)) {
+        fprintf(stderr, "Error creating the Count-Min Sketch on rank %d\n", rank);
+        if (global)
+            cms_free(global);
+        cms_window_free(sw.window);
+        safe_cleanup(NULL, cms, NULL);
         return -1;
     }
 
-    // Initialize MPI environment
-    MPI_Init(&argc, &argv);
+    StreamStats stats;
+    int result = stream_run(opts->input_file, &opts->stream_config, cms, global,
+                            sw.window ? stream_window_hook : NULL, &sw, MPI_COMM_WORLD, &stats);
+    if (result == -1)
+        fprintf(stderr, "Error in the stream ingestion on rank %d\n", rank);
+    // Rank 0 reads the whole stream; with workers it only updates the sketch when there is no one else
+    profile_add(&profile, PROFILE_READ, stats.read_time);
+    profile_add(&profile, PROFILE_UPDATE, stats.compute_time);
+    profile_add(&profile, PROFILE_REDUCE, stats.merge_time);
+    if (rank == 0)
+        profile_add(&profile, PROFILE_BYTES_READ, (double)stats.keys * IP_SIZE);
+    if (rank != 0 || comm_sz == 1)
+        profile_add(&profile, PROFILE_KEYS, (double)stats.keys);
+
+    printf("Rank %d processed %llu addresses in %llu batches.\n", rank, stats.keys, stats.batches);
+    if (rank == 0) {
+        printf("Sketch %d x %d, %s-bit counters%s, hash %s (seed %llu), kernel %s%s, update %s\n",
+               global->depth, global->width, cms_counter_width_name(global->counters),
+               global->conservative ? " (conservative)" : "", cms_hash_family_name(global->hash_family),
+               (unsigned long long)global->seed, cms_kernel_name(global->kernel), global->specialized ? " (specialized)" : "", cms_update_mode_name(global->update_mode));
+        printf("Stream: %d merge(s) every %.1f s (%s), batches of %zu keys, queue depth %d, waiting for input %.6f s\n",
+               stats.merges, opts->stream_config.merge_interval, cms_reduce_mode_name(opts->reduce_mode),
+               opts->stream_config.batch_keys, opts->stream_config.queue_depth, stats.read_time);
+        if (sw.window)
+            printf("Window: last %d epochs of %.1f s, %llu keys in the window, %lld rotations\n",
+                   sw.window->n_epochs, opts->stream_config.merge_interval,
+                   cms_window_keys(sw.window, sw.window->n_epochs), sw.window->rotations);
+        if (sw.window && opts->query_file && stream_window_query(opts, sw.window, &profile) == -1)
+            result = -1;
+        printf("Throughput (stream, %d ranks): %.0f keys/s\n", comm_sz, stats.keys / (MPI_Wtime() - start_time));
+        // The global sketch already holds the whole stream on rank 0
+        if (opts->checkpoint_file) {
+            profile_begin(&profile, PROFILE_WRITE);
+            if (cms_file_write(global, stats.keys, opts->checkpoint_file) == -1)
+                result = -1;
+            profile_end(&profile, PROFILE_WRITE);
+            if (result == 0)
+                printf("Checkpoint: %s, %.1f MiB written in %.6f s\n", opts->checkpoint_file,
+                       cms_table_bytes(global) / (1024.0 * 1024.0), profile.values[PROFILE_WRITE]);
+        }
+    }
+    profile_add(&profile, PROFILE_TOTAL, MPI_Wtime() - start_time);
+    if (report_profile(&profile, opts, "stream", (long long)stats.keys, rank, comm_sz) == -1)
+        result = -1;
+
+    if (global)
+        cms_free(global);
+    cms_window_free(sw.window);
+    safe_cleanup(NULL, cms, NULL);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    RunOptions opts;
+    if (parse_options(argc, argv, &opts) == -1)
+        return -1;
+
+    // Initialize MPI environment. Only the main thread calls MPI in hybrid mode
+    int thread_level;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_level);
 
     MPI_File fh;    // MPI file handle 
     int rank, comm_sz; // MPI rank (current process) and size (number of processes)
-    double start_time, end_time;
-    double io_time = 0.0, compute_time = 0.0;
+    double start_time;
+    RankProfile profile;  // Per-phase times of the rank, gathered on rank 0 at the end
+    profile_init(&profile);
 
     // Initialize MPI communication, getting rank and size
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
     start_time = MPI_Wtime();
 
+    if (opts.n_threads > 0 && thread_level < MPI_THREAD_FUNNELED && rank == 0)
+        fprintf(stderr, "Warning: the MPI library does not support MPI_THREAD_FUNNELED\n");
+
+    // Every rank hashes with the seed of rank 0, so that the sketches can be merged
+    if (rank == 0 && opts.random_seed)
+        opts.cms_config.seed = cms_random_seed();
+    MPI_Bcast(&opts.cms_config.seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+
+    // Tables are first touched by the threads that update them, on their NUMA nodes
+    cms_mem_set_pages(opts.pages);
+    cms_mem_set_threads(opts.n_threads);
+
+    if (opts.stream) {
+        int result = stream_main(&opts, rank, comm_sz, start_time);
+        cms_mem_pool_release();
+        return result;
+    }
+
+    // MPI-IO hints from the command line, used by the open and the collective file view
+    MPI_Info io_info;
+    if (io_info_create(opts.io_hints, opts.n_io_hints, &io_info) == -1) {
+        safe_cleanup(NULL, NULL, NULL);
+        return -1;
+    }
+    opts.read_config.info = io_info;
+
     // Open the binary file containing IPv4 addresses
-    MPI_File_open(MPI_COMM_WORLD, argv[1], MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    profile_begin(&profile, PROFILE_OPEN);
+    MPI_File_open(MPI_COMM_WORLD, opts.input_file, MPI_MODE_RDONLY, io_info, &fh);
     if(fh == MPI_FILE_NULL) {
-        fprintf(stderr, "Error opening file %s\n", argv[1]);
+        fprintf(stderr, "Error opening file %s\n", opts.input_file);
         safe_cleanup(NULL, NULL, NULL);
         return -1;
     }
 
+    // Records of the input: --key, or the key header at the start of the file (IPv4 without either)
+    MPI_Offset data_offset = 0;
+    if (key_format_probe(opts.input_file, opts.key_from_cli, &opts.key_format, &data_offset) == -1) {
+        safe_cleanup(NULL, NULL, &fh);
+        return -1;
+    }
+    const int record_size = opts.key_format.record_size;
+    opts.read_config.record_size = record_size;
+    opts.read_config.data_offset = data_offset;
+    opts.cms_config.key_width = opts.key_format.key_width;
+    if ((opts.topk > 0 || opts.hierarchy.n_levels > 0) && opts.key_format.key_width > IP_SIZE) {
+        if (rank == 0)
+            fprintf(stderr, "--topk and --hierarchy require keys of at most %d bytes\n", IP_SIZE);
+        safe_cleanup(NULL, NULL, &fh);
+        return -1;
+    }
+
     MPI_Offset file_size = 0;
     // Get the size of the file
     MPI_File_get_size(fh, &file_size);
-    if(file_size % IP_SIZE != 0) {
+    if(file_size < data_offset || (file_size - data_offset) % record_size != 0) {
         if (rank == 0) {
-            fprintf(stderr, "File size is not a multiple of IP address size\n");
+            fprintf(stderr, "File size is not a multiple of the record size (%d bytes)\n", record_size);
         }
         safe_cleanup(NULL, NULL, &fh);
         return -1;
     }
+    profile_end(&profile, PROFILE_OPEN);
 
     // Compute the information neede for parallel reading on the file
 
     // Total number of data elements in the file (file_size divided by size of each element)
-    MPI_Offset total_addresses = file_size / IP_SIZE;
+    MPI_Offset total_addresses = (file_size - data_offset) / record_size;
     // Number of elements each process gets in an even distribution
     MPI_Offset base_address_count = total_addresses / comm_sz;
     // Leftover elements that don't fit evenly
@@ -82,54 +299,313 @@ int main(int argc, char **argv) {
     // Number of addresses handled by the process. if rank < remainder, assign 1 extra element
     MPI_Offset local_addresses = base_address_count + (rank < remainder ? 1 : 0);
 
-    // Allocate buffer to read IP addresses. Each process has its own buffer.
-    uint8_t *buffer = malloc(BUFFER_SIZE);
-    if(!buffer) {
-        fprintf(stderr, "Error allocating memory for buffer on rank %d\n", rank);
+    // Dynamic schedule: every rank claims chunks of the whole file from a shared counter
+    ChunkScheduler scheduler;
+    if (opts.schedule == SCHEDULE_DYNAMIC) {
+        if (chunk_scheduler_init(&scheduler, MPI_COMM_WORLD, total_addresses,
+                                 read_config_chunk_records(&opts.read_config)) == -1) {
+            safe_cleanup(NULL, NULL, &fh);
+            return -1;
+        }
+        opts.read_config.scheduler = &scheduler;
+        start_index = 0;
+        local_addresses = total_addresses;
+    }
+
+    // Initialize Count-Min Sketch data structure. A restored sketch brings its own
+    // dimensions, hash functions and counters: epsilon and delta are not used
+    CmsMappedFile restored = { 0 };
+    CountMinSketch *cms;
+    if (opts.restore_file) {
+        if (cms_file_map(opts.restore_file, &opts.cms_config, &restored) == -1) {
+            safe_cleanup(NULL, NULL, &fh);
+            return -1;
+        }
+        if (opts.n_threads > 0 && (restored.cms->counters != CMS_COUNTER_32 || restored.cms->conservative)) {
+            fprintf(stderr, "--threads requires 32-bit counters and the standard update\n");
+            cms_file_unmap(&restored);
+            safe_cleanup(NULL, NULL, &fh);
+            return -1;
+        }
+        if (restored.cms->key_width != opts.key_format.key_width) {
+            fprintf(stderr, "%s counts %d-byte keys, the input has %d-byte keys\n", opts.restore_file,
+                    restored.cms->key_width, opts.key_format.key_width);
+            cms_file_unmap(&restored);
+            safe_cleanup(NULL, NULL, &fh);
+            return -1;
+        }
+        cms = cms_file_create_like(&restored, &opts.cms_config);
+    } else {
+        cms = cms_create_from_error_ex(opts.epsilon, opts.delta, &opts.cms_config);
+    }
+    if (cms == NULL) {
+        fprintf(stderr, "Error creating the Count-Min Sketch on rank %d\n", rank);
+        cms_file_unmap(&restored);
         safe_cleanup(NULL, NULL, &fh);
         return -1;
     }
 
-    // Initialize Count-Min Sketch data structure
-    CountMinSketch *cms = cms_create_from_error(epsilon, delta);
-    
+    // Wide keys are digested with parameters drawn from the seed of the sketch, like its hash functions
+    key_format_seed(&opts.key_format, cms->seed);
+
+    // Records that are not 4-byte keys are converted chunk by chunk, right before the update
+    size_t key_buffer_bytes = (size_t)read_config_chunk_records(&opts.read_config) * IP_SIZE;
+    uint8_t *key_buffer = NULL;
+    if (!key_format_native(&opts.key_format)) {
+        key_buffer = cms_mem_alloc(key_buffer_bytes, CMS_MEM_BUFFER);
+        if (key_buffer == NULL) {
+            fprintf(stderr, "Error: failed to allocate the key buffer on rank %d\n", rank);
+            cms_file_unmap(&restored);
+            safe_cleanup(NULL, cms, &fh);
+            return -1;
+        }
+    }
+
+    // Heavy-hitter candidates of the rank, a few times K so that the merge does not miss global ones
+    TopK *topk = NULL;
+    if (opts.topk > 0) {
+        topk = topk_create(TOPK_LOCAL_FACTOR * opts.topk);
+        if (topk == NULL) {
+            cms_mem_free(key_buffer, key_buffer_bytes);
+            cms_file_unmap(&restored);
+            safe_cleanup(NULL, cms, &fh);
+            return -1;
+        }
+    }
+
+    // Prefix levels, updated with the base sketch and reduced with it
+    HierarchicalSketch *hier = NULL;
+    if (opts.hierarchy.n_levels > 0) {
+        hier = cms_hier_create(cms, &opts.hierarchy, opts.delta, &opts.cms_config);
+        if (hier == NULL) {
+            topk_free(topk);
+            cms_mem_free(key_buffer, key_buffer_bytes);
+            safe_cleanup(NULL, cms, &fh);
+            return -1;
+        }
+    }
+
+    // Reader of the process range (MPI-IO pipeline, mmap or pread backend)
+    InputReader reader;
+    profile_begin(&profile, PROFILE_OPEN);
+    if (reader_open(&reader, opts.reader, opts.input_file, fh, MPI_COMM_WORLD, &opts.read_config,
+                    start_index, local_addresses) == -1) {
+        fprintf(stderr, "Error opening the %s reader on rank %d\n", reader_backend_name(opts.reader), rank);
+        reader_close(&reader);
+        cms_mem_free(key_buffer, key_buffer_bytes);
+        cms_file_unmap(&restored);
+        cms_hier_free(hier);
+        safe_cleanup(NULL, cms, &fh);
+        return -1;
+    }
+    profile_end(&profile, PROFILE_OPEN);
+
     // Chunked reading and processing
     MPI_Offset total_read = 0;
-    while (total_read < local_addresses) {
-        // Remaining IPs to read for this process
-        MPI_Offset remaining = local_addresses - total_read;
-        // Number of IPs to read in this batch (max BUFFER_IP_COUNT)
-        MPI_Offset current_count = (remaining > BUFFER_IP_COUNT) ? BUFFER_IP_COUNT : remaining;
-        // Starting index for this batch
-        MPI_Offset current_start = start_index + total_read;
-
-        // Read the assigned portion of the file into the buffer
-        double io_start = MPI_Wtime();
-        int addresses_read = read_buffer(fh, buffer, current_start, current_count);
-        io_time += MPI_Wtime() - io_start;
-
-        if (addresses_read == -1) {
-            fprintf(stderr, "Error reading buffer on rank %d\n", rank);
-            safe_cleanup(buffer, cms, &fh);
-            return -1;
+    long long n_chunks = 0;
+    uint8_t *buffer;
+    MPI_Offset addresses_read;
+    int status;
+    while ((status = reader_next(&reader, &buffer, &addresses_read)) == 1) {
+        profile_begin(&profile, PROFILE_UPDATE);
+        if (key_buffer) {
+            if (opts.n_threads > 0)
+                key_extract_threaded(&opts.key_format, buffer, (size_t)addresses_read, key_buffer, opts.n_threads);
+            else
+                key_extract(&opts.key_format, buffer, (size_t)addresses_read, key_buffer);
+            buffer = key_buffer;
+        }
+        if (hier) {
+            cms_hier_batch_update(hier, buffer, addresses_read);
+            if (topk)
+                cms_topk_offer_batch(cms, topk, buffer, addresses_read);
+        } else if (opts.n_threads > 0) {
+            cms_threaded_batch_update(cms, buffer, addresses_read, opts.n_threads, opts.thread_strategy);
+            if (topk)
+                cms_topk_offer_batch(cms, topk, buffer, addresses_read);
+        } else if (topk) {
+            cms_topk_batch_update(cms, topk, buffer, addresses_read);
+        } else {
+            cms_batch_update(cms, buffer, addresses_read);
         }
-        double compute_start = MPI_Wtime();
-        cms_batch_update(cms, buffer, addresses_read);
-        compute_time += MPI_Wtime() - compute_start;
+        profile_end(&profile, PROFILE_UPDATE);
         total_read += addresses_read;
+        n_chunks++;
     }
+    // Only the I/O time that was not hidden behind the computation
+    profile_add(&profile, PROFILE_READ, reader.exposed_time);
+    profile_add(&profile, PROFILE_BYTES_READ, (double)total_read * record_size);
+    profile_add(&profile, PROFILE_KEYS, (double)total_read);
+    double io_overlap = reader_overlap(&reader);
+    reader_close(&reader);
+    cms_mem_free(key_buffer, key_buffer_bytes);
 
-    end_time = MPI_Wtime();
+    if (status == -1) {
+        fprintf(stderr, "Error reading buffer on rank %d\n", rank);
+        cms_file_unmap(&restored);
+        cms_hier_free(hier);
+        safe_cleanup(NULL, cms, &fh);
+        return -1;
+    }
 
-    // Debugging prints
-    printf("Rank %d processed %lld addresses.\n", rank, total_read);
+    // Slowest rank ingest time, used for the throughput report; the others are idle until it ends
+    double ingest_time = MPI_Wtime() - start_time;
+    double max_ingest_time = 0.0;
+    MPI_Allreduce(&ingest_time, &max_ingest_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    double idle_time = max_ingest_time - ingest_time;
+    profile_add(&profile, PROFILE_IDLE, idle_time);
+    double max_idle_time = 0.0;
+    MPI_Reduce(&idle_time, &max_idle_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (opts.schedule == SCHEDULE_DYNAMIC)
+        chunk_scheduler_free(&scheduler);
+
+    // Combine the partial sketches of all the ranks into the global one
+    CmsReduceTiming reduce_timing;
+    profile_begin(&profile, PROFILE_REDUCE);
+    int reduced = hier ? cms_hier_reduce(hier, opts.reduce_mode, 0, MPI_COMM_WORLD, &reduce_timing)
+                       : cms_reduce(cms, opts.reduce_mode, 0, MPI_COMM_WORLD, &reduce_timing);
+    if (reduced == -1) {
+        fprintf(stderr, "Error reducing the sketch on rank %d\n", rank);
+        cms_file_unmap(&restored);
+        cms_hier_free(hier);
+        safe_cleanup(NULL, cms, &fh);
+        return -1;
+    }
+    profile_end(&profile, PROFILE_REDUCE);
+
+    // The restored counts are added once, to the global table
+    uint64_t total_keys = (uint64_t)total_addresses;
+    uint64_t restored_keys = 0;
+    if (opts.restore_file) {
+        if (rank == 0 || opts.reduce_mode == CMS_REDUCE_ALL)
+            cms_merge_into(cms, restored.cms);
+        restored_keys = restored.header->total_keys;
+        total_keys += restored_keys;
+        cms_file_unmap(&restored);
+    }
 
-    //Log the info about the runtime
-    if(rank == 0){
-        write_execution_info(argv[2], comm_sz, total_addresses, end_time - start_time, io_time, compute_time);
+    // Global heavy hitters: local candidates re-estimated with the global sketch on rank 0
+    double topk_time = 0.0;
+    if (topk) {
+        double topk_start = MPI_Wtime();
+        if (topk_merge(topk, cms, 0, MPI_COMM_WORLD) == -1) {
+            topk_free(topk);
+            cms_hier_free(hier);
+            safe_cleanup(NULL, cms, &fh);
+            return -1;
+        }
+        topk_time = MPI_Wtime() - topk_start;
+        profile_add(&profile, PROFILE_REDUCE, topk_time);
     }
-    
+
+    // Bulk queries against the finished sketch, which every rank needs
+    QueryStats query_stats;
+    double max_query_time = 0.0;
+    if (opts.query_file) {
+        profile_begin(&profile, PROFILE_QUERY);
+        if (opts.reduce_mode != CMS_REDUCE_ALL && cms_broadcast(cms, 0, MPI_COMM_WORLD) == -1) {
+            topk_free(topk);
+            cms_hier_free(hier);
+            safe_cleanup(NULL, cms, &fh);
+            return -1;
+        }
+        double query_start = MPI_Wtime();
+        if (query_file_run(cms, opts.query_file, opts.query_output, &opts.read_config, &opts.key_format,
+                           opts.n_threads, MPI_COMM_WORLD, &query_stats) == -1) {
+            topk_free(topk);
+            cms_hier_free(hier);
+            safe_cleanup(NULL, cms, &fh);
+            return -1;
+        }
+        double query_time = MPI_Wtime() - query_start;
+        profile_end(&profile, PROFILE_QUERY);
+        MPI_Reduce(&query_time, &max_query_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
+
+    // Save the global sketch, each rank writing a slice of the table
+    if (opts.checkpoint_file) {
+        profile_begin(&profile, PROFILE_WRITE);
+        int replicated = (opts.reduce_mode == CMS_REDUCE_ALL || opts.query_file != NULL);
+        if (cms_file_write_all(cms, total_keys, opts.checkpoint_file, replicated, 0, io_info, MPI_COMM_WORLD) == -1) {
+            topk_free(topk);
+            cms_hier_free(hier);
+            safe_cleanup(NULL, cms, &fh);
+            return -1;
+        }
+        profile_end(&profile, PROFILE_WRITE);
+    }
+
+    profile_add(&profile, PROFILE_TOTAL, MPI_Wtime() - start_time);
+
+    // Debugging prints
+    printf("Rank %d processed %lld addresses in %lld chunks, idle %.6f s.\n", rank, total_read, n_chunks, idle_time);
+    if (rank == 0) {
+        printf("Sketch %d x %d, %s-bit counters%s, hash %s (seed %llu), kernel %s%s, update %s\n",
+               cms->depth, cms->width, cms_counter_width_name(cms->counters), cms->conservative ? " (conservative)" : "",
+               cms_hash_family_name(cms->hash_family), (unsigned long long)cms->seed, cms_kernel_name(cms->kernel),
+               cms->specialized ? " (specialized)" : "", cms_update_mode_name(cms->update_mode));
+        if (opts.reader == READER_MPIIO)
+            printf("I/O pipeline: %s, %d buffer(s) of %lld bytes, exposed I/O %.6f s, overlap %.1f%%\n",
+                   opts.read_config.collective ? "collective" : "independent", opts.read_config.n_buffers,
+                   (long long)opts.read_config.chunk_size, profile.values[PROFILE_READ], 100.0 * io_overlap);
+        else
+            printf("I/O reader: %s, chunks of %lld bytes, exposed I/O %.6f s\n",
+                   reader_backend_name(opts.reader), (long long)opts.read_config.chunk_size, profile.values[PROFILE_READ]);
+        char keys_text[64];
+        key_format_describe(&opts.key_format, keys_text, sizeof(keys_text));
+        printf("Keys: %s, %d-byte records from byte %lld\n", keys_text, record_size, (long long)data_offset);
+        CmsMemStats mem;
+        cms_mem_stats(&mem);
+        printf("Memory: %s pages, %.1f MiB transparent / %.1f MiB reserved huge pages, %llu blocks (%llu from the pool)\n",
+               cms_page_mode_name(opts.pages), mem.thp_bytes / (1024.0 * 1024.0), mem.hugetlb_bytes / (1024.0 * 1024.0),
+               mem.allocations, mem.pool_hits);
+        printf("Schedule %s: max idle time %.6f s\n", schedule_mode_name(opts.schedule), max_idle_time);
+        printf("Reduction (%s): intra-node %.6f s, inter-node %.6f s\n",
+               cms_reduce_mode_name(opts.reduce_mode), reduce_timing.intra_time, reduce_timing.inter_time);
+        if (opts.restore_file)
+            printf("Restored: %s, %llu keys\n", opts.restore_file, (unsigned long long)restored_keys);
+        if (opts.checkpoint_file)
+            printf("Checkpoint: %s, %.1f MiB, %llu keys, written in %.6f s\n", opts.checkpoint_file,
+                   cms_table_bytes(cms) / (1024.0 * 1024.0), (unsigned long long)total_keys, profile.values[PROFILE_WRITE]);
+        if (topk) {
+            TopKEntry *top = malloc(topk->capacity * sizeof(TopKEntry));
+            if (top != NULL) {
+                int n_top = topk_sorted(topk, top);
+                if (n_top > opts.topk)
+                    n_top = opts.topk;
+                printf("Top %d addresses (merge %.6f s):\n", n_top, topk_time);
+                for (int i = 0; i < n_top; i++)
+                    printf("  %u.%u.%u.%u %llu\n", top[i].key >> 24, (top[i].key >> 16) & 0xFF,
+                           (top[i].key >> 8) & 0xFF, top[i].key & 0xFF, (unsigned long long)top[i].count);
+                free(top);
+            }
+        }
+        if (hier)
+            report_hierarchy(hier, &opts, total_keys);
+        if (opts.query_file)
+            printf("Queries: %lld in %.6f s (%.0f queries/s), kernel %s, read %.6f s, query %.6f s, write %.6f s\n",
+                   (long long)query_stats.total_queries, max_query_time,
+                   max_query_time > 0.0 ? query_stats.total_queries / max_query_time : 0.0,
+                   cms_kernel_name(cms->kernel), query_stats.read_time, query_stats.query_time,
+                   query_stats.write_time);
+        if (opts.n_threads > 0)
+            printf("Throughput (hybrid-%s, %d ranks x %d threads): %.0f keys/s\n",
+                   cms_thread_strategy_name(opts.thread_strategy), comm_sz, opts.n_threads,
+                   total_addresses / max_ingest_time);
+        else
+            printf("Throughput (mpi, %d ranks): %.0f keys/s\n", comm_sz, total_addresses / max_ingest_time);
+    }
+
+    // Per-phase times of all the ranks, appended to the output file
+    int result = report_profile(&profile, &opts, opts.n_threads > 0 ? "hybrid" : "mpi", (long long)total_addresses,
+                                rank, comm_sz);
+
     // Cleanup allocated resources
-    safe_cleanup(buffer, cms, &fh);
-    return 0;
+    if (io_info != MPI_INFO_NULL)
+        MPI_Info_free(&io_info);
+    topk_free(topk);
+    cms_hier_free(hier);
+    safe_cleanup(NULL, cms, &fh);
+    cms_mem_pool_release();
+    return result;
 }
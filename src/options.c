@@ -0,0 +1,473 @@
+#include "headers/options.h"
+#include <errno.h>
+
+/*
+    Print the command-line usage of the program
+*/
+void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <input_file> <output_file> <epsilon> <delta> [options]\n", prog);
+    fprintf(stderr, "       %s <-|fifo|unix:socket> <output_file> <epsilon> <delta> --stream [options]\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --key=ipv4|ipv6|record:SIZE[:OFFSET:WIDTH]  input records, keys wider than 4 bytes are digested\n");
+    fprintf(stderr, "                                      (default: the key header of the file, else ipv4)\n");
+    fprintf(stderr, "  --reduce=reduce|allreduce|scatter|hier   how the rank sketches are combined (default: reduce)\n");
+    fprintf(stderr, "  --reader=mpiio|mmap|pread           input backend, mmap/pread for single-node runs (default: mpiio)\n");
+    fprintf(stderr, "  --schedule=static|dynamic           fixed rank ranges, or chunks claimed from a shared counter (default: static)\n");
+    fprintf(stderr, "  --buffers=N                         read buffers, N-1 chunks prefetched during compute (default: 2, 1 = blocking)\n");
+    fprintf(stderr, "  --chunk-size=BYTES[K|M]             bytes read per chunk, multiple of %d (default: %d)\n", IP_SIZE, BUFFER_SIZE);
+    fprintf(stderr, "  --io=independent|collective         independent MPI_File_iread_at or collective MPI_File_iread_at_all (default: independent)\n");
+    fprintf(stderr, "  --cb-buffer-size=V --cb-nodes=V --romio-cb-read=V --striping-factor=V --striping-unit=V\n");
+    fprintf(stderr, "  --hint=KEY=VALUE                    MPI-IO hints passed to MPI_File_open and the file view\n");
+    fprintf(stderr, "  --threads=N                         hybrid mode: N threads update one sketch per rank (default: 0, pure MPI)\n");
+    fprintf(stderr, "  --thread-update=atomic|striped      how the threads share the sketch (default: atomic)\n");
+    fprintf(stderr, "  --hash=modprime|multishift|mersenne hash family of the sketch rows (default: modprime)\n");
+    fprintf(stderr, "  --seed=N|random                     seed of the hash parameters, random = drawn by rank 0 (default: %d)\n", CMS_DEFAULT_SEED);
+    fprintf(stderr, "  --kernel=auto|scalar|avx2|avx512    batch update kernel (default: auto, by CPU features)\n");
+    fprintf(stderr, "  --update=auto|direct|prefetch|partition  cache strategy of the update (default: auto, by table size)\n");
+    fprintf(stderr, "  --pages=auto|small|hugetlb          pages of the tables and read buffers, auto = transparent huge pages (default: auto)\n");
+    fprintf(stderr, "  --specialize=on|off                 fixed-depth update/query kernels for depth <= 8 (default: on)\n");
+    fprintf(stderr, "  --query=FILE --query-output=FILE    estimate the keys of FILE (input format) with the global sketch, as uint64s\n");
+    fprintf(stderr, "  --topk=K                            track and print the K most frequent addresses (default: 0)\n");
+    fprintf(stderr, "  --hierarchy=8,16,24|dyadic[:BITS]   also count the address prefixes of these lengths (default: none)\n");
+    fprintf(stderr, "  --hierarchy-epsilon=E               error of a prefix query on a sketched level (default: epsilon)\n");
+    fprintf(stderr, "  --range=CIDR|FIRST-LAST[,...]       estimate the addresses of these prefixes/ranges (needs --hierarchy)\n");
+    fprintf(stderr, "  --hhh=PHI                           print the hierarchical heavy hitters above PHI * keys (needs --hierarchy)\n");
+    fprintf(stderr, "  --counters=8|16|32|64               counter width, 8/16-bit cells saturate into an overflow table (default: 32)\n");
+    fprintf(stderr, "  --conservative=on|off               conservative update, only the minimal cells are incremented (default: off)\n");
+    fprintf(stderr, "  --checkpoint=FILE                   save the global sketch to FILE (collective write, mmap-able format)\n");
+    fprintf(stderr, "  --restore=FILE                      start from the sketch saved in FILE, with its parameters\n");
+    fprintf(stderr, "  --profile=FILE                      write the per-phase, per-rank measures of the run to FILE as JSON\n");
+    fprintf(stderr, "  --stream                            read an unbounded stream on rank 0 and distribute it to the other ranks\n");
+    fprintf(stderr, "  --stream-batch=N                    keys per batch sent to a worker (default: 262144)\n");
+    fprintf(stderr, "  --stream-queue=N                    batches in flight per worker (default: 4)\n");
+    fprintf(stderr, "  --window=N                          stream mode: count only the last N merge intervals (default: 0, whole stream)\n");
+    fprintf(stderr, "  --window-query=N                    with --window: --query estimates the last N epochs (default: 0, whole window)\n");
+    fprintf(stderr, "  --merge-interval=SECONDS            time between two merges of the worker sketches (default: 5)\n");
+}
+
+/*
+    Parse a floating point argument, rejecting anything that is not a number.
+    Returns 0 on success, -1 on error.
+*/
+static int parse_double(const char *name, const char *value, double *out) {
+    char *endptr;
+    *out = strtod(value, &endptr);
+    if (endptr == value || *endptr != '\0') {
+        fprintf(stderr, "Invalid %s: '%s' (not a number)\n", name, value);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Parse an integer argument in [min, max].
+    Returns 0 on success, -1 on error.
+*/
+static int parse_long(const char *name, const char *value, long min, long max, long *out) {
+    char *endptr;
+    long n = strtol(value, &endptr, 10);
+    if (endptr == value || *endptr != '\0' || n < min || n > max) {
+        fprintf(stderr, "Invalid %s: '%s'\n", name, value);
+        return -1;
+    }
+    *out = n;
+    return 0;
+}
+
+/*
+    Parse a size in bytes with an optional K or M suffix.
+    Returns 0 on success, -1 on error.
+*/
+static int parse_size(const char *value, MPI_Offset *out) {
+    char *endptr;
+    long long size = strtoll(value, &endptr, 10);
+    if (endptr == value || size <= 0)
+        return -1;
+    if (*endptr == 'K' || *endptr == 'k') {
+        size *= 1024LL;
+        endptr++;
+    } else if (*endptr == 'M' || *endptr == 'm') {
+        size *= 1024LL * 1024LL;
+        endptr++;
+    }
+    if (*endptr != '\0')
+        return -1;
+    *out = (MPI_Offset)size;
+    return 0;
+}
+
+/*
+    Append an MPI-IO hint to opts. Returns 0 on success, -1 on error.
+*/
+static int add_io_hint(RunOptions *opts, const char *key, const char *value) {
+    if (opts->n_io_hints == MAX_IO_HINTS) {
+        fprintf(stderr, "Too many MPI-IO hints (max %d)\n", MAX_IO_HINTS);
+        return -1;
+    }
+    if (strlen(key) >= sizeof(opts->io_hints[0].key) || strlen(value) >= sizeof(opts->io_hints[0].value) ||
+        key[0] == '\0' || value[0] == '\0') {
+        fprintf(stderr, "Invalid MPI-IO hint: '%s=%s'\n", key, value);
+        return -1;
+    }
+    IoHint *hint = &opts->io_hints[opts->n_io_hints++];
+    strcpy(hint->key, key);
+    strcpy(hint->value, value);
+    return 0;
+}
+
+/*
+    Parse the command line into opts.
+    Returns 0 on success, -1 if the arguments are not valid
+    (an error message has already been printed).
+*/
+int parse_options(int argc, char **argv, RunOptions *opts) {
+    // Check the validity of command-line arguments
+    if (argc < 5) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    opts->input_file = argv[1];
+    opts->output_file = argv[2];
+    opts->profile_file = NULL;
+    key_format_default(&opts->key_format);
+    opts->key_from_cli = 0;
+    opts->reduce_mode = CMS_REDUCE_ROOT;
+    opts->n_threads = 0;
+    opts->reader = READER_MPIIO;
+    opts->schedule = SCHEDULE_STATIC;
+    read_config_default(&opts->read_config);
+    opts->n_io_hints = 0;
+    opts->thread_strategy = CMS_THREADS_ATOMIC;
+    cms_config_default(&opts->cms_config);
+    opts->pages = CMS_PAGES_AUTO;
+    opts->query_file = NULL;
+    opts->query_output = NULL;
+    opts->topk = 0;
+    opts->hierarchy.n_levels = 0;
+    opts->hierarchy.epsilon = 0.0;
+    opts->ranges = NULL;
+    opts->hhh_phi = 0.0;
+    opts->checkpoint_file = NULL;
+    opts->random_seed = 0;
+    opts->restore_file = NULL;
+    opts->stream = 0;
+    opts->window_epochs = 0;
+    opts->window_query = 0;
+    stream_config_default(&opts->stream_config);
+
+    if (access(opts->output_file, F_OK) == -1) {
+        fprintf(stderr, "Output file %s does not exist.\n", opts->output_file);
+        return -1;
+    }
+
+    /* Parse and validate epsilon and delta */
+    if (parse_double("epsilon", argv[3], &opts->epsilon) == -1)
+        return -1;
+    if (parse_double("delta", argv[4], &opts->delta) == -1)
+        return -1;
+
+    /* Optional switches */
+    for (int i = 5; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--key=", 6) == 0) {
+            if (key_format_parse(arg + 6, &opts->key_format) == -1) {
+                fprintf(stderr, "Invalid key format: '%s' (ipv4|ipv6|record:SIZE[:OFFSET:WIDTH])\n", arg + 6);
+                return -1;
+            }
+            opts->key_from_cli = 1;
+        } else if (strncmp(arg, "--reduce=", 9) == 0) {
+            if (cms_reduce_mode_parse(arg + 9, &opts->reduce_mode) == -1) {
+                fprintf(stderr, "Invalid reduction mode: '%s'\n", arg + 9);
+                return -1;
+            }
+        } else if (strncmp(arg, "--reader=", 9) == 0) {
+            if (reader_backend_parse(arg + 9, &opts->reader) == -1) {
+                fprintf(stderr, "Invalid reader: '%s'\n", arg + 9);
+                return -1;
+            }
+        } else if (strncmp(arg, "--schedule=", 11) == 0) {
+            if (schedule_mode_parse(arg + 11, &opts->schedule) == -1) {
+                fprintf(stderr, "Invalid schedule: '%s'\n", arg + 11);
+                return -1;
+            }
+        } else if (strncmp(arg, "--buffers=", 10) == 0) {
+            char *endptr;
+            long n = strtol(arg + 10, &endptr, 10);
+            if (endptr == arg + 10 || *endptr != '\0' || n < 1 || n > 64) {
+                fprintf(stderr, "Invalid number of buffers: '%s'\n", arg + 10);
+                return -1;
+            }
+            opts->read_config.n_buffers = (int)n;
+        } else if (strncmp(arg, "--chunk-size=", 13) == 0) {
+            MPI_Offset size;
+            if (parse_size(arg + 13, &size) == -1 || size % IP_SIZE != 0 || size > 1073741824LL) {
+                fprintf(stderr, "Invalid chunk size: '%s' (multiple of %d, at most 1G)\n", arg + 13, IP_SIZE);
+                return -1;
+            }
+            opts->read_config.chunk_size = size;
+        } else if (strncmp(arg, "--io=", 5) == 0) {
+            if (strcmp(arg + 5, "independent") == 0)
+                opts->read_config.collective = 0;
+            else if (strcmp(arg + 5, "collective") == 0)
+                opts->read_config.collective = 1;
+            else {
+                fprintf(stderr, "Invalid I/O mode: '%s'\n", arg + 5);
+                return -1;
+            }
+        } else if (strncmp(arg, "--cb-buffer-size=", 17) == 0) {
+            if (add_io_hint(opts, "cb_buffer_size", arg + 17) == -1)
+                return -1;
+        } else if (strncmp(arg, "--cb-nodes=", 11) == 0) {
+            if (add_io_hint(opts, "cb_nodes", arg + 11) == -1)
+                return -1;
+        } else if (strncmp(arg, "--romio-cb-read=", 16) == 0) {
+            if (add_io_hint(opts, "romio_cb_read", arg + 16) == -1)
+                return -1;
+        } else if (strncmp(arg, "--striping-factor=", 18) == 0) {
+            if (add_io_hint(opts, "striping_factor", arg + 18) == -1)
+                return -1;
+        } else if (strncmp(arg, "--striping-unit=", 16) == 0) {
+            if (add_io_hint(opts, "striping_unit", arg + 16) == -1)
+                return -1;
+        } else if (strncmp(arg, "--hint=", 7) == 0) {
+            char key[64];
+            const char *eq = strchr(arg + 7, '=');
+            if (eq == NULL || (size_t)(eq - (arg + 7)) >= sizeof(key)) {
+                fprintf(stderr, "Invalid MPI-IO hint: '%s' (KEY=VALUE)\n", arg + 7);
+                return -1;
+            }
+            memcpy(key, arg + 7, eq - (arg + 7));
+            key[eq - (arg + 7)] = '\0';
+            if (add_io_hint(opts, key, eq + 1) == -1)
+                return -1;
+        } else if (strncmp(arg, "--threads=", 10) == 0) {
+            char *endptr;
+            long n = strtol(arg + 10, &endptr, 10);
+            if (endptr == arg + 10 || *endptr != '\0' || n < 0 || n > 4096) {
+                fprintf(stderr, "Invalid number of threads: '%s'\n", arg + 10);
+                return -1;
+            }
+            opts->n_threads = (int)n;
+        } else if (strncmp(arg, "--thread-update=", 16) == 0) {
+            if (cms_thread_strategy_parse(arg + 16, &opts->thread_strategy) == -1) {
+                fprintf(stderr, "Invalid thread update strategy: '%s'\n", arg + 16);
+                return -1;
+            }
+        } else if (strncmp(arg, "--hash=", 7) == 0) {
+            if (cms_hash_family_parse(arg + 7, &opts->cms_config.hash_family) == -1) {
+                fprintf(stderr, "Invalid hash family: '%s'\n", arg + 7);
+                return -1;
+            }
+        } else if (strncmp(arg, "--kernel=", 9) == 0) {
+            if (cms_kernel_parse(arg + 9, &opts->cms_config.kernel) == -1) {
+                fprintf(stderr, "Invalid kernel: '%s'\n", arg + 9);
+                return -1;
+            }
+        } else if (strncmp(arg, "--update=", 9) == 0) {
+            if (cms_update_mode_parse(arg + 9, &opts->cms_config.update_mode) == -1) {
+                fprintf(stderr, "Invalid update mode: '%s'\n", arg + 9);
+                return -1;
+            }
+        } else if (strncmp(arg, "--pages=", 8) == 0) {
+            if (cms_page_mode_parse(arg + 8, &opts->pages) == -1) {
+                fprintf(stderr, "Invalid page mode: '%s' (auto|small|hugetlb)\n", arg + 8);
+                return -1;
+            }
+        } else if (strncmp(arg, "--specialize=", 13) == 0) {
+            if (strcmp(arg + 13, "on") == 0)
+                opts->cms_config.specialize = 1;
+            else if (strcmp(arg + 13, "off") == 0)
+                opts->cms_config.specialize = 0;
+            else {
+                fprintf(stderr, "Invalid specialize value: '%s' (on|off)\n", arg + 13);
+                return -1;
+            }
+        } else if (strncmp(arg, "--seed=", 7) == 0) {
+            char *endptr;
+            if (strcmp(arg + 7, "random") == 0) {
+                opts->random_seed = 1;
+            } else {
+                errno = 0;
+                opts->cms_config.seed = strtoull(arg + 7, &endptr, 0);
+                opts->random_seed = 0;
+                if (endptr == arg + 7 || *endptr != '\0' || arg[7] == '-' || errno == ERANGE) {
+                    fprintf(stderr, "Invalid seed: '%s' (unsigned 64-bit integer or random)\n", arg + 7);
+                    return -1;
+                }
+            }
+        } else if (strncmp(arg, "--counters=", 11) == 0) {
+            if (cms_counter_width_parse(arg + 11, &opts->cms_config.counters) == -1) {
+                fprintf(stderr, "Invalid counter width: '%s' (8|16|32|64)\n", arg + 11);
+                return -1;
+            }
+        } else if (strncmp(arg, "--conservative=", 15) == 0) {
+            if (strcmp(arg + 15, "on") == 0)
+                opts->cms_config.conservative = 1;
+            else if (strcmp(arg + 15, "off") == 0)
+                opts->cms_config.conservative = 0;
+            else {
+                fprintf(stderr, "Invalid conservative value: '%s' (on|off)\n", arg + 15);
+                return -1;
+            }
+        } else if (strncmp(arg, "--query=", 8) == 0) {
+            opts->query_file = arg + 8;
+        } else if (strncmp(arg, "--query-output=", 15) == 0) {
+            opts->query_output = arg + 15;
+        } else if (strncmp(arg, "--topk=", 7) == 0) {
+            long n;
+            if (parse_long("top-k size", arg + 7, 0, 1000000, &n) == -1)
+                return -1;
+            opts->topk = (int)n;
+        } else if (strncmp(arg, "--hierarchy=", 12) == 0) {
+            if (cms_hier_levels_parse(arg + 12, &opts->hierarchy) == -1) {
+                fprintf(stderr, "Invalid prefix levels: '%s' (increasing lengths in [1, 31], dyadic or dyadic:BITS)\n",
+                        arg + 12);
+                return -1;
+            }
+        } else if (strncmp(arg, "--hierarchy-epsilon=", 20) == 0) {
+            if (parse_double("hierarchy epsilon", arg + 20, &opts->hierarchy.epsilon) == -1)
+                return -1;
+            if (opts->hierarchy.epsilon <= 0.0 || opts->hierarchy.epsilon >= 1.0) {
+                fprintf(stderr, "Invalid hierarchy epsilon: '%s' (in (0, 1))\n", arg + 20);
+                return -1;
+            }
+        } else if (strncmp(arg, "--range=", 8) == 0) {
+            opts->ranges = arg + 8;
+        } else if (strncmp(arg, "--hhh=", 6) == 0) {
+            if (parse_double("heavy hitter fraction", arg + 6, &opts->hhh_phi) == -1)
+                return -1;
+            if (opts->hhh_phi <= 0.0 || opts->hhh_phi > 1.0) {
+                fprintf(stderr, "Invalid heavy hitter fraction: '%s' (in (0, 1])\n", arg + 6);
+                return -1;
+            }
+        } else if (strncmp(arg, "--checkpoint=", 13) == 0) {
+            opts->checkpoint_file = arg + 13;
+        } else if (strncmp(arg, "--restore=", 10) == 0) {
+            opts->restore_file = arg + 10;
+        } else if (strncmp(arg, "--profile=", 10) == 0) {
+            opts->profile_file = arg + 10;
+        } else if (strcmp(arg, "--stream") == 0) {
+            opts->stream = 1;
+        } else if (strncmp(arg, "--stream-batch=", 15) == 0) {
+            long n;
+            if (parse_long("stream batch", arg + 15, 1, 16777216, &n) == -1)
+                return -1;
+            opts->stream_config.batch_keys = (size_t)n;
+        } else if (strncmp(arg, "--stream-queue=", 15) == 0) {
+            long n;
+            if (parse_long("stream queue depth", arg + 15, 1, 1024, &n) == -1)
+                return -1;
+            opts->stream_config.queue_depth = (int)n;
+        } else if (strncmp(arg, "--window=", 9) == 0) {
+            long n;
+            if (parse_long("window length", arg + 9, 0, 4096, &n) == -1)
+                return -1;
+            opts->window_epochs = (int)n;
+        } else if (strncmp(arg, "--window-query=", 15) == 0) {
+            long n;
+            if (parse_long("window query length", arg + 15, 0, 4096, &n) == -1)
+                return -1;
+            opts->window_query = (int)n;
+        } else if (strncmp(arg, "--merge-interval=", 17) == 0) {
+            double seconds;
+            if (parse_double("merge interval", arg + 17, &seconds) == -1)
+                return -1;
+            if (seconds <= 0.0) {
+                fprintf(stderr, "Invalid merge interval: '%s' (must be positive)\n", arg + 17);
+                return -1;
+            }
+            opts->stream_config.merge_interval = seconds;
+        } else {
+            fprintf(stderr, "Unknown option: '%s'\n", arg);
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    // A stream source is only opened at run time (stdin, FIFO writer, socket listener)
+    if (!opts->stream && access(opts->input_file, F_OK) == -1) {
+        fprintf(stderr, "Input file %s does not exist.\n", opts->input_file);
+        return -1;
+    }
+    if (opts->window_epochs > 0 && !opts->stream) {
+        fprintf(stderr, "--window requires --stream\n");
+        return -1;
+    }
+    if (opts->n_threads > 0 && (opts->cms_config.counters != CMS_COUNTER_32 || opts->cms_config.conservative)) {
+        fprintf(stderr, "--threads requires 32-bit counters and the standard update\n");
+        return -1;
+    }
+    if (opts->window_epochs > 0 && opts->cms_config.counters != CMS_COUNTER_32) {
+        fprintf(stderr, "--window requires 32-bit counters\n");
+        return -1;
+    }
+    if ((opts->query_file == NULL) != (opts->query_output == NULL)) {
+        fprintf(stderr, "--query and --query-output must be given together\n");
+        return -1;
+    }
+    if (opts->query_file && access(opts->query_file, F_OK) == -1) {
+        fprintf(stderr, "Query file %s does not exist.\n", opts->query_file);
+        return -1;
+    }
+    if (opts->query_file && opts->stream && opts->window_epochs == 0) {
+        fprintf(stderr, "--query is only available in stream mode with --window\n");
+        return -1;
+    }
+    if (opts->window_query > opts->window_epochs) {
+        fprintf(stderr, "--window-query cannot exceed --window (%d epochs)\n", opts->window_epochs);
+        return -1;
+    }
+    if (opts->restore_file && access(opts->restore_file, F_OK) == -1) {
+        fprintf(stderr, "Sketch file %s does not exist.\n", opts->restore_file);
+        return -1;
+    }
+    if (opts->restore_file && opts->stream) {
+        fprintf(stderr, "--restore is not available in stream mode\n");
+        return -1;
+    }
+    if (opts->checkpoint_file && opts->window_epochs > 0) {
+        fprintf(stderr, "--checkpoint is not available with --window\n");
+        return -1;
+    }
+    if (opts->key_from_cli && opts->stream) {
+        fprintf(stderr, "--key is not available in stream mode (IPv4 only)\n");
+        return -1;
+    }
+    if (opts->topk > 0 && opts->stream) {
+        fprintf(stderr, "--topk is not available in stream mode\n");
+        return -1;
+    }
+    if ((opts->ranges || opts->hhh_phi > 0.0) && opts->hierarchy.n_levels == 0) {
+        fprintf(stderr, "--range and --hhh require --hierarchy\n");
+        return -1;
+    }
+    if (opts->ranges) {
+        // Check every range now, rank 0 parses them again for the queries
+        const char *list = opts->ranges;
+        char spec[CMS_HIER_RANGE_TEXT];
+        uint32_t lo, hi;
+        int status;
+        while ((status = cms_hier_ranges_next(&list, spec, &lo, &hi)) == 1)
+            ;
+        if (status == -1) {
+            fprintf(stderr, "Invalid range: '%s' (a.b.c.d/len or a.b.c.d-e.f.g.h)\n", spec);
+            return -1;
+        }
+    }
+    if (opts->hierarchy.n_levels > 0) {
+        if (opts->hierarchy.epsilon == 0.0)
+            opts->hierarchy.epsilon = opts->epsilon;
+        // The levels are updated with the base sketch by the single-threaded batch path
+        if (opts->stream || opts->n_threads > 0 || opts->restore_file) {
+            fprintf(stderr, "--hierarchy is not available with --stream, --threads or --restore\n");
+            return -1;
+        }
+    }
+    if (opts->schedule == SCHEDULE_DYNAMIC && opts->read_config.collective) {
+        // Collective reads need the same number of reads on every rank
+        fprintf(stderr, "--schedule=dynamic requires --io=independent\n");
+        return -1;
+    }
+    opts->stream_config.reduce_mode = opts->reduce_mode;
+    return 0;
+}
@@ -0,0 +1,234 @@
+#include "headers/profile.h"
+
+#define PROFILE_HEADER_SIZE 4096
+
+const char *profile_metric_name(profile_metric metric) {
+    switch (metric) {
+        case PROFILE_OPEN:       return "open";
+        case PROFILE_READ:       return "read";
+        case PROFILE_UPDATE:     return "update";
+        case PROFILE_IDLE:       return "idle";
+        case PROFILE_REDUCE:     return "reduce";
+        case PROFILE_QUERY:      return "query";
+        case PROFILE_WRITE:      return "write";
+        case PROFILE_TOTAL:      return "total";
+        case PROFILE_BYTES_READ: return "bytes_read";
+        case PROFILE_KEYS:       return "keys";
+        case PROFILE_N_METRICS:  break;
+    }
+    return "unknown";
+}
+
+void profile_init(RankProfile *profile) {
+    memset(profile, 0, sizeof(*profile));
+}
+
+/*
+    Time a phase: the time between profile_begin and profile_end is added
+    to the phase, which can be timed several times
+*/
+void profile_begin(RankProfile *profile, profile_metric phase) {
+    profile->started[phase] = MPI_Wtime();
+}
+
+void profile_end(RankProfile *profile, profile_metric phase) {
+    profile->values[phase] += MPI_Wtime() - profile->started[phase];
+}
+
+void profile_add(RankProfile *profile, profile_metric metric, double value) {
+    profile->values[metric] += value;
+}
+
+/*
+    Gather the measures of every rank on root and compute, for each
+    metric, its minimum, mean, maximum and standard deviation over the
+    ranks. Collective over comm. Returns 0 on success, -1 on error
+    (on every rank).
+*/
+int profile_gather(const RankProfile *profile, int root, MPI_Comm comm, ProfileSummary *summary) {
+    int rank, comm_sz;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_sz);
+    memset(summary, 0, sizeof(*summary));
+
+    int ok = 1;
+    if (rank == root) {
+        summary->per_rank = malloc((size_t)comm_sz * PROFILE_N_METRICS * sizeof(double));
+        if (summary->per_rank == NULL) {
+            fprintf(stderr, "Error: failed to allocate the measures of %d ranks\n", comm_sz);
+            ok = 0;
+        }
+    }
+    // The other ranks must not enter the gather if the root cannot receive
+    MPI_Bcast(&ok, 1, MPI_INT, root, comm);
+    if (!ok)
+        return -1;
+    MPI_Gather(profile->values, PROFILE_N_METRICS, MPI_DOUBLE, summary->per_rank, PROFILE_N_METRICS,
+               MPI_DOUBLE, root, comm);
+    if (rank != root)
+        return 0;
+
+    summary->n_ranks = comm_sz;
+    for (int m = 0; m < PROFILE_N_METRICS; m++) {
+        ProfileStat *stat = &summary->stats[m];
+        double sum = 0.0;
+        stat->min = stat->max = summary->per_rank[m];
+        for (int r = 0; r < comm_sz; r++) {
+            double v = summary->per_rank[(size_t)r * PROFILE_N_METRICS + m];
+            sum += v;
+            if (v < stat->min)
+                stat->min = v;
+            if (v > stat->max)
+                stat->max = v;
+        }
+        stat->avg = sum / comm_sz;
+        double var = 0.0;
+        for (int r = 0; r < comm_sz; r++) {
+            double d = summary->per_rank[(size_t)r * PROFILE_N_METRICS + m] - stat->avg;
+            var += d * d;
+        }
+        stat->stddev = sqrt(var / comm_sz);
+    }
+    return 0;
+}
+
+void profile_summary_free(ProfileSummary *summary) {
+    free(summary->per_rank);
+    summary->per_rank = NULL;
+}
+
+/*
+    Table of the phase times over the ranks; max/avg is the load imbalance
+*/
+void profile_print(const ProfileSummary *summary, FILE *out) {
+    fprintf(out, "Phases over %d ranks (s):   min        avg        max     stddev  max/avg\n", summary->n_ranks);
+    for (int m = 0; m <= PROFILE_TOTAL; m++) {
+        const ProfileStat *stat = &summary->stats[m];
+        if (stat->max == 0.0)
+            continue;
+        fprintf(out, "  %-22s %10.6f %10.6f %10.6f %10.6f %8.2f\n", profile_metric_name(m),
+                stat->min, stat->avg, stat->max, stat->stddev, stat->avg > 0.0 ? stat->max / stat->avg : 0.0);
+    }
+}
+
+/*
+    CSV header of the current schema
+*/
+static void csv_header(char *header, size_t size) {
+    int n = snprintf(header, size, "schema_version,mode,n_processes,n_threads,dataset_size,execution_time");
+    for (int m = 0; m < PROFILE_N_METRICS; m++) {
+        const char *name = profile_metric_name(m);
+        n += snprintf(header + n, size - n, ",%s_min,%s_avg,%s_max,%s_stddev", name, name, name, name);
+    }
+}
+
+/*
+    Append the execution record of the run to a CSV file, one line per run:
+        schema_version,mode,n_processes,n_threads,dataset_size,execution_time,
+        then <metric>_min,<metric>_avg,<metric>_max,<metric>_stddev for every
+        metric of profile_metric (times in seconds).
+    execution_time is the wall time of the slowest rank. The header is
+    written to an empty file; a file that starts with another header (an
+    older schema) is left untouched. Only called by the root of
+    profile_gather. Returns 0 on success, -1 on error.
+*/
+int profile_write_csv(const char *filename, const ProfileRun *run, const ProfileSummary *summary) {
+    char header[PROFILE_HEADER_SIZE];
+    char first_line[PROFILE_HEADER_SIZE];
+    csv_header(header, sizeof(header));
+
+    FILE *fp = fopen(filename, "a+");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return -1;
+    }
+    // Lock the file for exclusive access, several runs may share it
+    if (flock(fileno(fp), LOCK_EX) == -1) {
+        fprintf(stderr, "Failed to lock file\n");
+        fclose(fp);
+        return -1;
+    }
+
+    int result = 0;
+    rewind(fp);
+    int empty = (fgets(first_line, sizeof(first_line), fp) == NULL);
+    // A write that follows a read needs a repositioning, append mode then writes at the end
+    fseek(fp, 0, SEEK_END);
+    if (empty) {
+        fprintf(fp, "%s\n", header);
+    } else {
+        first_line[strcspn(first_line, "\r\n")] = '\0';
+        if (strcmp(first_line, header) != 0) {
+            fprintf(stderr, "Error: %s does not have the header of schema version %d, start a new file "
+                    "(an empty file gets the header)\n", filename, PROFILE_SCHEMA_VERSION);
+            result = -1;
+        }
+    }
+
+    if (result == 0) {
+        fprintf(fp, "%d,%s,%d,%d,%lld,%.6f", PROFILE_SCHEMA_VERSION, run->mode, run->n_processes, run->n_threads,
+                run->dataset_size, summary->stats[PROFILE_TOTAL].max);
+        for (int m = 0; m < PROFILE_N_METRICS; m++) {
+            const ProfileStat *stat = &summary->stats[m];
+            if (m <= PROFILE_TOTAL)
+                fprintf(fp, ",%.6f,%.6f,%.6f,%.6f", stat->min, stat->avg, stat->max, stat->stddev);
+            else
+                fprintf(fp, ",%.0f,%.1f,%.0f,%.1f", stat->min, stat->avg, stat->max, stat->stddev);
+        }
+        if (fprintf(fp, "\n") < 0 || fflush(fp) != 0) {
+            fprintf(stderr, "Failed to write to file %s\n", filename);
+            result = -1;
+        }
+    }
+
+    // Release lock and close the file
+    flock(fileno(fp), LOCK_UN);
+    fclose(fp);
+    return result;
+}
+
+/*
+    Write the execution record as a JSON document: the same fields as the
+    CSV line, the max/avg imbalance of every metric and the raw measures
+    of every rank. The file is overwritten. Returns 0 on success, -1 on error.
+*/
+int profile_write_json(const char *filename, const ProfileRun *run, const ProfileSummary *summary) {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return -1;
+    }
+    fprintf(fp, "{\n  \"schema_version\": %d,\n  \"mode\": \"%s\",\n  \"n_processes\": %d,\n  \"n_threads\": %d,\n",
+            PROFILE_SCHEMA_VERSION, run->mode, run->n_processes, run->n_threads);
+    fprintf(fp, "  \"dataset_size\": %lld,\n  \"execution_time\": %.6f,\n", run->dataset_size,
+            summary->stats[PROFILE_TOTAL].max);
+
+    fprintf(fp, "  \"metrics\": {\n");
+    for (int m = 0; m < PROFILE_N_METRICS; m++) {
+        const ProfileStat *stat = &summary->stats[m];
+        fprintf(fp, "    \"%s\": {\"min\": %.6f, \"avg\": %.6f, \"max\": %.6f, \"stddev\": %.6f, \"imbalance\": ",
+                profile_metric_name(m), stat->min, stat->avg, stat->max, stat->stddev);
+        if (stat->avg > 0.0)
+            fprintf(fp, "%.4f}", stat->max / stat->avg);
+        else
+            fprintf(fp, "null}");
+        fprintf(fp, "%s\n", m + 1 < PROFILE_N_METRICS ? "," : "");
+    }
+    fprintf(fp, "  },\n");
+
+    fprintf(fp, "  \"ranks\": [\n");
+    for (int r = 0; r < summary->n_ranks; r++) {
+        const double *values = summary->per_rank + (size_t)r * PROFILE_N_METRICS;
+        fprintf(fp, "    {\"rank\": %d", r);
+        for (int m = 0; m < PROFILE_N_METRICS; m++)
+            fprintf(fp, m <= PROFILE_TOTAL ? ", \"%s\": %.6f" : ", \"%s\": %.0f", profile_metric_name(m), values[m]);
+        fprintf(fp, "}%s\n", r + 1 < summary->n_ranks ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+
+    if (ferror(fp) || fclose(fp) != 0) {
+        fprintf(stderr, "Failed to write to file %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
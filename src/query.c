@@ -0,0 +1,136 @@
+#include "headers/query.h"
+#include "headers/hybrid.h"
+
+/*
+    Answer every query of a key file with the sketch.
+
+    The query file holds records of the input format keys (seeded with
+    the sketch, see key_format_seed) unless it starts with its own key
+    header, whose keys must then have the same width. It is split in
+    contiguous ranges among the ranks of comm, read with the collective
+    pipeline. The estimates are written to output_path as 64-bit unsigned
+    integers in host byte order, one per query and in the order of the
+    query file, with collective writes.
+    Every rank must hold the complete sketch. With n_threads > 0 each
+    chunk is answered by n_threads OpenMP threads.
+    Collective over comm. Returns 0 on success, -1 on error.
+*/
+int query_file_run(const CountMinSketch *cms, const char *query_path, const char *output_path,
+                   const ReadConfig *config, const KeyFormat *keys, int n_threads, MPI_Comm comm,
+                   QueryStats *stats) {
+    int rank, comm_sz;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_sz);
+    memset(stats, 0, sizeof(*stats));
+
+    KeyFormat query_keys = *keys;
+    MPI_Offset data_offset;
+    if (key_format_probe(query_path, 0, &query_keys, &data_offset) == -1)
+        return -1;
+    if (query_keys.key_width != keys->key_width) {
+        if (rank == 0)
+            fprintf(stderr, "Query file %s has %d-byte keys, the sketch counts %d-byte keys\n", query_path,
+                    query_keys.key_width, keys->key_width);
+        return -1;
+    }
+    // Same digest parameters as the input keys
+    memcpy(query_keys.secrets, keys->secrets, sizeof(query_keys.secrets));
+    query_keys.digest_init = keys->digest_init;
+
+    MPI_File qfh, ofh;
+    if (MPI_File_open(comm, query_path, MPI_MODE_RDONLY, config->info, &qfh) != MPI_SUCCESS) {
+        if (rank == 0)
+            fprintf(stderr, "Error opening query file %s\n", query_path);
+        return -1;
+    }
+    MPI_Offset file_size = 0;
+    MPI_File_get_size(qfh, &file_size);
+    if (file_size < data_offset || (file_size - data_offset) % query_keys.record_size != 0) {
+        if (rank == 0)
+            fprintf(stderr, "Query file size is not a multiple of the record size (%d bytes)\n",
+                    query_keys.record_size);
+        MPI_File_close(&qfh);
+        return -1;
+    }
+    if (MPI_File_open(comm, output_path, MPI_MODE_CREATE | MPI_MODE_WRONLY, config->info, &ofh) != MPI_SUCCESS) {
+        if (rank == 0)
+            fprintf(stderr, "Error opening query output file %s\n", output_path);
+        MPI_File_close(&qfh);
+        return -1;
+    }
+
+    // Same split as the input data
+    MPI_Offset total = (file_size - data_offset) / query_keys.record_size;
+    MPI_Offset base = total / comm_sz;
+    MPI_Offset remainder = total % comm_sz;
+    MPI_Offset start_index = (MPI_Offset)rank * base + (rank < remainder ? rank : remainder);
+    MPI_Offset n_local = base + (rank < remainder ? 1 : 0);
+    stats->total_queries = total;
+    MPI_File_set_size(ofh, total * (MPI_Offset)sizeof(uint64_t));
+
+    // Collective reads, so every rank takes part in the same number of collective writes
+    ReadConfig query_config = *config;
+    query_config.collective = 1;
+    query_config.scheduler = NULL;
+    query_config.record_size = query_keys.record_size;
+    query_config.data_offset = data_offset;
+    ReadPipeline pipe;
+    memset(&pipe, 0, sizeof(pipe));
+    const size_t chunk_records = (size_t)read_config_chunk_records(&query_config);
+    const size_t estimate_bytes = chunk_records * sizeof(uint64_t), key_bytes = chunk_records * IP_SIZE;
+    uint64_t *estimates = cms_mem_alloc(estimate_bytes, CMS_MEM_BUFFER);
+    uint8_t *key_buffer = key_format_native(&query_keys) ? NULL : cms_mem_alloc(key_bytes, CMS_MEM_BUFFER);
+    int error = (estimates == NULL || (key_buffer == NULL && !key_format_native(&query_keys)));
+    if (error)
+        fprintf(stderr, "Error: failed to allocate the query estimates on rank %d\n", rank);
+    // A rank that stops early would leave the others waiting in the collective calls
+    MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_LOR, comm);
+    if (!error) {
+        error = (read_pipeline_init(&pipe, qfh, comm, &query_config, start_index, n_local) == -1);
+        MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_LOR, comm);
+    }
+
+    uint8_t *records;
+    MPI_Offset count;
+    int status;
+    while (!error && (status = read_pipeline_next(&pipe, &records, &count)) != 0) {
+        int failed = (status == -1);
+        double start = MPI_Wtime();
+        if (failed) {
+            count = 0;  // Still takes part in the collective write, with nothing to write
+        } else {
+            uint8_t *batch = records;
+            if (key_buffer) {
+                if (n_threads > 0)
+                    key_extract_threaded(&query_keys, records, (size_t)count, key_buffer, n_threads);
+                else
+                    key_extract(&query_keys, records, (size_t)count, key_buffer);
+                batch = key_buffer;
+            }
+            if (n_threads > 0)
+                cms_threaded_batch_query(cms, batch, (size_t)count, estimates, n_threads);
+            else
+                cms_batch_query(cms, batch, (size_t)count, estimates);
+        }
+        double written = MPI_Wtime();
+        stats->query_time += written - start;
+
+        MPI_Offset offset = (start_index + stats->n_queries) * (MPI_Offset)sizeof(uint64_t);
+        if (MPI_File_write_at_all(ofh, offset, estimates, (int)count, MPI_UINT64_T, MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+            fprintf(stderr, "Error writing the query estimates on rank %d\n", rank);
+            failed = 1;
+        }
+        stats->write_time += MPI_Wtime() - written;
+        stats->n_queries += count;
+        // All the ranks stop together
+        MPI_Allreduce(&failed, &error, 1, MPI_INT, MPI_LOR, comm);
+    }
+    stats->read_time = pipe.exposed_time;
+
+    read_pipeline_free(&pipe);
+    cms_mem_free(estimates, estimate_bytes);
+    cms_mem_free(key_buffer, key_bytes);
+    MPI_File_close(&qfh);
+    MPI_File_close(&ofh);
+    return error ? -1 : 0;
+}
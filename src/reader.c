@@ -0,0 +1,244 @@
+#define _DEFAULT_SOURCE // madvise and MADV_HUGEPAGE
+#include "headers/reader.h"
+
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+/*
+    Convert the command-line name of a reader backend to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int reader_backend_parse(const char *name, reader_backend *backend) {
+    if (strcmp(name, "mpiio") == 0)
+        *backend = READER_MPIIO;
+    else if (strcmp(name, "mmap") == 0)
+        *backend = READER_MMAP;
+    else if (strcmp(name, "pread") == 0)
+        *backend = READER_PREAD;
+    else
+        return -1;
+    return 0;
+}
+
+const char *reader_backend_name(reader_backend backend) {
+    switch (backend) {
+        case READER_MPIIO: return "mpiio";
+        case READER_MMAP:  return "mmap";
+        case READER_PREAD: return "pread";
+    }
+    return "unknown";
+}
+
+/*
+    Size of the next chunk of the range
+*/
+static MPI_Offset reader_chunk_count(const InputReader *reader) {
+    MPI_Offset remaining = reader->n_addresses - reader->position;
+    return (remaining > reader->chunk_addresses) ? reader->chunk_addresses : remaining;
+}
+
+/*
+    First address and size of the next chunk: the following one of the
+    range, or the one claimed from the scheduler in dynamic mode.
+    Returns 1 if there is a chunk, 0 at the end.
+*/
+static int reader_next_range(InputReader *reader, MPI_Offset *first, MPI_Offset *count) {
+    if (reader->scheduler)
+        return chunk_scheduler_claim(reader->scheduler, first, count);
+    *first = reader->start_index + reader->position;
+    *count = reader_chunk_count(reader);
+    return *count > 0;
+}
+
+/* ---------------- MPI-IO backend ---------------- */
+
+static int mpiio_next(InputReader *reader, uint8_t **data, MPI_Offset *count) {
+    int status = read_pipeline_next(&reader->pipe, data, count);
+    reader->exposed_time = reader->pipe.exposed_time;
+    if (status == 1)
+        reader->position += *count;
+    return status;
+}
+
+static void mpiio_close(InputReader *reader) {
+    read_pipeline_free(&reader->pipe);
+}
+
+/* ---------------- mmap backend ---------------- */
+
+/*
+    Chunks are pointers into the mapping: the pages are faulted in by the
+    sketch update itself, with sequential read-ahead from the kernel
+*/
+static int mmap_next(InputReader *reader, uint8_t **data, MPI_Offset *count) {
+    MPI_Offset first, n;
+    if (!reader_next_range(reader, &first, &n))
+        return 0;
+    *data = reader->map + reader->map_skip + (size_t)(first - reader->start_index) * reader->record_size;
+    *count = n;
+    reader->position += n;
+    return 1;
+}
+
+static void mmap_close(InputReader *reader) {
+    if (reader->map)
+        munmap(reader->map, reader->map_length);
+    if (reader->fd >= 0)
+        close(reader->fd);
+    reader->map = NULL;
+    reader->fd = -1;
+}
+
+static int mmap_open(InputReader *reader, const char *path) {
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd == -1) {
+        fprintf(stderr, "Error: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (reader->n_addresses == 0)
+        return 0;
+
+    // mmap offsets must be page aligned: map from the page holding the first address
+    long page = sysconf(_SC_PAGESIZE);
+    off_t begin = (off_t)reader->data_offset + (off_t)reader->start_index * reader->record_size;
+    off_t aligned = begin - begin % page;
+    reader->map_skip = (size_t)(begin - aligned);
+    reader->map_length = reader->map_skip + (size_t)reader->n_addresses * reader->record_size;
+
+    void *map = mmap(NULL, reader->map_length, PROT_READ, MAP_PRIVATE, reader->fd, aligned);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: cannot mmap %s: %s\n", path, strerror(errno));
+        mmap_close(reader);
+        return -1;
+    }
+    reader->map = map;
+
+    // Hints only: failures are harmless
+    posix_madvise(map, reader->map_length, POSIX_MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, reader->map_length, MADV_HUGEPAGE);
+#endif
+    return 0;
+}
+
+/* ---------------- pread backend ---------------- */
+
+static int pread_next(InputReader *reader, uint8_t **data, MPI_Offset *count) {
+    MPI_Offset first, n;
+    if (!reader_next_range(reader, &first, &n))
+        return 0;
+
+    double start = MPI_Wtime();
+    size_t to_read = (size_t)n * reader->record_size;
+    off_t offset = (off_t)reader->data_offset + (off_t)first * reader->record_size;
+    size_t done = 0;
+    while (done < to_read) {
+        ssize_t got = pread(reader->fd, reader->buffer + done, to_read - done, offset + (off_t)done);
+        if (got == -1 && errno == EINTR)
+            continue;
+        if (got <= 0) {
+            fprintf(stderr, "Error: Process failed to read the expected number of bytes. Expected %zu, got %zu\n",
+                    to_read, done);
+            return -1;
+        }
+        done += (size_t)got;
+    }
+    reader->exposed_time += MPI_Wtime() - start;
+
+    *data = reader->buffer;
+    *count = n;
+    reader->position += n;
+    return 1;
+}
+
+static void pread_close(InputReader *reader) {
+    cms_mem_free(reader->buffer, (size_t)reader->chunk_addresses * reader->record_size);
+    if (reader->fd >= 0)
+        close(reader->fd);
+    reader->buffer = NULL;
+    reader->fd = -1;
+}
+
+static int pread_open(InputReader *reader, const char *path) {
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd == -1) {
+        fprintf(stderr, "Error: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    reader->buffer = cms_mem_alloc((size_t)reader->chunk_addresses * reader->record_size, CMS_MEM_BUFFER);
+    if (reader->buffer == NULL) {
+        fprintf(stderr, "Error: failed to allocate the pread buffer\n");
+        pread_close(reader);
+        return -1;
+    }
+    posix_fadvise(reader->fd, (off_t)reader->data_offset + (off_t)reader->start_index * reader->record_size,
+                  (off_t)reader->n_addresses * reader->record_size, POSIX_FADV_SEQUENTIAL);
+    return 0;
+}
+
+/* ---------------- Interface ---------------- */
+
+/*
+    Open a reader over the addresses [start_index, start_index + n_addresses)
+    of the input file.
+    - READER_MPIIO reads through fh with the pipeline of config (buffers,
+      chunk size, collective mode); it is collective over comm when
+      config->collective is set.
+    - READER_MMAP and READER_PREAD open path directly and are meant for
+      single-node runs; they return chunks of config->chunk_size bytes.
+    Addresses are records of config->record_size bytes, the first one at
+    byte config->data_offset of the file.
+    With config->scheduler the chunks are claimed dynamically instead:
+    the range must then cover the whole file.
+    Returns 0 on success, -1 on error.
+*/
+int reader_open(InputReader *reader, reader_backend backend, const char *path, MPI_File fh, MPI_Comm comm,
+                const ReadConfig *config, MPI_Offset start_index, MPI_Offset n_addresses) {
+    memset(reader, 0, sizeof(*reader));
+    reader->backend = backend;
+    reader->fd = -1;
+    reader->start_index = start_index;
+    reader->n_addresses = n_addresses;
+    reader->record_size = config->record_size;
+    reader->data_offset = config->data_offset;
+    reader->chunk_addresses = read_config_chunk_records(config);
+    reader->scheduler = config->scheduler;
+
+    switch (backend) {
+        case READER_MPIIO:
+            reader->next = mpiio_next;
+            reader->close = mpiio_close;
+            return read_pipeline_init(&reader->pipe, fh, comm, config, start_index, n_addresses);
+        case READER_MMAP:
+            reader->next = mmap_next;
+            reader->close = mmap_close;
+            return mmap_open(reader, path);
+        case READER_PREAD:
+            reader->next = pread_next;
+            reader->close = pread_close;
+            return pread_open(reader, path);
+    }
+    return -1;
+}
+
+/*
+    Return the next chunk of the range in *data and its size in *count.
+    The chunk stays valid until the following call.
+    Returns 1 if a chunk was returned, 0 at the end of the range, -1 on error.
+*/
+int reader_next(InputReader *reader, uint8_t **data, MPI_Offset *count) {
+    return reader->next(reader, data, count);
+}
+
+/*
+    Overlap between I/O and computation (only the MPI-IO pipeline overlaps)
+*/
+double reader_overlap(const InputReader *reader) {
+    return (reader->backend == READER_MPIIO) ? read_pipeline_overlap(&reader->pipe) : 0.0;
+}
+
+void reader_close(InputReader *reader) {
+    if (reader->close)
+        reader->close(reader);
+}
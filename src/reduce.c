@@ -0,0 +1,409 @@
+#include "headers/reduce.h"
+#include "headers/cms_kernels.h"
+#include "headers/cms_memory.h"
+
+/*
+    MPI datatype and counter width of the cells
+*/
+MPI_Datatype cms_cell_datatype(const CountMinSketch *cms) {
+    switch (cms->counters) {
+        case CMS_COUNTER_8:  return MPI_UINT8_T;
+        case CMS_COUNTER_16: return MPI_UINT16_T;
+        case CMS_COUNTER_64: return MPI_UINT64_T;
+        case CMS_COUNTER_32:
+        default:             return MPI_UINT32_T;
+    }
+}
+
+static cms_counter_width cms_datatype_counters(MPI_Datatype datatype) {
+    if (datatype == MPI_UINT8_T)
+        return CMS_COUNTER_8;
+    if (datatype == MPI_UINT16_T)
+        return CMS_COUNTER_16;
+    if (datatype == MPI_UINT64_T)
+        return CMS_COUNTER_64;
+    return CMS_COUNTER_32;
+}
+
+/*
+    User defined reduction operator for the sketch tables.
+    Sums two counter arrays element-wise (inout += in), with the width
+    given by the datatype; 8/16-bit cells saturate.
+    Having our own operator keeps the reduction semantics in one place,
+    independently of how the MPI implementation treats MPI_SUM on these types.
+*/
+static void cms_sum_op(void *in, void *inout, int *len, MPI_Datatype *datatype) {
+    cms_cells_add(cms_datatype_counters(*datatype), inout, in, 0, (size_t)*len);
+}
+
+/*
+    Raw value of a cell of an 8/16-bit table (the maximum means saturated)
+*/
+static inline uint64_t saturating_cell(const CountMinSketch *cms, const void *cells, size_t cell) {
+    if (cms->counters == CMS_COUNTER_8)
+        return ((const uint8_t *)cells)[cell];
+    return ((const uint16_t *)cells)[cell];
+}
+
+/*
+    Exact counts of the saturated cells after the reduction of 8/16-bit
+    tables. A reduced cell at the maximum only says that the sum did not
+    fit: the cells in that state on the root are listed, every rank adds
+    up the exact value it had for them before the reduction (local_cells
+    and its overflow table) and the sums go to the overflow table of the
+    root (of every rank with CMS_REDUCE_ALL).
+*/
+static int cms_reduce_overflow(CountMinSketch *cms, const void *local_cells, cms_reduce_mode mode,
+                               int root, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    size_t n_cells = (size_t)cms->width * cms->depth;
+    uint64_t max_value = (cms->counters == CMS_COUNTER_8) ? UINT8_MAX : UINT16_MAX;
+
+    int n_saturated = 0;
+    if (rank == root || mode == CMS_REDUCE_ALL) {
+        for (size_t i = 0; i < n_cells; i++)
+            n_saturated += (saturating_cell(cms, cms->cells, i) == max_value);
+    }
+    if (mode != CMS_REDUCE_ALL)
+        MPI_Bcast(&n_saturated, 1, MPI_INT, root, comm);
+    if (n_saturated == 0)
+        return 0;
+
+    uint32_t *saturated = malloc(n_saturated * sizeof(uint32_t));
+    uint64_t *sums = malloc(n_saturated * sizeof(uint64_t));
+    int error = (saturated == NULL || sums == NULL);
+    MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_LOR, comm);
+    if (error) {
+        fprintf(stderr, "Error: failed to allocate the overflow reduction buffers on rank %d\n", rank);
+        free(saturated);
+        free(sums);
+        return -1;
+    }
+    if (rank == root || mode == CMS_REDUCE_ALL) {
+        int n = 0;
+        for (size_t i = 0; i < n_cells; i++) {
+            if (saturating_cell(cms, cms->cells, i) == max_value)
+                saturated[n++] = (uint32_t)i;
+        }
+    }
+    if (mode != CMS_REDUCE_ALL)
+        MPI_Bcast(saturated, n_saturated, MPI_UINT32_T, root, comm);
+
+    // Local exact value of each saturated cell
+    for (int j = 0; j < n_saturated; j++) {
+        uint64_t value = saturating_cell(cms, local_cells, saturated[j]);
+        sums[j] = (value == max_value) ? cms_overflow_get(cms->overflow, saturated[j]) : value;
+    }
+    if (mode == CMS_REDUCE_ALL)
+        MPI_Allreduce(MPI_IN_PLACE, sums, n_saturated, MPI_UINT64_T, MPI_SUM, comm);
+    else if (rank == root)
+        MPI_Reduce(MPI_IN_PLACE, sums, n_saturated, MPI_UINT64_T, MPI_SUM, root, comm);
+    else
+        MPI_Reduce(sums, NULL, n_saturated, MPI_UINT64_T, MPI_SUM, root, comm);
+
+    if (rank == root || mode == CMS_REDUCE_ALL) {
+        cms_overflow_clear(cms->overflow);
+        for (int j = 0; j < n_saturated; j++) {
+            if (cms_overflow_set(cms->overflow, saturated[j], sums[j]) == -1)
+                error = 1;
+        }
+    }
+    free(saturated);
+    free(sums);
+    return error ? -1 : 0;
+}
+
+/*
+    Convert the command-line name of a reduction mode to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int cms_reduce_mode_parse(const char *name, cms_reduce_mode *mode) {
+    if (strcmp(name, "reduce") == 0)
+        *mode = CMS_REDUCE_ROOT;
+    else if (strcmp(name, "allreduce") == 0)
+        *mode = CMS_REDUCE_ALL;
+    else if (strcmp(name, "scatter") == 0)
+        *mode = CMS_REDUCE_SCATTER;
+    else if (strcmp(name, "hier") == 0)
+        *mode = CMS_REDUCE_HIER;
+    else
+        return -1;
+    return 0;
+}
+
+const char *cms_reduce_mode_name(cms_reduce_mode mode) {
+    switch (mode) {
+        case CMS_REDUCE_ROOT:    return "reduce";
+        case CMS_REDUCE_ALL:     return "allreduce";
+        case CMS_REDUCE_SCATTER: return "scatter";
+        case CMS_REDUCE_HIER:    return "hier";
+    }
+    return "unknown";
+}
+
+/*
+    Reduce-scatter the table in blocks of whole rows, then gather the
+    reduced blocks on the root.
+    For very wide tables this splits the summation work across the ranks
+    instead of funnelling every table through the reduction tree.
+    When there are more ranks than rows the blocks are split at cell
+    granularity, so that every rank still owns a part of the table.
+*/
+static int cms_reduce_scatter(CountMinSketch *cms, MPI_Op op, int root, MPI_Comm comm) {
+    int rank, comm_sz;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_sz);
+
+    int *counts = malloc(comm_sz * sizeof(int));
+    int *displs = malloc(comm_sz * sizeof(int));
+    if (counts == NULL || displs == NULL) {
+        fprintf(stderr, "Error: failed to allocate reduce-scatter counts on rank %d\n", rank);
+        free(counts);
+        free(displs);
+        return -1;
+    }
+
+    // Block granularity: a full row if there are enough rows, a single cell otherwise
+    int unit = (comm_sz <= cms->depth) ? cms->width : 1;
+    int n_units = (unit == 1) ? cms->width * cms->depth : cms->depth;
+    int base = n_units / comm_sz;
+    int remainder = n_units % comm_sz;
+    int offset = 0;
+    for (int r = 0; r < comm_sz; r++) {
+        counts[r] = (base + (r < remainder ? 1 : 0)) * unit;
+        displs[r] = offset;
+        offset += counts[r];
+    }
+
+    MPI_Datatype cell_type = cms_cell_datatype(cms);
+    void *block = malloc((counts[rank] > 0 ? counts[rank] : 1) * cms->cell_size);
+    if (block == NULL) {
+        fprintf(stderr, "Error: failed to allocate reduce-scatter block on rank %d\n", rank);
+        free(counts);
+        free(displs);
+        return -1;
+    }
+
+    MPI_Reduce_scatter(cms->cells, block, counts, cell_type, op, comm);
+    MPI_Gatherv(block, counts[rank], cell_type,
+                cms->cells, counts, displs, cell_type, root, comm);
+
+    free(block);
+    free(counts);
+    free(displs);
+    return 0;
+}
+
+/*
+    Two-level reduction.
+    1) The ranks sharing a node (MPI_COMM_TYPE_SHARED) copy their table into
+       an MPI-3 shared window, then each of them sums a slice of the cells
+       of all the copies into the copy of the node leader.
+    2) Only the node leaders take part in the inter-node MPI_Reduce.
+    The root is always made the leader of its node, so that it ends up
+    holding the global table.
+*/
+static int cms_reduce_hier(CountMinSketch *cms, MPI_Op op, int root, MPI_Comm comm, CmsReduceTiming *timing) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int n_cells = cms->width * cms->depth;
+
+    // Ordering key: the root comes first in its node and among the leaders
+    int key = (rank == root) ? 0 : rank + 1;
+
+    double intra_start = MPI_Wtime();
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, key, MPI_INFO_NULL, &node_comm);
+    int node_rank, node_sz;
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_sz);
+
+    // Every rank exposes a full copy of its table in the shared window
+    size_t cell_size = cms->cell_size;
+    uint8_t *segment;
+    MPI_Win win;
+    MPI_Win_allocate_shared((MPI_Aint)n_cells * cell_size, (int)cell_size,
+                            MPI_INFO_NULL, node_comm, &segment, &win);
+
+    uint8_t **copies = malloc(node_sz * sizeof(uint8_t *));
+    if (copies == NULL) {
+        fprintf(stderr, "Error: failed to allocate shared segment pointers on rank %d\n", rank);
+        MPI_Win_free(&win);
+        MPI_Comm_free(&node_comm);
+        return -1;
+    }
+    for (int r = 0; r < node_sz; r++) {
+        MPI_Aint size;
+        int disp_unit;
+        MPI_Win_shared_query(win, r, &size, &disp_unit, &copies[r]);
+    }
+
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+    memcpy(segment, cms->cells, (size_t)n_cells * cell_size);
+    MPI_Win_sync(win);
+    MPI_Barrier(node_comm);
+    MPI_Win_sync(win);
+
+    // Each rank of the node sums its slice of cells into the leader copy
+    int base = n_cells / node_sz;
+    int remainder = n_cells % node_sz;
+    int lo = node_rank * base + (node_rank < remainder ? node_rank : remainder);
+    int hi = lo + base + (node_rank < remainder ? 1 : 0);
+    for (int r = 1; r < node_sz; r++)
+        cms_cells_add(cms->counters, copies[0], copies[r], (size_t)lo, (size_t)hi);
+
+    MPI_Win_sync(win);
+    MPI_Barrier(node_comm);
+    MPI_Win_sync(win);
+    if (node_rank == 0)
+        memcpy(cms->cells, copies[0], (size_t)n_cells * cell_size);
+    MPI_Win_unlock_all(win);
+
+    free(copies);
+    MPI_Win_free(&win);
+    double intra_end = MPI_Wtime();
+
+    // Inter-node level, among the node leaders only
+    MPI_Comm leader_comm;
+    MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, key, &leader_comm);
+    if (leader_comm != MPI_COMM_NULL) {
+        int leader_rank;
+        MPI_Comm_rank(leader_comm, &leader_rank);
+        if (leader_rank == 0)
+            MPI_Reduce(MPI_IN_PLACE, cms->cells, n_cells, cms_cell_datatype(cms), op, 0, leader_comm);
+        else
+            MPI_Reduce(cms->cells, NULL, n_cells, cms_cell_datatype(cms), op, 0, leader_comm);
+        MPI_Comm_free(&leader_comm);
+    }
+    double inter_end = MPI_Wtime();
+
+    MPI_Comm_free(&node_comm);
+    if (timing) {
+        timing->intra_time = intra_end - intra_start;
+        timing->inter_time = inter_end - intra_end;
+    }
+    return 0;
+}
+
+/*
+    Sum the Count-Min Sketch tables of all the ranks in comm.
+    All the sketches must share dimensions and hash parameters.
+    Depending on mode, the global table is left on the root only
+    (CMS_REDUCE_ROOT, CMS_REDUCE_SCATTER, CMS_REDUCE_HIER) or on every rank
+    (CMS_REDUCE_ALL); the other ranks keep a partial table.
+    If timing is not NULL it receives the time spent in each level.
+    Returns 0 on success, -1 on error.
+*/
+int cms_reduce(CountMinSketch *cms, cms_reduce_mode mode, int root, MPI_Comm comm, CmsReduceTiming *timing) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int n_cells = cms->width * cms->depth;
+
+    MPI_Op op;
+    MPI_Op_create(cms_sum_op, 1, &op);
+
+    if (timing) {
+        timing->intra_time = 0.0;
+        timing->inter_time = 0.0;
+    }
+
+    // Saturating cells: keep the local counts to compute the exact sums of the saturated ones
+    void *local_cells = NULL;
+    int result = 0;
+    if (cms->overflow) {
+        local_cells = cms_mem_alloc(cms_table_bytes(cms), CMS_MEM_BUFFER);
+        if (local_cells == NULL)
+            fprintf(stderr, "Error: failed to allocate the local copy of the table on rank %d\n", rank);
+        else if (cms_status(cms) == -1)
+            fprintf(stderr, "Error: the sketch of rank %d lost the count of a saturated cell\n", rank);
+        // No rank takes part in the sums if one of them cannot provide exact counts
+        result = (local_cells == NULL || cms_status(cms) == -1) ? -1 : 0;
+        MPI_Allreduce(MPI_IN_PLACE, &result, 1, MPI_INT, MPI_MIN, comm);
+        if (result == -1) {
+            cms_mem_free(local_cells, cms_table_bytes(cms));
+            MPI_Op_free(&op);
+            return -1;
+        }
+        memcpy(local_cells, cms->cells, cms_table_bytes(cms));
+    }
+
+    MPI_Datatype cell_type = cms_cell_datatype(cms);
+    double start = MPI_Wtime();
+    switch (mode) {
+        case CMS_REDUCE_ROOT:
+            if (rank == root)
+                MPI_Reduce(MPI_IN_PLACE, cms->cells, n_cells, cell_type, op, root, comm);
+            else
+                MPI_Reduce(cms->cells, NULL, n_cells, cell_type, op, root, comm);
+            break;
+        case CMS_REDUCE_ALL:
+            MPI_Allreduce(MPI_IN_PLACE, cms->cells, n_cells, cell_type, op, comm);
+            break;
+        case CMS_REDUCE_SCATTER:
+            result = cms_reduce_scatter(cms, op, root, comm);
+            break;
+        case CMS_REDUCE_HIER:
+            result = cms_reduce_hier(cms, op, root, comm, timing);
+            break;
+    }
+    if (local_cells) {
+        if (result == 0)
+            result = cms_reduce_overflow(cms, local_cells, mode, root, comm);
+        cms_mem_free(local_cells, cms_table_bytes(cms));
+    }
+    if (timing && mode != CMS_REDUCE_HIER)
+        timing->inter_time = MPI_Wtime() - start;
+
+    MPI_Op_free(&op);
+    return result;
+}
+
+/*
+    Copy the table of root (with its overflow table) to every rank of comm.
+    Returns 0 on success, -1 on error.
+*/
+int cms_broadcast(CountMinSketch *cms, int root, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    size_t n_cells = (size_t)cms->width * cms->depth;
+    MPI_Bcast(cms->cells, (int)n_cells, cms_cell_datatype(cms), root, comm);
+    if (cms->overflow == NULL)
+        return 0;
+
+    // The saturated cells are now the same everywhere, only their exact counts are sent
+    uint64_t max_value = (cms->counters == CMS_COUNTER_8) ? UINT8_MAX : UINT16_MAX;
+    int n_saturated = 0;
+    for (size_t i = 0; i < n_cells; i++)
+        n_saturated += (saturating_cell(cms, cms->cells, i) == max_value);
+    if (n_saturated == 0) {
+        cms_overflow_clear(cms->overflow);
+        return 0;
+    }
+    uint64_t *counts = malloc(n_saturated * sizeof(uint64_t));
+    int error = (counts == NULL);
+    MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_LOR, comm);
+    if (error) {
+        fprintf(stderr, "Error: failed to allocate the overflow broadcast buffer on rank %d\n", rank);
+        free(counts);
+        return -1;
+    }
+    if (rank == root) {
+        int n = 0;
+        for (size_t i = 0; i < n_cells; i++) {
+            if (saturating_cell(cms, cms->cells, i) == max_value)
+                counts[n++] = cms_overflow_get(cms->overflow, i);
+        }
+    }
+    MPI_Bcast(counts, n_saturated, MPI_UINT64_T, root, comm);
+    if (rank != root) {
+        cms_overflow_clear(cms->overflow);
+        int n = 0;
+        for (size_t i = 0; i < n_cells && !error; i++) {
+            if (saturating_cell(cms, cms->cells, i) == max_value)
+                error = (cms_overflow_set(cms->overflow, i, counts[n++]) == -1);
+        }
+    }
+    free(counts);
+    return error ? -1 : 0;
+}
@@ -0,0 +1,82 @@
+#include "headers/schedule.h"
+
+/*
+    Convert the command-line name of a schedule to its enum value.
+    Returns 0 on success, -1 if the name is unknown.
+*/
+int schedule_mode_parse(const char *name, schedule_mode *mode) {
+    if (strcmp(name, "static") == 0)
+        *mode = SCHEDULE_STATIC;
+    else if (strcmp(name, "dynamic") == 0)
+        *mode = SCHEDULE_DYNAMIC;
+    else
+        return -1;
+    return 0;
+}
+
+const char *schedule_mode_name(schedule_mode mode) {
+    switch (mode) {
+        case SCHEDULE_STATIC:  return "static";
+        case SCHEDULE_DYNAMIC: return "dynamic";
+    }
+    return "unknown";
+}
+
+/*
+    Create the shared chunk counter over the n_addresses addresses of the
+    file, cut in chunks of chunk_addresses. Collective over comm: the
+    window lives on rank 0 and stays open in a passive-target epoch until
+    chunk_scheduler_free.
+    Returns 0 on success, -1 on error.
+*/
+int chunk_scheduler_init(ChunkScheduler *sched, MPI_Comm comm, MPI_Offset n_addresses, MPI_Offset chunk_addresses) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    memset(sched, 0, sizeof(*sched));
+    sched->n_addresses = n_addresses;
+    sched->chunk_addresses = chunk_addresses;
+    sched->n_chunks = (long long)((n_addresses + chunk_addresses - 1) / chunk_addresses);
+
+    MPI_Aint size = (rank == 0) ? (MPI_Aint)sizeof(long long) : 0;
+    if (MPI_Win_allocate(size, sizeof(long long), MPI_INFO_NULL, comm, &sched->counter, &sched->win) != MPI_SUCCESS) {
+        fprintf(stderr, "Error: failed to allocate the chunk counter window on rank %d\n", rank);
+        return -1;
+    }
+    if (rank == 0)
+        *sched->counter = 0;
+    // The counter must be set before any rank claims a chunk
+    MPI_Barrier(comm);
+    MPI_Win_lock_all(0, sched->win);
+    return 0;
+}
+
+/*
+    Claim the next unprocessed chunk of the file: *first receives its
+    first address and *count its number of addresses.
+    Returns 1 if a chunk was claimed, 0 once the file is exhausted.
+*/
+int chunk_scheduler_claim(ChunkScheduler *sched, MPI_Offset *first, MPI_Offset *count) {
+    double start = MPI_Wtime();
+    long long one = 1, chunk;
+    MPI_Fetch_and_op(&one, &chunk, MPI_LONG_LONG, 0, 0, MPI_SUM, sched->win);
+    MPI_Win_flush(0, sched->win);
+    sched->claim_time += MPI_Wtime() - start;
+
+    if (chunk >= sched->n_chunks)
+        return 0;
+    *first = (MPI_Offset)chunk * sched->chunk_addresses;
+    MPI_Offset remaining = sched->n_addresses - *first;
+    *count = (remaining > sched->chunk_addresses) ? sched->chunk_addresses : remaining;
+    sched->claimed++;
+    return 1;
+}
+
+/*
+    Close the epoch and free the window. Collective over the communicator
+    of chunk_scheduler_init.
+*/
+void chunk_scheduler_free(ChunkScheduler *sched) {
+    MPI_Win_unlock_all(sched->win);
+    MPI_Win_free(&sched->win);
+    sched->counter = NULL;
+}
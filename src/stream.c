@@ -0,0 +1,321 @@
+#include "headers/stream.h"
+#include "headers/file_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+    Streaming ingestion.
+
+    Rank 0 is the reader: it pulls batches of keys from the source (stdin,
+    a FIFO or a UNIX socket) and hands them to the worker ranks with
+    nonblocking sends. Every worker has a bounded queue of
+    queue_depth batches: a batch is only sent to a worker that returned
+    a credit for one of its previous batches, so a slow worker never gets
+    flooded and the reader memory stays bounded.
+    The workers update their local sketch; every merge_interval seconds
+    the reader asks all the ranks to reduce their local sketches on
+    rank 0, where they are added to the global sketch, and the local
+    tables restart from zero.
+*/
+
+void stream_config_default(StreamConfig *config) {
+    config->batch_keys = 262144;   // 1 MB of IPv4 keys
+    config->queue_depth = 4;
+    config->merge_interval = 5.0;
+    config->reduce_mode = CMS_REDUCE_ROOT;
+}
+
+/*
+    Open the stream source: "-" is stdin, "unix:<path>" a UNIX stream
+    socket to connect to, anything else a path (FIFO or regular file).
+    Returns a file descriptor or -1 on error.
+*/
+static int stream_open_source(const char *source) {
+    if (strcmp(source, "-") == 0)
+        return STDIN_FILENO;
+
+    if (strncmp(source, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(source + 5) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Error: socket path too long: %s\n", source + 5);
+            return -1;
+        }
+        strcpy(addr.sun_path, source + 5);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            fprintf(stderr, "Error: cannot connect to %s: %s\n", source + 5, strerror(errno));
+            if (fd != -1)
+                close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    int fd = open(source, O_RDONLY);
+    if (fd == -1)
+        fprintf(stderr, "Error: cannot open %s: %s\n", source, strerror(errno));
+    return fd;
+}
+
+/*
+    Incremental reader of the source
+*/
+typedef struct {
+    int fd;
+    int eof;
+    uint8_t carry[IP_SIZE];  // Bytes of an incomplete key left by the previous batch
+    size_t n_carry;
+} StreamSource;
+
+/*
+    Fill buffer with at most max_keys keys, returning early when the
+    deadline (MPI_Wtime) passes so that a slow feed still gets merged on
+    time. Returns the number of complete keys, or -1 on error.
+*/
+static long stream_fill(StreamSource *src, uint8_t *buffer, size_t max_keys, double deadline) {
+    size_t capacity = max_keys * IP_SIZE;
+    size_t filled = src->n_carry;
+    memcpy(buffer, src->carry, src->n_carry);
+    src->n_carry = 0;
+
+    while (filled < capacity && !src->eof) {
+        int timeout_ms = (int)((deadline - MPI_Wtime()) * 1000.0);
+        if (timeout_ms < 0)
+            timeout_ms = 0;
+        struct pollfd pfd = { .fd = src->fd, .events = POLLIN, .revents = 0 };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready == -1 && errno == EINTR)
+            continue;
+        if (ready == -1) {
+            fprintf(stderr, "Error: poll on the stream source failed: %s\n", strerror(errno));
+            return -1;
+        }
+        if (ready == 0)
+            break; // Deadline reached, send what we have
+
+        ssize_t got = read(src->fd, buffer + filled, capacity - filled);
+        if (got == -1 && errno == EINTR)
+            continue;
+        if (got == -1) {
+            fprintf(stderr, "Error: read from the stream source failed: %s\n", strerror(errno));
+            return -1;
+        }
+        if (got == 0)
+            src->eof = 1;
+        filled += (size_t)got;
+    }
+
+    // Keep the bytes of an incomplete key for the next batch
+    src->n_carry = filled % IP_SIZE;
+    memcpy(src->carry, buffer + filled - src->n_carry, src->n_carry);
+    return (long)(filled / IP_SIZE);
+}
+
+/*
+    Collective merge of the local sketches into the global one on rank 0
+*/
+static int stream_merge(const StreamConfig *config, CountMinSketch *local, CountMinSketch *global,
+                        MPI_Comm comm, StreamStats *stats) {
+    double start = MPI_Wtime();
+    if (cms_reduce(local, config->reduce_mode, 0, comm, NULL) == -1)
+        return -1;
+    if (global != NULL)
+        cms_merge_into(global, local);
+    cms_clear(local);
+    stats->merges++;
+    stats->merge_time += MPI_Wtime() - start;
+    return 0;
+}
+
+/*
+    Worker side: process batches until the reader sends STOP
+*/
+static int stream_worker(const StreamConfig *config, CountMinSketch *local, MPI_Comm comm, StreamStats *stats) {
+    uint8_t *buffer = cms_mem_alloc(config->batch_keys * IP_SIZE, CMS_MEM_BUFFER);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error: failed to allocate the stream batch buffer\n");
+        return -1;
+    }
+
+    int result = 0;
+    for (;;) {
+        MPI_Status status;
+        MPI_Recv(buffer, (int)(config->batch_keys * IP_SIZE), MPI_BYTE, 0, MPI_ANY_TAG, comm, &status);
+
+        if (status.MPI_TAG == STREAM_TAG_DATA) {
+            int bytes = 0;
+            MPI_Get_count(&status, MPI_BYTE, &bytes);
+            double start = MPI_Wtime();
+            cms_batch_update(local, buffer, (size_t)bytes / IP_SIZE);
+            stats->compute_time += MPI_Wtime() - start;
+            stats->keys += (unsigned long long)bytes / IP_SIZE;
+            stats->batches++;
+
+            // Give the queue slot back to the reader
+            int credit = 1;
+            MPI_Send(&credit, 1, MPI_INT, 0, STREAM_TAG_CREDIT, comm);
+        } else {
+            if (stream_merge(config, local, NULL, comm, stats) == -1)
+                result = -1;
+            if (status.MPI_TAG == STREAM_TAG_STOP)
+                break;
+        }
+    }
+    cms_mem_free(buffer, config->batch_keys * IP_SIZE);
+    return result;
+}
+
+/*
+    Reader side (rank 0)
+*/
+static int stream_reader(const char *source, const StreamConfig *config, CountMinSketch *local,
+                         CountMinSketch *global, stream_merge_hook hook, void *hook_arg,
+                         MPI_Comm comm, StreamStats *stats) {
+    int comm_sz;
+    MPI_Comm_size(comm, &comm_sz);
+    int n_workers = comm_sz - 1;
+    // Without workers rank 0 updates the sketch itself, through a single slot
+    int n_slots = (n_workers > 0) ? n_workers * config->queue_depth : 1;
+
+    size_t slots_bytes = (size_t)n_slots * config->batch_keys * IP_SIZE;
+    uint8_t *slots = cms_mem_alloc(slots_bytes, CMS_MEM_BUFFER);
+    MPI_Request *requests = malloc(n_slots * sizeof(MPI_Request));
+    int *outstanding = calloc(comm_sz, sizeof(int));  // Batches in flight per worker
+    int *next_slot = calloc(comm_sz, sizeof(int));    // Ring index in the worker slots
+    if (!slots || !requests || !outstanding || !next_slot) {
+        fprintf(stderr, "Error: failed to allocate the stream queues\n");
+        cms_mem_free(slots, slots_bytes); free(requests); free(outstanding); free(next_slot);
+        slots = NULL;
+        requests = NULL;
+        outstanding = next_slot = NULL;
+        n_slots = 0;
+    }
+    for (int s = 0; s < n_slots; s++)
+        requests[s] = MPI_REQUEST_NULL;
+
+    // On error the workers still have to be stopped: start at end of stream
+    StreamSource src = { .fd = -1, .eof = 1, .n_carry = 0 };
+    int result = -1;
+    if (slots != NULL && (src.fd = stream_open_source(source)) != -1) {
+        src.eof = 0;
+        result = 0;
+    }
+    int worker = 0;
+    double next_merge = MPI_Wtime() + config->merge_interval;
+
+    while (!src.eof) {
+        int slot = 0;
+        if (n_workers > 0) {
+            // Collect the credits already returned, then pick a worker with a free slot
+            int flag = 1;
+            while (flag) {
+                MPI_Status status;
+                MPI_Iprobe(MPI_ANY_SOURCE, STREAM_TAG_CREDIT, comm, &flag, &status);
+                if (flag) {
+                    int credit;
+                    MPI_Recv(&credit, 1, MPI_INT, status.MPI_SOURCE, STREAM_TAG_CREDIT, comm, MPI_STATUS_IGNORE);
+                    outstanding[status.MPI_SOURCE]--;
+                }
+            }
+            int found = 0;
+            for (int tries = 0; tries < n_workers && !found; tries++) {
+                worker = worker % n_workers + 1;
+                found = outstanding[worker] < config->queue_depth;
+            }
+            if (!found) {
+                // Every queue is full: wait for the first credit
+                MPI_Status status;
+                int credit;
+                MPI_Recv(&credit, 1, MPI_INT, MPI_ANY_SOURCE, STREAM_TAG_CREDIT, comm, &status);
+                outstanding[status.MPI_SOURCE]--;
+                worker = status.MPI_SOURCE;
+            }
+            slot = (worker - 1) * config->queue_depth + next_slot[worker];
+            // The previous send from this slot has been received, complete it
+            MPI_Wait(&requests[slot], MPI_STATUS_IGNORE);
+        }
+
+        uint8_t *batch = slots + (size_t)slot * config->batch_keys * IP_SIZE;
+        double read_start = MPI_Wtime();
+        long n_keys = stream_fill(&src, batch, config->batch_keys, next_merge);
+        stats->read_time += MPI_Wtime() - read_start;
+        if (n_keys == -1) {
+            result = -1;
+            break;
+        }
+
+        if (n_keys > 0) {
+            if (n_workers > 0) {
+                MPI_Isend(batch, (int)(n_keys * IP_SIZE), MPI_BYTE, worker, STREAM_TAG_DATA, comm, &requests[slot]);
+                outstanding[worker]++;
+                next_slot[worker] = (next_slot[worker] + 1) % config->queue_depth;
+            } else {
+                double start = MPI_Wtime();
+                cms_batch_update(local, batch, (size_t)n_keys);
+                stats->compute_time += MPI_Wtime() - start;
+            }
+            stats->keys += (unsigned long long)n_keys;
+            stats->batches++;
+        }
+
+        if (!src.eof && MPI_Wtime() >= next_merge) {
+            for (int w = 1; w <= n_workers; w++)
+                MPI_Send(NULL, 0, MPI_BYTE, w, STREAM_TAG_MERGE, comm);
+            if (stream_merge(config, local, global, comm, stats) == -1)
+                result = -1;
+            if (hook)
+                hook(global, stats, hook_arg);
+            next_merge = MPI_Wtime() + config->merge_interval;
+        }
+    }
+
+    // End of stream (or error): final merge, then collect the last credits
+    for (int w = 1; w <= n_workers; w++)
+        MPI_Send(NULL, 0, MPI_BYTE, w, STREAM_TAG_STOP, comm);
+    if (stream_merge(config, local, global, comm, stats) == -1)
+        result = -1;
+    if (hook)
+        hook(global, stats, hook_arg);
+    for (int w = 1; w <= n_workers && outstanding != NULL; w++) {
+        while (outstanding[w] > 0) {
+            int credit;
+            MPI_Recv(&credit, 1, MPI_INT, w, STREAM_TAG_CREDIT, comm, MPI_STATUS_IGNORE);
+            outstanding[w]--;
+        }
+    }
+    if (n_slots > 0)
+        MPI_Waitall(n_slots, requests, MPI_STATUSES_IGNORE);
+
+    cms_mem_free(slots, slots_bytes);
+    free(requests);
+    free(outstanding);
+    free(next_slot);
+    if (src.fd != -1 && src.fd != STDIN_FILENO)
+        close(src.fd);
+    return result;
+}
+
+/*
+    Run the streaming ingestion on all the ranks of comm.
+    - source: "-" (stdin), "unix:<path>" or the path of a FIFO, read by rank 0
+    - local: sketch updated by this rank, reset after every merge
+    - global: on rank 0, receives the merged counts (ignored elsewhere)
+    - hook: optional callback run on rank 0 after every merge
+    Returns 0 on success, -1 on error.
+*/
+int stream_run(const char *source, const StreamConfig *config, CountMinSketch *local, CountMinSketch *global,
+               stream_merge_hook hook, void *hook_arg, MPI_Comm comm, StreamStats *stats) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    memset(stats, 0, sizeof(*stats));
+    if (rank == 0)
+        return stream_reader(source, config, local, global, hook, hook_arg, comm, stats);
+    return stream_worker(config, local, comm, stats);
+}
@@ -0,0 +1,324 @@
+#include "headers/keygen.h"
+#include "headers/keys.h"
+
+#include <mpi.h>
+#include <omp.h>
+
+/*
+    * Parallel generator of input files
+    Writes n_keys synthetic addresses drawn by keygen (uniform, Zipf or
+    hot set) to an input file of the program. Every rank generates a
+    contiguous slice of the stream with its OpenMP threads and writes it
+    with collective MPI-IO, the next chunk being generated while the
+    previous one is written. Key i only depends on the seed and on i, so
+    the file is the same for any number of ranks and threads.
+    With --truth the exact count of every address of the Zipf ranks or of
+    the hot set is written to a second file, most frequent first, as
+    12-byte records: the address (4 bytes, network byte order) and its
+    count (uint64, host byte order), behind a key header. That file can be
+    given as it is to --query, whose estimates come out in the same order.
+    Usage: mpirun -n P ./cms_generate <output> <n_keys> [options]
+*/
+
+#define GEN_CHUNK_KEYS (4 * 1024 * 1024)  // Keys per chunk and per collective write
+#define GEN_MAX_DISTINCT (1U << 28)       // Largest Zipf support / hot set
+#define TRUTH_RECORD 12                   // Address + uint64 count
+
+typedef struct {
+    const char *output;
+    long long n_keys;
+    keygen_distribution distribution;
+    uint32_t n_distinct;
+    double skew;
+    double hot_share;
+    uint64_t seed;
+    int ipv6;                  // 16-byte IPv6 records (2001:db8::/96 + the address) behind a key header
+    const char *truth;         // Ground-truth file (NULL = none)
+} GenOptions;
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: mpirun -n P %s <output> <n_keys> [options]\n", prog);
+    fprintf(stderr, "  --dist=uniform|zipf|hotset   distribution of the addresses (default: zipf)\n");
+    fprintf(stderr, "  --distinct=N                 Zipf ranks or hot addresses (default: 1048576, hotset: 1024)\n");
+    fprintf(stderr, "  --skew=S                     Zipf exponent (default: 1.1)\n");
+    fprintf(stderr, "  --hot-share=F                share of the keys drawn from the hot set (default: %.1f)\n",
+            KEYGEN_HOT_SHARE);
+    fprintf(stderr, "  --seed=N                     seed of the stream (default: 1)\n");
+    fprintf(stderr, "  --key=ipv4|ipv6              record format (default: ipv4)\n");
+    fprintf(stderr, "  --truth=FILE                 write the exact counts of the Zipf/hot addresses to FILE\n");
+}
+
+/*
+    Parse the command line. Returns 0 on success, -1 on error.
+*/
+static int parse_gen_options(int argc, char **argv, GenOptions *opts) {
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    opts->output = argv[1];
+    char *end;
+    opts->n_keys = strtoll(argv[2], &end, 10);
+    if (end == argv[2] || *end != '\0' || opts->n_keys < 1) {
+        fprintf(stderr, "Invalid number of keys: '%s'\n", argv[2]);
+        return -1;
+    }
+    opts->distribution = KEYGEN_ZIPF;
+    opts->n_distinct = 0;
+    opts->skew = 1.1;
+    opts->hot_share = KEYGEN_HOT_SHARE;
+    opts->seed = 1;
+    opts->ipv6 = 0;
+    opts->truth = NULL;
+
+    for (int i = 3; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--dist=", 7) == 0) {
+            if (keygen_distribution_parse(arg + 7, &opts->distribution) == -1) {
+                fprintf(stderr, "Invalid distribution: '%s' (uniform|zipf|hotset)\n", arg + 7);
+                return -1;
+            }
+        } else if (strncmp(arg, "--distinct=", 11) == 0) {
+            long long n = strtoll(arg + 11, &end, 10);
+            if (end == arg + 11 || *end != '\0' || n < 1 || n > GEN_MAX_DISTINCT) {
+                fprintf(stderr, "Invalid number of distinct addresses: '%s' (1 to %u)\n", arg + 11, GEN_MAX_DISTINCT);
+                return -1;
+            }
+            opts->n_distinct = (uint32_t)n;
+        } else if (strncmp(arg, "--skew=", 7) == 0) {
+            opts->skew = strtod(arg + 7, &end);
+            if (end == arg + 7 || *end != '\0' || opts->skew <= 0.0) {
+                fprintf(stderr, "Invalid skew: '%s' (positive)\n", arg + 7);
+                return -1;
+            }
+        } else if (strncmp(arg, "--hot-share=", 12) == 0) {
+            opts->hot_share = strtod(arg + 12, &end);
+            if (end == arg + 12 || *end != '\0' || opts->hot_share < 0.0 || opts->hot_share > 1.0) {
+                fprintf(stderr, "Invalid hot share: '%s' (in [0, 1])\n", arg + 12);
+                return -1;
+            }
+        } else if (strncmp(arg, "--seed=", 7) == 0) {
+            opts->seed = strtoull(arg + 7, &end, 0);
+            if (end == arg + 7 || *end != '\0' || arg[7] == '-') {
+                fprintf(stderr, "Invalid seed: '%s'\n", arg + 7);
+                return -1;
+            }
+        } else if (strncmp(arg, "--key=", 6) == 0) {
+            if (strcmp(arg + 6, "ipv4") == 0)
+                opts->ipv6 = 0;
+            else if (strcmp(arg + 6, "ipv6") == 0)
+                opts->ipv6 = 1;
+            else {
+                fprintf(stderr, "Invalid key format: '%s' (ipv4|ipv6)\n", arg + 6);
+                return -1;
+            }
+        } else if (strncmp(arg, "--truth=", 8) == 0) {
+            opts->truth = arg + 8;
+        } else {
+            fprintf(stderr, "Unknown option: '%s'\n", arg);
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (opts->n_distinct == 0)
+        opts->n_distinct = (opts->distribution == KEYGEN_HOTSET) ? 1024 : 1U << 20;
+    if (opts->truth && opts->distribution == KEYGEN_UNIFORM) {
+        fprintf(stderr, "--truth needs --dist=zipf or --dist=hotset (uniform keys are almost all distinct)\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Generate the keys [first, first + n) into records, and count the ranks
+    of the generator in counts (if not NULL)
+*/
+static void generate_chunk(const KeyGenerator *gen, long long first, long long n, int record_size,
+                           uint8_t *records, uint64_t *counts) {
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < n; i++) {
+        uint32_t key = keygen_key_at(gen, (uint64_t)(first + i));
+        uint8_t *out = records + i * record_size;
+        if (record_size == 16) {
+            // 2001:db8::/96 followed by the address
+            static const uint8_t prefix[12] = { 0x20, 0x01, 0x0d, 0xb8 };
+            memcpy(out, prefix, sizeof(prefix));
+            out += 12;
+        }
+        out[0] = (uint8_t)(key >> 24);
+        out[1] = (uint8_t)(key >> 16);
+        out[2] = (uint8_t)(key >> 8);
+        out[3] = (uint8_t)key;
+        if (counts) {
+            // The uniform keys of a hot-set stream may also hit a hot address
+            uint32_t rank = keygen_rank_of_key(gen, key);
+            if (rank < gen->n_distinct) {
+                #pragma omp atomic
+                counts[rank]++;
+            }
+        }
+    }
+}
+
+typedef struct {
+    uint32_t key;
+    uint64_t count;
+} TruthEntry;
+
+static int truth_compare_desc(const void *a, const void *b) {
+    const TruthEntry *x = a, *y = b;
+    if (x->count != y->count)
+        return (x->count < y->count) ? 1 : -1;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/*
+    Write the ground truth of root: the addresses seen at least once with
+    their counts, most frequent first. Returns 0 on success, -1 on error.
+*/
+static int write_truth(const char *path, const KeyGenerator *gen, const uint64_t *counts) {
+    size_t n = 0;
+    for (uint32_t r = 0; r < gen->n_distinct; r++)
+        n += (counts[r] > 0);
+    TruthEntry *entries = malloc((n > 0 ? n : 1) * sizeof(TruthEntry));
+    if (entries == NULL) {
+        fprintf(stderr, "Error: failed to allocate the ground truth (%zu addresses)\n", n);
+        return -1;
+    }
+    n = 0;
+    for (uint32_t r = 0; r < gen->n_distinct; r++)
+        if (counts[r] > 0)
+            entries[n++] = (TruthEntry){ keygen_key_of_rank(gen, r), counts[r] };
+    qsort(entries, n, sizeof(TruthEntry), truth_compare_desc);
+
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Error: cannot create %s\n", path);
+        free(entries);
+        return -1;
+    }
+    KeyFormat fmt;
+    key_format_parse("record:12:0:4", &fmt);
+    int result = key_format_write_header(out, &fmt);
+    for (size_t i = 0; i < n && result == 0; i++) {
+        uint8_t record[TRUTH_RECORD] = { (uint8_t)(entries[i].key >> 24), (uint8_t)(entries[i].key >> 16),
+                                         (uint8_t)(entries[i].key >> 8), (uint8_t)entries[i].key };
+        memcpy(record + 4, &entries[i].count, sizeof(uint64_t));
+        if (fwrite(record, sizeof(record), 1, out) != 1)
+            result = -1;
+    }
+    if (fclose(out) != 0)
+        result = -1;
+    if (result == -1)
+        fprintf(stderr, "Error: failed to write %s\n", path);
+    else
+        printf("Ground truth: %zu addresses in %s\n", n, path);
+    free(entries);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    MPI_Init(&argc, &argv);
+    int rank, comm_sz;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+    double start_time = MPI_Wtime();
+
+    GenOptions opts;
+    KeyGenerator gen;
+    if (parse_gen_options(argc, argv, &opts) == -1 ||
+        keygen_init(&gen, opts.distribution, opts.n_distinct, opts.skew, opts.seed) == -1) {
+        MPI_Finalize();
+        return 1;
+    }
+    gen.hot_share = opts.hot_share;
+
+    // Contiguous slice of the stream, the first ranks take the remainder
+    KeyFormat fmt;
+    key_format_parse(opts.ipv6 ? "ipv6" : "ipv4", &fmt);
+    const int record_size = fmt.record_size;
+    const MPI_Offset header_bytes = opts.ipv6 ? (MPI_Offset)sizeof(KeyFileHeader) : 0;
+    const long long base = opts.n_keys / comm_sz, remainder = opts.n_keys % comm_sz;
+    const long long first = rank * base + (rank < remainder ? rank : remainder);
+    const long long n_local = base + (rank < remainder ? 1 : 0);
+    // Every rank takes part in the same number of collective writes
+    const long long n_writes = (base + (remainder > 0) + GEN_CHUNK_KEYS - 1) / GEN_CHUNK_KEYS;
+
+    int error = 0;
+    uint8_t *buffers[2] = { malloc((size_t)GEN_CHUNK_KEYS * record_size), malloc((size_t)GEN_CHUNK_KEYS * record_size) };
+    uint64_t *counts = opts.truth ? calloc(gen.n_distinct, sizeof(uint64_t)) : NULL;
+    if (buffers[0] == NULL || buffers[1] == NULL || (opts.truth && counts == NULL)) {
+        fprintf(stderr, "Error: failed to allocate the buffers on rank %d\n", rank);
+        error = 1;
+    }
+    // Rank 0 truncates the file and writes the key header, if any
+    if (!error && rank == 0) {
+        FILE *out = fopen(opts.output, "wb");
+        if (out == NULL || (header_bytes > 0 && key_format_write_header(out, &fmt) == -1)) {
+            fprintf(stderr, "Error: cannot create %s\n", opts.output);
+            error = 1;
+        }
+        if (out)
+            fclose(out);
+    }
+    MPI_File fh = MPI_FILE_NULL;
+    MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (!error && MPI_File_open(MPI_COMM_WORLD, opts.output, MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (rank == 0)
+            fprintf(stderr, "Error: cannot open %s\n", opts.output);
+        error = 1;
+    }
+
+    // Chunk w + 1 is generated while chunk w is being written
+    double write_wait = 0.0;
+    MPI_Request request = MPI_REQUEST_NULL;
+    // A failed write does not stop the loop: the other ranks still wait in the collective calls
+    for (long long w = 0; w < n_writes && fh != MPI_FILE_NULL; w++) {
+        long long done = w * GEN_CHUNK_KEYS;
+        long long count = (n_local - done < GEN_CHUNK_KEYS) ? n_local - done : GEN_CHUNK_KEYS;
+        if (count < 0)
+            count = 0;
+        uint8_t *buffer = buffers[w % 2];
+        generate_chunk(&gen, first + done, count, record_size, buffer, counts);
+
+        double wait_start = MPI_Wtime();
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        MPI_Offset offset = header_bytes + (MPI_Offset)(first + done) * record_size;
+        if (MPI_File_iwrite_at_all(fh, offset, buffer, (int)(count * record_size), MPI_BYTE, &request)
+            != MPI_SUCCESS) {
+            fprintf(stderr, "Error writing %s on rank %d\n", opts.output, rank);
+            error = 1;
+        }
+        write_wait += MPI_Wtime() - wait_start;
+    }
+    if (request != MPI_REQUEST_NULL)
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+    if (fh != MPI_FILE_NULL)
+        MPI_File_close(&fh);
+    MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+    if (!error && counts) {
+        if (rank == 0)
+            MPI_Reduce(MPI_IN_PLACE, counts, (int)gen.n_distinct, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        else
+            MPI_Reduce(counts, NULL, (int)gen.n_distinct, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0 && write_truth(opts.truth, &gen, counts) == -1)
+            error = 1;
+    }
+
+    double elapsed = MPI_Wtime() - start_time;
+    double max_wait = 0.0;
+    MPI_Reduce(&write_wait, &max_wait, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0 && !error)
+        printf("Generated %lld %s keys (%s, seed %llu) in %s: %d ranks x %d threads, %.3f s (%.0f keys/s), "
+               "max write wait %.3f s\n", opts.n_keys, opts.ipv6 ? "IPv6" : "IPv4",
+               keygen_distribution_name(opts.distribution), (unsigned long long)opts.seed, opts.output, comm_sz,
+               omp_get_max_threads(), elapsed, opts.n_keys / elapsed, max_wait);
+
+    free(buffers[0]);
+    free(buffers[1]);
+    free(counts);
+    keygen_free(&gen);
+    MPI_Finalize();
+    return error ? 1 : 0;
+}
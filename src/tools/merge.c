@@ -0,0 +1,55 @@
+#include "headers/cms_file.h"
+
+#include <sys/mman.h>
+
+/*
+    * Merge saved sketches into one
+    Every input is mapped and added cell by cell to the first one, which
+    is then written to the output. The inputs must come from runs with the
+    same sketch parameters (dimensions, hash functions, counter width).
+    The output may be one of the inputs, so a running total can be kept
+    up to date one file at a time:
+        ./cms_merge total.cms total.cms day-42.cms
+    Usage: ./cms_merge <output> <input> [<input> ...]
+*/
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <output> <input> [<input> ...]\n", argv[0]);
+        return 1;
+    }
+    const char *output = argv[1];
+
+    // The first input holds the sum: its private pages are copied as they are updated
+    CmsMappedFile total;
+    if (cms_file_map(argv[2], NULL, &total) == -1)
+        return 1;
+    uint64_t total_keys = total.header->total_keys;
+
+    for (int i = 3; i < argc; i++) {
+        CmsMappedFile input;
+        if (cms_file_map(argv[i], NULL, &input) == -1) {
+            cms_file_unmap(&total);
+            return 1;
+        }
+        if (!cms_file_compatible(&total, &input)) {
+            fprintf(stderr, "Error: %s and %s were not built with the same sketch parameters.\n", argv[2], argv[i]);
+            cms_file_unmap(&input);
+            cms_file_unmap(&total);
+            return 1;
+        }
+        // The input is read once, front to back
+        posix_madvise(input.base, input.bytes, POSIX_MADV_SEQUENTIAL);
+        cms_merge_into(total.cms, input.cms);
+        total_keys += input.header->total_keys;
+        cms_file_unmap(&input);
+    }
+
+    int result = cms_file_write(total.cms, total_keys, output);
+    if (result == 0)
+        printf("Merged %d sketch(es) of %d x %d %s-bit counters, %llu keys, into %s\n", argc - 2,
+               total.cms->depth, total.cms->width, cms_counter_width_name(total.cms->counters),
+               (unsigned long long)total_keys, output);
+    cms_file_unmap(&total);
+    return result == 0 ? 0 : 1;
+}
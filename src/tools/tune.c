@@ -0,0 +1,563 @@
+#include "headers/cms.h"
+#include "headers/keys.h"
+#include "headers/cms_kernels.h"
+#include "headers/util.h"
+#include <errno.h>
+
+/*
+    * Auto-tuner of the sketch configuration
+    Reads a sample of the input (blocks spread over the whole file) and
+    counts it exactly with a hash map, then:
+        1. builds the sample sketch of every table shape (cms_create_from_error
+           over a grid of epsilon/delta around the target), hash family and
+           update rule (standard/conservative), and measures its error on
+           every distinct key of the sample. A configuration meets the
+           target if no more than a share delta of the keys are
+           overestimated by more than epsilon * N;
+        2. times the update of the sample with every kernel, cache strategy
+           and counter width available for the configurations that meet
+           the target (they do not change the counts, so not the error).
+    The fastest one is written as a shell file to source before running
+    the program:
+        EPSILON, DELTA and CMS_OPTIONS, e.g.
+        mpirun -n P ./CMsketch <input> <output> $EPSILON $DELTA $CMS_OPTIONS
+    The timings are single-threaded updates of a warm sample, so they rank
+    the configurations but are not the throughput of a whole run.
+    Usage: ./cms_tune <input> <epsilon> <delta> [options]
+*/
+
+#define TUNE_SAMPLE_KEYS (4 * 1024 * 1024)  // Default sample size
+#define TUNE_BLOCKS 64                      // Sample blocks spread over the file
+#define TUNE_REPEAT 3                       // Timed updates of the sample per configuration (best one kept)
+#define TUNE_MAX_VARIANTS 7                 // Kernel/cache strategy/counter combinations timed per shape
+
+// Grid around the target: epsilon * factor, delta ^ exponent
+static const double EPSILON_FACTORS[] = { 8.0, 4.0, 2.0, 1.0, 0.5 };
+static const double DELTA_EXPONENTS[] = { 0.25, 0.5, 1.0 };
+#define N_EPSILON_FACTORS (int)(sizeof(EPSILON_FACTORS) / sizeof(EPSILON_FACTORS[0]))
+#define N_DELTA_EXPONENTS (int)(sizeof(DELTA_EXPONENTS) / sizeof(DELTA_EXPONENTS[0]))
+#define N_HASH_FAMILIES 3
+
+typedef struct {
+    const char *input;
+    double epsilon;           // Target: keys overestimated by more than epsilon * N ...
+    double delta;             // ... are at most this share of the distinct keys
+    size_t sample_keys;
+    KeyFormat key_format;
+    int key_from_cli;
+    uint64_t seed;
+    int repeat;
+    const char *config;       // Where the chosen configuration is written (NULL = stdout)
+} TuneOptions;
+
+/*
+    Exact counts of the sample: open addressing on the host order keys
+*/
+typedef struct {
+    uint32_t *keys;
+    uint64_t *counts;         // 0 = empty slot
+    size_t mask;
+    size_t n_distinct;
+} ExactCounts;
+
+/*
+    Accuracy of a table shape, hash family and update rule
+*/
+typedef struct {
+    double epsilon, delta;    // Passed to cms_create_from_error
+    int width, depth;         // Resulting dimensions
+    cms_hash_family hash_family;
+    int conservative;
+    double over_share;        // Share of the distinct keys overestimated by more than the target
+    double max_error;         // Largest overestimate, relative to the sample size
+    int meets_target;
+} ShapeResult;
+
+/*
+    Update rate of a configuration meeting the target
+*/
+typedef struct {
+    const ShapeResult *shape;
+    cms_kernel kernel;
+    cms_update_mode update_mode;
+    cms_counter_width counters;
+    double keys_per_second;
+    size_t table_bytes;
+} TuneResult;
+
+static double tune_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <input> <epsilon> <delta> [options]\n", prog);
+    fprintf(stderr, "  Finds the fastest configuration whose estimates exceed the count by more than\n");
+    fprintf(stderr, "  epsilon * N for at most a share delta of the keys of a sample of <input>\n");
+    fprintf(stderr, "  --sample=N        keys of the sample (default: %d)\n", TUNE_SAMPLE_KEYS);
+    fprintf(stderr, "  --key=FORMAT      ipv4|ipv6|record:SIZE[:OFFSET:WIDTH], as for the program (default: ipv4)\n");
+    fprintf(stderr, "  --seed=N          seed of the hash parameters (default: %d)\n", CMS_DEFAULT_SEED);
+    fprintf(stderr, "  --repeat=N        timed updates of the sample per configuration (default: %d)\n", TUNE_REPEAT);
+    fprintf(stderr, "  --config=FILE     write the chosen configuration to FILE (default: standard output)\n");
+}
+
+/*
+    Parse the command line. Returns 0 on success, -1 on error.
+*/
+static int parse_tune_options(int argc, char **argv, TuneOptions *opts) {
+    if (argc < 4) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    char *end;
+    opts->input = argv[1];
+    opts->epsilon = strtod(argv[2], &end);
+    if (end == argv[2] || *end != '\0' || opts->epsilon <= 0.0 || opts->epsilon >= 1.0) {
+        fprintf(stderr, "Invalid epsilon: '%s' (in (0, 1))\n", argv[2]);
+        return -1;
+    }
+    opts->delta = strtod(argv[3], &end);
+    if (end == argv[3] || *end != '\0' || opts->delta <= 0.0 || opts->delta >= 1.0) {
+        fprintf(stderr, "Invalid delta: '%s' (in (0, 1))\n", argv[3]);
+        return -1;
+    }
+    opts->sample_keys = TUNE_SAMPLE_KEYS;
+    key_format_default(&opts->key_format);
+    opts->key_from_cli = 0;
+    opts->seed = CMS_DEFAULT_SEED;
+    opts->repeat = TUNE_REPEAT;
+    opts->config = NULL;
+
+    for (int i = 4; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--sample=", 9) == 0) {
+            long long n = strtoll(arg + 9, &end, 10);
+            if (end == arg + 9 || *end != '\0' || n < TUNE_BLOCKS) {
+                fprintf(stderr, "Invalid sample size: '%s' (at least %d keys)\n", arg + 9, TUNE_BLOCKS);
+                return -1;
+            }
+            opts->sample_keys = (size_t)n;
+        } else if (strncmp(arg, "--key=", 6) == 0) {
+            if (key_format_parse(arg + 6, &opts->key_format) == -1)
+                return -1;
+            opts->key_from_cli = 1;
+        } else if (strncmp(arg, "--seed=", 7) == 0) {
+            errno = 0;
+            opts->seed = strtoull(arg + 7, &end, 0);
+            if (end == arg + 7 || *end != '\0' || arg[7] == '-' || errno == ERANGE) {
+                fprintf(stderr, "Invalid seed: '%s'\n", arg + 7);
+                return -1;
+            }
+        } else if (strncmp(arg, "--repeat=", 9) == 0) {
+            long n = strtol(arg + 9, &end, 10);
+            if (end == arg + 9 || *end != '\0' || n < 1 || n > 100) {
+                fprintf(stderr, "Invalid repeat count: '%s' (1 to 100)\n", arg + 9);
+                return -1;
+            }
+            opts->repeat = (int)n;
+        } else if (strncmp(arg, "--config=", 9) == 0) {
+            opts->config = arg + 9;
+        } else {
+            fprintf(stderr, "Unknown option: '%s'\n", arg);
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Read the sample: TUNE_BLOCKS blocks of records spread evenly over the
+    file (the whole file if it is smaller), turned into the 4-byte keys of
+    the kernels. Returns the keys (n_keys of them), NULL on error.
+*/
+static uint8_t *read_sample(const TuneOptions *opts, const KeyFormat *fmt, off_t data_offset, size_t *n_keys) {
+    FILE *in = fopen(opts->input, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Error: cannot open %s\n", opts->input);
+        return NULL;
+    }
+    fseeko(in, 0, SEEK_END);
+    off_t file_size = ftello(in);
+    size_t n_records = (file_size > data_offset) ? (size_t)(file_size - data_offset) / fmt->record_size : 0;
+    if (n_records == 0) {
+        fprintf(stderr, "Error: %s holds no record\n", opts->input);
+        fclose(in);
+        return NULL;
+    }
+    size_t n_sample = (n_records < opts->sample_keys) ? n_records : opts->sample_keys;
+    uint8_t *records = malloc(n_sample * fmt->record_size);
+    uint8_t *keys = malloc(n_sample * IP_SIZE);
+    if (records == NULL || keys == NULL) {
+        fprintf(stderr, "Error: failed to allocate the sample (%zu keys)\n", n_sample);
+        free(records);
+        free(keys);
+        fclose(in);
+        return NULL;
+    }
+
+    size_t done = 0;
+    for (int b = 0; b < TUNE_BLOCKS && done < n_sample; b++) {
+        // Block b: the records from b / TUNE_BLOCKS of the file on
+        size_t first = (size_t)((double)n_records * b / TUNE_BLOCKS);
+        size_t count = n_sample * (b + 1) / TUNE_BLOCKS - done;
+        if (first + count > n_records)
+            first = n_records - count;
+        if (fseeko(in, data_offset + (off_t)first * fmt->record_size, SEEK_SET) != 0 ||
+            fread(records + done * fmt->record_size, fmt->record_size, count, in) != count) {
+            fprintf(stderr, "Error: failed to read %s\n", opts->input);
+            free(records);
+            free(keys);
+            fclose(in);
+            return NULL;
+        }
+        done += count;
+    }
+    fclose(in);
+
+    key_extract(fmt, records, n_sample, keys);
+    free(records);
+    *n_keys = n_sample;
+    return keys;
+}
+
+/*
+    Count the keys of the sample. Returns 0 on success, -1 on error.
+*/
+static int exact_counts_build(ExactCounts *exact, const uint8_t *keys, size_t n_keys) {
+    size_t slots = 1;
+    while (slots < 2 * n_keys)
+        slots <<= 1;
+    exact->keys = malloc(slots * sizeof(uint32_t));
+    exact->counts = calloc(slots, sizeof(uint64_t));
+    exact->mask = slots - 1;
+    exact->n_distinct = 0;
+    if (exact->keys == NULL || exact->counts == NULL) {
+        fprintf(stderr, "Error: failed to allocate the exact counts (%zu slots)\n", slots);
+        free(exact->keys);
+        free(exact->counts);
+        return -1;
+    }
+    for (size_t i = 0; i < n_keys; i++) {
+        uint32_t key = ip_to_int(keys + i * IP_SIZE);
+        size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & exact->mask;
+        while (exact->counts[slot] > 0 && exact->keys[slot] != key)
+            slot = (slot + 1) & exact->mask;
+        if (exact->counts[slot] == 0) {
+            exact->keys[slot] = key;
+            exact->n_distinct++;
+        }
+        exact->counts[slot]++;
+    }
+    return 0;
+}
+
+/*
+    Error of the sketch built from the sample, on every distinct key
+*/
+static void measure_error(const CountMinSketch *cms, const ExactCounts *exact, const uint8_t *distinct,
+                          uint64_t *estimates, size_t n_keys, double epsilon, ShapeResult *result) {
+    cms_batch_query(cms, distinct, exact->n_distinct, estimates);
+    double threshold = epsilon * (double)n_keys;
+    size_t n_over = 0, i = 0;
+    uint64_t max_error = 0;
+    for (size_t slot = 0; slot <= exact->mask; slot++) {
+        if (exact->counts[slot] == 0)
+            continue;
+        uint64_t error = (estimates[i] > exact->counts[slot]) ? estimates[i] - exact->counts[slot] : 0;
+        n_over += ((double)error > threshold);
+        if (error > max_error)
+            max_error = error;
+        i++;
+    }
+    result->over_share = (double)n_over / (double)exact->n_distinct;
+    result->max_error = (double)max_error / (double)n_keys;
+}
+
+/*
+    Best update time of the sample, over repeat runs from an empty table
+*/
+static double time_update(CountMinSketch *cms, const uint8_t *keys, size_t n_keys, int repeat) {
+    double best = 0.0;
+    for (int r = 0; r < repeat; r++) {
+        cms_clear(cms);
+        double start = tune_now();
+        cms_batch_update(cms, keys, n_keys);
+        double elapsed = tune_now() - start;
+        if (r == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+/*
+    Time every kernel, cache strategy and counter width for the shape.
+    Appends to results and returns the new count.
+*/
+static int time_shape(const ShapeResult *shape, const TuneOptions *opts, const uint8_t *keys, size_t n_keys,
+                      TuneResult *results, int n_results) {
+    static const cms_counter_width counters[] = { CMS_COUNTER_32, CMS_COUNTER_16, CMS_COUNTER_8 };
+    static const cms_kernel kernels[] = { CMS_KERNEL_SCALAR, CMS_KERNEL_AVX2, CMS_KERNEL_AVX512 };
+    static const cms_update_mode modes[] = { CMS_UPDATE_DIRECT, CMS_UPDATE_PREFETCH, CMS_UPDATE_PARTITION };
+
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) {
+            for (int m = 0; m < 3; m++) {
+                // The cache-aware paths hash with the scalar code: one kernel is enough
+                if (modes[m] != CMS_UPDATE_DIRECT && kernels[k] != CMS_KERNEL_SCALAR)
+                    continue;
+                // The vector kernels and the cache-aware paths only do the standard update of 32-bit cells
+                if ((kernels[k] != CMS_KERNEL_SCALAR || modes[m] != CMS_UPDATE_DIRECT) &&
+                    (counters[c] != CMS_COUNTER_32 || shape->conservative))
+                    continue;
+                if (kernels[k] != CMS_KERNEL_SCALAR &&
+                    (shape->hash_family != CMS_HASH_MULTISHIFT || !cms_kernel_supported(kernels[k])))
+                    continue;
+
+                CmsConfig config;
+                cms_config_default(&config);
+                config.hash_family = shape->hash_family;
+                config.conservative = shape->conservative;
+                config.counters = counters[c];
+                config.kernel = kernels[k];
+                config.update_mode = modes[m];
+                config.seed = opts->seed;
+                CountMinSketch *cms = cms_create_from_error_ex(shape->epsilon, shape->delta, &config);
+                if (cms == NULL)
+                    return -1;
+                double seconds = time_update(cms, keys, n_keys, opts->repeat);
+                results[n_results++] = (TuneResult){ shape, cms->kernel, cms->update_mode, counters[c],
+                                                     seconds > 0.0 ? n_keys / seconds : 0.0, cms_table_bytes(cms) };
+                cms_free(cms);
+            }
+        }
+    }
+    return n_results;
+}
+
+/*
+    Sketch every shape of the grid with every hash family and update rule
+    (scalar standard kernels: the other kernels give the same counts).
+    Returns the number of shapes measured, -1 on error.
+*/
+static int measure_shapes(const TuneOptions *opts, const uint8_t *keys, size_t n_keys, const ExactCounts *exact,
+                          const uint8_t *distinct, uint64_t *estimates, ShapeResult *shapes) {
+    printf("\n%-10s %-10s %8s %6s %-10s %-12s %10s %10s\n", "epsilon", "delta", "width", "depth", "hash",
+           "update", "above", "max_error");
+    int n_shapes = 0;
+    for (int e = 0; e < N_EPSILON_FACTORS; e++) {
+        for (int d = 0; d < N_DELTA_EXPONENTS; d++) {
+            for (int h = 0; h < N_HASH_FAMILIES; h++) {
+                for (int conservative = 0; conservative <= 1; conservative++) {
+                    ShapeResult *shape = &shapes[n_shapes];
+                    shape->epsilon = opts->epsilon * EPSILON_FACTORS[e];
+                    shape->delta = pow(opts->delta, DELTA_EXPONENTS[d]);
+                    shape->hash_family = (cms_hash_family)h;
+                    shape->conservative = conservative;
+                    if (shape->epsilon >= 1.0)
+                        continue;
+                    CmsConfig config;
+                    cms_config_default(&config);
+                    config.hash_family = shape->hash_family;
+                    config.conservative = conservative;
+                    config.kernel = CMS_KERNEL_SCALAR;
+                    config.update_mode = CMS_UPDATE_DIRECT;
+                    config.seed = opts->seed;
+                    CountMinSketch *cms = cms_create_from_error_ex(shape->epsilon, shape->delta, &config);
+                    if (cms == NULL)
+                        return -1;
+                    shape->width = cms->width;
+                    shape->depth = cms->depth;
+                    // The rounding of the multiply-shift widths can give a shape already measured
+                    int seen = 0;
+                    for (int s = 0; s < n_shapes && !seen; s++)
+                        seen = (shapes[s].width == shape->width && shapes[s].depth == shape->depth &&
+                                shapes[s].hash_family == shape->hash_family && shapes[s].conservative == conservative);
+                    if (seen) {
+                        cms_free(cms);
+                        continue;
+                    }
+                    cms_batch_update(cms, keys, n_keys);
+                    measure_error(cms, exact, distinct, estimates, n_keys, opts->epsilon, shape);
+                    shape->meets_target = (shape->over_share <= opts->delta);
+                    cms_free(cms);
+                    printf("%-10g %-10g %8d %6d %-10s %-12s %10.3g %10.3g%s\n", shape->epsilon, shape->delta,
+                           shape->width, shape->depth, cms_hash_family_name(shape->hash_family),
+                           conservative ? "conservative" : "standard", shape->over_share, shape->max_error,
+                           shape->meets_target ? "" : "  (misses the target)");
+                    n_shapes++;
+                }
+            }
+        }
+    }
+    return n_shapes;
+}
+
+/*
+    Key format as given to --key
+*/
+static void key_format_spec(const KeyFormat *fmt, char *text, size_t size) {
+    if (fmt->kind == KEY_RECORD)
+        snprintf(text, size, "record:%d:%d:%d", fmt->record_size, fmt->key_offset, fmt->key_width);
+    else
+        snprintf(text, size, "%s", key_format_kind_name(fmt->kind));
+}
+
+/*
+    Write the configuration as shell variables. Returns 0 on success, -1 on error.
+*/
+static int write_config(FILE *out, const TuneOptions *opts, const TuneResult *best, size_t n_keys,
+                        size_t n_distinct, double default_rate) {
+    const ShapeResult *shape = best->shape;
+    char key_text[64], key_spec[64];
+    key_format_describe(&opts->key_format, key_text, sizeof(key_text));
+    key_format_spec(&opts->key_format, key_spec, sizeof(key_spec));
+    fprintf(out, "# Written by cms_tune for %s (%s keys)\n", opts->input, key_text);
+    fprintf(out, "# Target: at most %g of the keys overestimated by more than %g * N\n", opts->delta, opts->epsilon);
+    fprintf(out, "# Sample: %zu keys, %zu distinct; observed: %g of the keys above the target, largest error %g * N\n",
+            n_keys, n_distinct, shape->over_share, shape->max_error);
+    fprintf(out, "# Sketch: %d x %d, %zu bytes; sample update: %.1f M keys/s (defaults at the target: %.1f M keys/s)\n",
+            shape->depth, shape->width, best->table_bytes, best->keys_per_second / 1e6, default_rate / 1e6);
+    fprintf(out, "EPSILON=%.17g\n", shape->epsilon);
+    fprintf(out, "DELTA=%.17g\n", shape->delta);
+    fprintf(out, "CMS_OPTIONS=\"--hash=%s --kernel=%s --update=%s --counters=%s --conservative=%s --seed=%llu",
+            cms_hash_family_name(shape->hash_family), cms_kernel_name(best->kernel),
+            cms_update_mode_name(best->update_mode), cms_counter_width_name(best->counters),
+            shape->conservative ? "on" : "off", (unsigned long long)opts->seed);
+    if (opts->key_from_cli)
+        fprintf(out, " --key=%s", key_spec);
+    fprintf(out, "\"\n");
+    return ferror(out) ? -1 : 0;
+}
+
+/*
+    1 if another shape of the same hash family and update rule meets the
+    target with no more rows nor columns: a larger table is not timed
+*/
+static int shape_dominated(const ShapeResult *shapes, int n_shapes, int s) {
+    for (int t = 0; t < n_shapes; t++)
+        if (t != s && shapes[t].meets_target && shapes[t].hash_family == shapes[s].hash_family &&
+            shapes[t].conservative == shapes[s].conservative && shapes[t].width <= shapes[s].width &&
+            shapes[t].depth <= shapes[s].depth &&
+            (shapes[t].width < shapes[s].width || shapes[t].depth < shapes[s].depth))
+            return 1;
+    return 0;
+}
+
+/*
+    Pick the fastest configuration meeting the target and write it.
+    Returns 0 on success, -1 on error.
+*/
+static int tune(const TuneOptions *opts, const uint8_t *keys, size_t n_keys, const ExactCounts *exact,
+                const uint8_t *distinct, uint64_t *estimates, ShapeResult *shapes, TuneResult *results) {
+    // 1. Accuracy of every shape, hash family and update rule
+    int n_shapes = measure_shapes(opts, keys, n_keys, exact, distinct, estimates, shapes);
+    if (n_shapes == -1)
+        return -1;
+
+    // 2. Update rate of the configurations meeting the target
+    int n_results = 0;
+    for (int s = 0; s < n_shapes && n_results != -1; s++)
+        if (shapes[s].meets_target && !shape_dominated(shapes, n_shapes, s))
+            n_results = time_shape(&shapes[s], opts, keys, n_keys, results, n_results);
+    if (n_results == -1)
+        return -1;
+    if (n_results == 0) {
+        fprintf(stderr, "Error: no configuration meets the target on the sample, try a larger epsilon or delta\n");
+        return -1;
+    }
+    const TuneResult *best = &results[0];
+    for (int r = 1; r < n_results; r++)
+        if (results[r].keys_per_second > best->keys_per_second ||
+            (results[r].keys_per_second == best->keys_per_second && results[r].table_bytes < best->table_bytes))
+            best = &results[r];
+
+    // Reference: the defaults of the program at the target itself
+    CmsConfig config;
+    cms_config_default(&config);
+    config.seed = opts->seed;
+    CountMinSketch *reference = cms_create_from_error_ex(opts->epsilon, opts->delta, &config);
+    if (reference == NULL)
+        return -1;
+    double default_seconds = time_update(reference, keys, n_keys, opts->repeat);
+    double default_rate = default_seconds > 0.0 ? n_keys / default_seconds : 0.0;
+    cms_free(reference);
+
+    printf("\n%d configurations timed; fastest: %d x %d %s %s, kernel %s, update %s, %s-bit counters, "
+           "%.1f M keys/s (defaults at the target: %.1f M keys/s)\n\n", n_results, best->shape->depth,
+           best->shape->width, cms_hash_family_name(best->shape->hash_family),
+           best->shape->conservative ? "conservative" : "standard", cms_kernel_name(best->kernel),
+           cms_update_mode_name(best->update_mode), cms_counter_width_name(best->counters),
+           best->keys_per_second / 1e6, default_rate / 1e6);
+
+    FILE *out = opts->config ? fopen(opts->config, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Error: cannot create %s\n", opts->config);
+        return -1;
+    }
+    int result = write_config(out, opts, best, n_keys, exact->n_distinct, default_rate);
+    if (opts->config && fclose(out) != 0)
+        result = -1;
+    if (result == -1)
+        fprintf(stderr, "Error: failed to write the configuration\n");
+    else if (opts->config)
+        printf("Configuration written to %s\n", opts->config);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    TuneOptions opts;
+    if (parse_tune_options(argc, argv, &opts) == -1)
+        return 1;
+    MPI_Offset data_offset;
+    if (key_format_probe(opts.input, opts.key_from_cli, &opts.key_format, &data_offset) == -1)
+        return 1;
+    // Wide keys are digested as the program does with the same seed
+    key_format_seed(&opts.key_format, opts.seed);
+
+    size_t n_keys;
+    uint8_t *keys = read_sample(&opts, &opts.key_format, (off_t)data_offset, &n_keys);
+    if (keys == NULL)
+        return 1;
+    ExactCounts exact;
+    if (exact_counts_build(&exact, keys, n_keys) == -1) {
+        free(keys);
+        return 1;
+    }
+    printf("Sample of %s: %zu keys, %zu distinct; target: at most %g of the keys above %g * N\n",
+           opts.input, n_keys, exact.n_distinct, opts.delta, opts.epsilon);
+
+    // Distinct keys in the input format, in the slot order of the exact counts
+    uint8_t *distinct = malloc(exact.n_distinct * IP_SIZE);
+    uint64_t *estimates = malloc(exact.n_distinct * sizeof(uint64_t));
+    int max_shapes = N_EPSILON_FACTORS * N_DELTA_EXPONENTS * N_HASH_FAMILIES * 2;
+    ShapeResult *shapes = malloc(max_shapes * sizeof(ShapeResult));
+    TuneResult *results = malloc(max_shapes * TUNE_MAX_VARIANTS * sizeof(TuneResult));
+    int status = 1;
+    if (distinct == NULL || estimates == NULL || shapes == NULL || results == NULL) {
+        fprintf(stderr, "Error: failed to allocate the tuner tables\n");
+    } else {
+        for (size_t slot = 0, i = 0; slot <= exact.mask; slot++) {
+            if (exact.counts[slot] == 0)
+                continue;
+            uint32_t key = exact.keys[slot];
+            uint8_t *out = distinct + (i++) * IP_SIZE;
+            out[0] = (uint8_t)(key >> 24);
+            out[1] = (uint8_t)(key >> 16);
+            out[2] = (uint8_t)(key >> 8);
+            out[3] = (uint8_t)key;
+        }
+        if (tune(&opts, keys, n_keys, &exact, distinct, estimates, shapes, results) == 0)
+            status = 0;
+    }
+
+    free(keys);
+    free(exact.keys);
+    free(exact.counts);
+    free(distinct);
+    free(estimates);
+    free(shapes);
+    free(results);
+    return status;
+}
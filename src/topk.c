@@ -0,0 +1,265 @@
+#include "headers/topk.h"
+#include "headers/util.h"
+
+#define TOPK_BLOCK 4096 // Keys updated before their estimates are offered
+
+/*
+    Create a tracker of the capacity most frequent keys.
+    Returns NULL on error.
+*/
+TopK *topk_create(int capacity) {
+    if (capacity < 1) {
+        fprintf(stderr, "Error: the top-k capacity must be positive.\n");
+        return NULL;
+    }
+    TopK *topk = calloc(1, sizeof(TopK));
+    if (topk == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for TopK structure.\n");
+        return NULL;
+    }
+    topk->capacity = capacity;
+    topk->index_bits = 1;
+    while ((1 << topk->index_bits) < 2 * capacity)
+        topk->index_bits++;
+    topk->heap = malloc(capacity * sizeof(TopKEntry));
+    topk->index = calloc((size_t)1 << topk->index_bits, sizeof(int));
+    if (topk->heap == NULL || topk->index == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for the top-k heap.\n");
+        topk_free(topk);
+        return NULL;
+    }
+    return topk;
+}
+
+void topk_free(TopK *topk) {
+    if (topk == NULL)
+        return;
+    free(topk->heap);
+    free(topk->index);
+    free(topk);
+}
+
+void topk_clear(TopK *topk) {
+    topk->size = 0;
+    memset(topk->index, 0, ((size_t)1 << topk->index_bits) * sizeof(int));
+}
+
+/* ---------------- Index (linear probing) ---------------- */
+
+static inline int index_home(const TopK *topk, uint32_t key) {
+    return (int)((key * 2654435769U) >> (32 - topk->index_bits));
+}
+
+/*
+    Slot of key in the index, or -1 if it is not tracked
+*/
+static int index_find(const TopK *topk, uint32_t key) {
+    int mask = (1 << topk->index_bits) - 1;
+    for (int s = index_home(topk, key); topk->index[s] != 0; s = (s + 1) & mask) {
+        if (topk->heap[topk->index[s] - 1].key == key)
+            return s;
+    }
+    return -1;
+}
+
+static void index_insert(TopK *topk, int pos) {
+    int mask = (1 << topk->index_bits) - 1;
+    int s = index_home(topk, topk->heap[pos].key);
+    while (topk->index[s] != 0)
+        s = (s + 1) & mask;
+    topk->index[s] = pos + 1;
+    topk->heap[pos].slot = s;
+}
+
+/*
+    Remove a slot, shifting back the following entries of the probe
+    sequence so that lookups never stop on a hole
+*/
+static void index_remove(TopK *topk, int s) {
+    int mask = (1 << topk->index_bits) - 1;
+    int hole = s;
+    topk->index[hole] = 0;
+    for (int next = (hole + 1) & mask; topk->index[next] != 0; next = (next + 1) & mask) {
+        int home = index_home(topk, topk->heap[topk->index[next] - 1].key);
+        // Move the entry if its home is not in the cyclic range (hole, next]
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            topk->index[hole] = topk->index[next];
+            topk->heap[topk->index[hole] - 1].slot = hole;
+            topk->index[next] = 0;
+            hole = next;
+        }
+    }
+}
+
+/* ---------------- Heap ---------------- */
+
+static inline void heap_set(TopK *topk, int pos, TopKEntry entry) {
+    topk->heap[pos] = entry;
+    topk->index[entry.slot] = pos + 1;
+}
+
+static void heap_sift_down(TopK *topk, int pos) {
+    TopKEntry entry = topk->heap[pos];
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= topk->size)
+            break;
+        if (child + 1 < topk->size && topk->heap[child + 1].count < topk->heap[child].count)
+            child++;
+        if (topk->heap[child].count >= entry.count)
+            break;
+        heap_set(topk, pos, topk->heap[child]);
+        pos = child;
+    }
+    heap_set(topk, pos, entry);
+}
+
+static void heap_sift_up(TopK *topk, int pos) {
+    TopKEntry entry = topk->heap[pos];
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (topk->heap[parent].count <= entry.count)
+            break;
+        heap_set(topk, pos, topk->heap[parent]);
+        pos = parent;
+    }
+    heap_set(topk, pos, entry);
+}
+
+/*
+    Record count as the estimate of key. A tracked key gets its estimate
+    raised; an untracked one enters if the heap is not full or if it beats
+    the smallest tracked estimate, which is then evicted.
+*/
+void topk_offer(TopK *topk, uint32_t key, uint64_t count) {
+    // Fast path: a key that does not beat the minimum changes nothing
+    // (if tracked, its estimate is already the minimum)
+    if (topk->size == topk->capacity && count <= topk->heap[0].count)
+        return;
+
+    int s = index_find(topk, key);
+    if (s >= 0) {
+        int pos = topk->index[s] - 1;
+        if (count > topk->heap[pos].count) {
+            topk->heap[pos].count = count;
+            heap_sift_down(topk, pos);
+        }
+        return;
+    }
+
+    int pos;
+    if (topk->size < topk->capacity) {
+        pos = topk->size++;
+    } else {
+        // Evict the smallest estimate
+        pos = 0;
+        index_remove(topk, topk->heap[0].slot);
+    }
+    topk->heap[pos].key = key;
+    topk->heap[pos].count = count;
+    index_insert(topk, pos);
+    if (pos == 0)
+        heap_sift_down(topk, 0);
+    else
+        heap_sift_up(topk, pos);
+}
+
+static int entry_compare_desc(const void *a, const void *b) {
+    const TopKEntry *x = a, *y = b;
+    if (x->count != y->count)
+        return (x->count < y->count) ? 1 : -1;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/*
+    Copy the tracked keys to out, largest estimates first.
+    Returns the number of entries written.
+*/
+int topk_sorted(const TopK *topk, TopKEntry *out) {
+    memcpy(out, topk->heap, topk->size * sizeof(TopKEntry));
+    qsort(out, topk->size, sizeof(TopKEntry), entry_compare_desc);
+    return topk->size;
+}
+
+/* ---------------- Sketch integration ---------------- */
+
+/*
+    Offer the current estimate of every key of the batch
+*/
+void cms_topk_offer_batch(const CountMinSketch *cms, TopK *topk, const uint8_t *keys, size_t n_keys) {
+    for (size_t i = 0; i < n_keys; i++) {
+        uint32_t key = ip_to_int(&keys[i * IP_SIZE]);
+        topk_offer(topk, key, cms_query(cms, key));
+    }
+}
+
+/*
+    Batch update that also feeds the tracker. The keys are counted by
+    blocks with the selected batch kernel, then the estimates of the
+    block, still in cache, are offered to the tracker.
+*/
+void cms_topk_batch_update(CountMinSketch *cms, TopK *topk, const uint8_t *keys, size_t n_keys) {
+    for (size_t start = 0; start < n_keys; start += TOPK_BLOCK) {
+        size_t n = (n_keys - start < TOPK_BLOCK) ? n_keys - start : TOPK_BLOCK;
+        cms_batch_update(cms, keys + start * IP_SIZE, n);
+        cms_topk_offer_batch(cms, topk, keys + start * IP_SIZE, n);
+    }
+}
+
+/*
+    Distributed top-k: the tracked keys of every rank are gathered on
+    root and re-estimated with the global sketch (which must already hold
+    the reduced counts on root). A global heavy hitter is heavy in the
+    local sketch of at least one rank, so it is among the candidates as
+    long as the local trackers are not too small.
+    Collective over comm. On root topk holds the global top-k, elsewhere
+    it is left unchanged.
+    Returns 0 on success, -1 on error.
+*/
+int topk_merge(TopK *topk, const CountMinSketch *global, int root, MPI_Comm comm) {
+    int rank, comm_sz;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_sz);
+
+    uint32_t *local_keys = malloc(topk->capacity * sizeof(uint32_t));
+    int *counts = NULL, *displs = NULL;
+    uint32_t *candidates = NULL;
+    int error = (local_keys == NULL);
+    if (rank == root) {
+        counts = malloc(comm_sz * sizeof(int));
+        displs = malloc(comm_sz * sizeof(int));
+        candidates = malloc((size_t)comm_sz * topk->capacity * sizeof(uint32_t));
+        error |= (counts == NULL || displs == NULL || candidates == NULL);
+    }
+    // Every rank must agree before entering the gathers
+    MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_INT, MPI_LOR, comm);
+    if (error) {
+        fprintf(stderr, "Error: failed to allocate the top-k merge buffers on rank %d\n", rank);
+        free(local_keys); free(counts); free(displs); free(candidates);
+        return -1;
+    }
+
+    int n_local = topk->size;
+    for (int i = 0; i < n_local; i++)
+        local_keys[i] = topk->heap[i].key;
+    MPI_Gather(&n_local, 1, MPI_INT, counts, 1, MPI_INT, root, comm);
+    if (rank == root) {
+        displs[0] = 0;
+        for (int r = 1; r < comm_sz; r++)
+            displs[r] = displs[r - 1] + counts[r - 1];
+    }
+    MPI_Gatherv(local_keys, n_local, MPI_UINT32_T, candidates, counts, displs, MPI_UINT32_T, root, comm);
+
+    if (rank == root) {
+        int n_candidates = displs[comm_sz - 1] + counts[comm_sz - 1];
+        topk_clear(topk);
+        for (int i = 0; i < n_candidates; i++)
+            topk_offer(topk, candidates[i], cms_query(global, candidates[i]));
+    }
+
+    free(local_keys);
+    free(counts);
+    free(displs);
+    free(candidates);
+    return 0;
+}
@@ -13,13 +13,3 @@ void safe_cleanup(uint8_t *buffer, CountMinSketch *cms, MPI_File *fh) {
     MPI_Finalize();
 }
 
-/*
-    Convert an IPv4-mapped address to a 32-bit integer
-*/
-uint32_t ip_to_int(const uint8_t *ip_addr) {
-    // Assuming ip_addr is a valid IPv4-mapped  address
-    return (uint32_t)(ip_addr[12] << 24 |
-                      ip_addr[13] << 16 |
-                      ip_addr[14] << 8  |
-                      ip_addr[15]);
-}
\ No newline at end of file